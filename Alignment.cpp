@@ -0,0 +1,365 @@
+#include "Alignment.h"
+
+#include <librealsense2/rsutil.h>
+
+#include <string.h>
+#include <algorithm>
+
+AlignmentTable::AlignmentTable() :
+	myScale(0.f),
+	myDirection(Direction::ColorToDepth),
+	myValid(false),
+	myPinhole(true),
+	myTableWidth(0),
+	myBufferSize(0)
+{
+	memset(&myDepth, 0, sizeof(myDepth));
+	memset(&myColor, 0, sizeof(myColor));
+	memset(&myExtrinsics, 0, sizeof(myExtrinsics));
+}
+
+// Brown-Conrady without coefficients leaves points where the pinhole model
+// puts them. The other models divide by theirs, so they always need the
+// full projection.
+static bool
+isPinhole(const rs2_intrinsics& intrinsics)
+{
+	if (intrinsics.model == RS2_DISTORTION_NONE)
+		return true;
+	if (intrinsics.model != RS2_DISTORTION_MODIFIED_BROWN_CONRADY &&
+		intrinsics.model != RS2_DISTORTION_INVERSE_BROWN_CONRADY &&
+		intrinsics.model != RS2_DISTORTION_BROWN_CONRADY)
+		return false;
+	for (float coeff : intrinsics.coeffs)
+	{
+		if (coeff != 0.f)
+			return false;
+	}
+	return true;
+}
+
+bool
+AlignmentTable::update(const rs2_intrinsics& depth, const rs2_intrinsics& color,
+					   const rs2_extrinsics& depthToColor, float scale, Direction direction)
+{
+	if (myValid && direction == myDirection && scale == myScale &&
+		memcmp(&depth, &myDepth, sizeof(depth)) == 0 &&
+		memcmp(&color, &myColor, sizeof(color)) == 0 &&
+		memcmp(&depthToColor, &myExtrinsics, sizeof(depthToColor)) == 0)
+		return false;
+
+	myDepth = depth;
+	myColor = color;
+	myExtrinsics = depthToColor;
+	myScale = scale;
+	myDirection = direction;
+	myValid = true;
+	myPinhole = isPinhole(color);
+
+	bool corners = direction == Direction::DepthToColor;
+	int tableHeight = corners ? depth.height + 1 : depth.height;
+	myTableWidth = corners ? depth.width + 1 : depth.width;
+	float offset = corners ? -0.5f : 0.f;
+
+	size_t count = (size_t)myTableWidth * tableHeight;
+	myRayX.resize(count);
+	myRayY.resize(count);
+	myRayZ.resize(count);
+
+	// Same pixel convention as rs2::align and DeprojectionTable.
+	const float* r = depthToColor.rotation;
+	for (int y = 0; y < tableHeight; ++y)
+	{
+		for (int x = 0; x < myTableWidth; ++x)
+		{
+			const float pixel[2] = { x + offset, y + offset };
+			float ray[3];
+			rs2_deproject_pixel_to_point(ray, &depth, pixel, scale);
+
+			// The rotation is column major, as in rs2_transform_point_to_point.
+			size_t i = (size_t)y * myTableWidth + x;
+			myRayX[i] = r[0] * ray[0] + r[3] * ray[1] + r[6] * ray[2];
+			myRayY[i] = r[1] * ray[0] + r[4] * ray[1] + r[7] * ray[2];
+			myRayZ[i] = r[2] * ray[0] + r[5] * ray[1] + r[8] * ray[2];
+		}
+	}
+
+	size_t bufferSize = corners ? (size_t)color.width * color.height : 0;
+	if (bufferSize != myBufferSize)
+	{
+		myBuffer.reset(bufferSize ? new std::atomic<uint16_t>[bufferSize] : nullptr);
+		myBufferSize = bufferSize;
+	}
+	return true;
+}
+
+// Projects a point in color camera space to a color pixel. False if it's
+// behind the camera.
+template <bool Pinhole>
+static inline bool
+project(const rs2_intrinsics& intrinsics, const float point[3], float pixel[2])
+{
+	if (!(point[2] > 0.f))
+		return false;
+	if (Pinhole)
+	{
+		float inverse = 1.f / point[2];
+		pixel[0] = point[0] * inverse * intrinsics.fx + intrinsics.ppx;
+		pixel[1] = point[1] * inverse * intrinsics.fy + intrinsics.ppy;
+	}
+	else
+		rs2_project_point_to_pixel(pixel, &intrinsics, point);
+	return true;
+}
+
+template <bool Pinhole>
+void
+AlignmentTable::gatherRows(const uint16_t* depth, const uint8_t* color, int colorStride,
+						   uint8_t* dst, bool flip, uint16_t clipNear, uint16_t clipFar,
+						   int begin, int end) const
+{
+	const int width = myDepth.width;
+	const int height = myDepth.height;
+	const float colorWidth = (float)myColor.width;
+	const float colorHeight = (float)myColor.height;
+	const float* t = myExtrinsics.translation;
+
+	for (int y = begin; y < end; ++y)
+	{
+		int row = flip ? height - 1 - y : y;
+		const uint16_t* src = depth + (size_t)row * width;
+		const float* rayX = &myRayX[(size_t)row * width];
+		const float* rayY = &myRayY[(size_t)row * width];
+		const float* rayZ = &myRayZ[(size_t)row * width];
+		uint8_t* out = dst + (size_t)y * width * 4;
+
+		for (int x = 0; x < width; ++x, out += 4)
+		{
+			uint16_t d = src[x];
+			float point[3] = { d * rayX[x] + t[0], d * rayY[x] + t[1], d * rayZ[x] + t[2] };
+			float pixel[2];
+
+			// Rounded to the nearest pixel. Written so NaNs fail too.
+			if (d == 0 || d < clipNear || d > clipFar || !project<Pinhole>(myColor, point, pixel) ||
+				!(pixel[0] + 0.5f >= 0.f && pixel[0] + 0.5f < colorWidth &&
+				  pixel[1] + 0.5f >= 0.f && pixel[1] + 0.5f < colorHeight))
+			{
+				memset(out, 0, 4);
+				continue;
+			}
+
+			const uint8_t* in = color + (size_t)(int)(pixel[1] + 0.5f) * colorStride +
+				(size_t)(int)(pixel[0] + 0.5f) * 4;
+			out[0] = in[0];
+			out[1] = in[1];
+			out[2] = in[2];
+			out[3] = 255;
+		}
+	}
+}
+
+void
+AlignmentTable::gatherColor(const uint16_t* depth, const uint8_t* color, int colorStride,
+							uint8_t* dst, bool flip, uint16_t clipNear, uint16_t clipFar,
+							int begin, int end) const
+{
+	if (!myValid || myDirection != Direction::ColorToDepth)
+		return;
+	if (myPinhole)
+		gatherRows<true>(depth, color, colorStride, dst, flip, clipNear, clipFar, begin, end);
+	else
+		gatherRows<false>(depth, color, colorStride, dst, flip, clipNear, clipFar, begin, end);
+}
+
+void
+AlignmentTable::clearDepth(int begin, int end)
+{
+	if (!myBuffer)
+		return;
+	for (size_t i = (size_t)begin * myColor.width; i < (size_t)end * myColor.width; ++i)
+		myBuffer[i].store(0xFFFF, std::memory_order_relaxed);
+}
+
+// Keeps the nearest depth. The passes are separated by the worker pool's
+// join, so no ordering beyond the value itself is needed. Without other
+// threads scattering at the same time a plain store does, which saves the
+// locked instruction on every write.
+template <bool Concurrent>
+static inline void
+keepNearest(std::atomic<uint16_t>& slot, uint16_t value)
+{
+	uint16_t current = slot.load(std::memory_order_relaxed);
+	if (!Concurrent)
+	{
+		if (value < current)
+			slot.store(value, std::memory_order_relaxed);
+		return;
+	}
+	while (value < current &&
+		!slot.compare_exchange_weak(current, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+template <bool Pinhole, bool Concurrent>
+void
+AlignmentTable::scatterRows(const uint16_t* depth, uint16_t clipNear, uint16_t clipFar,
+							int begin, int end)
+{
+	const int width = myDepth.width;
+	const int colorWidth = myColor.width;
+	const int colorHeight = myColor.height;
+	const float* t = myExtrinsics.translation;
+
+	// Each row is projected in chunks before anything is written, so the
+	// pinhole projection runs without branches and can be vectorized. The
+	// corners are kept already offset by half a pixel for rounding.
+	const int Chunk = 256;
+	float left[Chunk], top[Chunk], right[Chunk], bottom[Chunk];
+
+	for (int y = begin; y < end; ++y)
+	{
+		const uint16_t* src = depth + (size_t)y * width;
+
+		for (int chunk = 0; chunk < width; chunk += Chunk)
+		{
+			const int count = std::min(Chunk, width - chunk);
+			const uint16_t* in = src + chunk;
+			size_t first = (size_t)y * myTableWidth + chunk;
+			const float* rayX0 = &myRayX[first];
+			const float* rayY0 = &myRayY[first];
+			const float* rayZ0 = &myRayZ[first];
+			// The bottom right corner is the top left one of the pixel
+			// diagonally below.
+			const float* rayX1 = rayX0 + myTableWidth + 1;
+			const float* rayY1 = rayY0 + myTableWidth + 1;
+			const float* rayZ1 = rayZ0 + myTableWidth + 1;
+
+			for (int i = 0; i < count; ++i)
+			{
+				const float d = (float)in[i];
+				const float p0[3] = { d * rayX0[i] + t[0], d * rayY0[i] + t[1], d * rayZ0[i] + t[2] };
+				const float p1[3] = { d * rayX1[i] + t[0], d * rayY1[i] + t[1], d * rayZ1[i] + t[2] };
+				float c0[2], c1[2];
+				bool front;
+				if (Pinhole)
+				{
+					float inverse0 = 1.f / p0[2];
+					float inverse1 = 1.f / p1[2];
+					c0[0] = p0[0] * inverse0 * myColor.fx + myColor.ppx;
+					c0[1] = p0[1] * inverse0 * myColor.fy + myColor.ppy;
+					c1[0] = p1[0] * inverse1 * myColor.fx + myColor.ppx;
+					c1[1] = p1[1] * inverse1 * myColor.fy + myColor.ppy;
+					front = p0[2] > 0.f && p1[2] > 0.f;
+				}
+				else
+					front = project<false>(myColor, p0, c0) && project<false>(myColor, p1, c1);
+
+				// Behind the camera fails the bounds check below.
+				left[i] = front ? c0[0] + 0.5f : -1.f;
+				top[i] = c0[1] + 0.5f;
+				right[i] = c1[0] + 0.5f;
+				bottom[i] = c1[1] + 0.5f;
+			}
+
+			for (int i = 0; i < count; ++i)
+			{
+				uint16_t d = in[i];
+				if (d == 0 || d < clipNear || d > clipFar)
+					continue;
+
+				// Like rs2::align, a pixel that isn't entirely inside the
+				// color image is dropped. Written so NaNs fail too.
+				if (!(left[i] >= 0.f && top[i] >= 0.f &&
+					  right[i] < (float)colorWidth && bottom[i] < (float)colorHeight))
+					continue;
+
+				int x0 = (int)left[i];
+				int y0 = (int)top[i];
+				int x1 = (int)right[i];
+				int y1 = (int)bottom[i];
+				for (int cy = y0; cy <= y1; ++cy)
+				{
+					std::atomic<uint16_t>* row = &myBuffer[(size_t)cy * colorWidth];
+					for (int cx = x0; cx <= x1; ++cx)
+						keepNearest<Concurrent>(row[cx], d);
+				}
+			}
+		}
+	}
+}
+
+void
+AlignmentTable::scatterDepth(const uint16_t* depth, uint16_t clipNear, uint16_t clipFar,
+							 bool concurrent, int begin, int end)
+{
+	if (!myValid || myDirection != Direction::DepthToColor)
+		return;
+	if (myPinhole && concurrent)
+		scatterRows<true, true>(depth, clipNear, clipFar, begin, end);
+	else if (myPinhole)
+		scatterRows<true, false>(depth, clipNear, clipFar, begin, end);
+	else if (concurrent)
+		scatterRows<false, true>(depth, clipNear, clipFar, begin, end);
+	else
+		scatterRows<false, false>(depth, clipNear, clipFar, begin, end);
+}
+
+void
+AlignmentTable::resolveDepth(float* dst, bool flip, int begin, int end) const
+{
+	if (!myBuffer)
+		return;
+
+	const int width = myColor.width;
+	const int height = myColor.height;
+	for (int y = begin; y < end; ++y)
+	{
+		int row = flip ? height - 1 - y : y;
+		const std::atomic<uint16_t>* in = &myBuffer[(size_t)row * width];
+		float* out = dst + (size_t)y * width;
+		for (int x = 0; x < width; ++x)
+		{
+			uint16_t d = in[x].load(std::memory_order_relaxed);
+			out[x] = d == 0xFFFF ? 0.f : d * myScale;
+		}
+	}
+}
+
+bool
+isColorFormatSupported(rs2_format format)
+{
+	return format == RS2_FORMAT_BGRA8 || format == RS2_FORMAT_RGBA8 ||
+		format == RS2_FORMAT_BGR8 || format == RS2_FORMAT_RGB8;
+}
+
+void
+convertColorRows(const uint8_t* src, int stride, rs2_format format, int width, int height,
+				 uint8_t* dst, bool flip, int begin, int end)
+{
+	// Byte of the source pixel that goes into blue, and red.
+	bool rgb = format == RS2_FORMAT_RGBA8 || format == RS2_FORMAT_RGB8;
+	int blue = rgb ? 2 : 0;
+	int red = rgb ? 0 : 2;
+	int bytes = format == RS2_FORMAT_BGR8 || format == RS2_FORMAT_RGB8 ? 3 : 4;
+
+	for (int y = begin; y < end; ++y)
+	{
+		const uint8_t* in = src + (size_t)(flip ? height - 1 - y : y) * stride;
+		uint8_t* out = dst + (size_t)y * width * 4;
+
+		if (format == RS2_FORMAT_BGRA8)
+		{
+			memcpy(out, in, (size_t)width * 4);
+			continue;
+		}
+
+		for (int x = 0; x < width; ++x, in += bytes, out += 4)
+		{
+			out[0] = in[blue];
+			out[1] = in[1];
+			out[2] = in[red];
+			out[3] = bytes == 4 ? in[3] : 255;
+		}
+	}
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Maps depth pixels into the color camera for the aligned Image modes.
+//
+// Where a depth pixel lands in the color image depends on its depth, but
+// only linearly: with the ray through the pixel rotated into the color
+// camera and scaled to one depth unit, the point in color camera space is
+// depth * ray + translation. The table caches those rotated rays, so per
+// pixel only that multiply-add and the color camera's projection are left,
+// and the deprojection and rotation only run again when the intrinsics,
+// extrinsics or depth scale change.
+//
+// Color aligned to depth gathers: every depth pixel looks up the color
+// pixel its center projects to. Depth aligned to color scatters: every
+// depth pixel covers the rectangle its corners project to, like
+// rs2::align does, and the nearest depth wins where rectangles overlap.
+// Scattering from several threads resolves that with an atomic minimum
+// per color pixel, so bands of depth rows can run in parallel.
+class AlignmentTable
+{
+public:
+	enum class Direction : int32_t
+	{
+		// Color sampled at every depth pixel, output at depth resolution.
+		ColorToDepth = 0,
+		// Depth splatted onto the color image, output at color resolution.
+		DepthToColor,
+	};
+
+	AlignmentTable();
+
+	// Rebuilds the table if anything it was built from differs. 'scale' is
+	// meters per depth unit. Returns true if it was rebuilt.
+	bool		update(const rs2_intrinsics& depth, const rs2_intrinsics& color,
+					   const rs2_extrinsics& depthToColor, float scale, Direction direction);
+
+	// Color aligned to depth for output rows [begin, end). 'color' is BGRA8
+	// at the color stream's size, 'dst' BGRA8 at the depth stream's size.
+	// Depth pixels without depth, outside [clipNear, clipFar] or landing
+	// outside the color image become transparent black. With 'flip' output
+	// row y comes from depth row height - 1 - y.
+	void		gatherColor(const uint16_t* depth, const uint8_t* color, int colorStride,
+							uint8_t* dst, bool flip, uint16_t clipNear, uint16_t clipFar,
+							int begin, int end) const;
+
+	// Depth aligned to color takes three passes over the frame, each of
+	// which can be split into bands across threads, but every pass has to
+	// finish before the next starts.
+	// Empties color rows [begin, end) of the depth buffer.
+	void		clearDepth(int begin, int end);
+	// Splats depth rows [begin, end) into the buffer. 'concurrent' has to be
+	// set if other threads scatter other rows at the same time.
+	void		scatterDepth(const uint16_t* depth, uint16_t clipNear, uint16_t clipFar,
+							 bool concurrent, int begin, int end);
+	// Writes color rows [begin, end) of the buffer to 'dst' as R32Float
+	// meters, 0 where no depth landed.
+	void		resolveDepth(float* dst, bool flip, int begin, int end) const;
+
+	int			depthWidth() const { return myDepth.width; }
+	int			depthHeight() const { return myDepth.height; }
+	int			colorWidth() const { return myColor.width; }
+	int			colorHeight() const { return myColor.height; }
+
+private:
+	template <bool Pinhole>
+	void		gatherRows(const uint16_t* depth, const uint8_t* color, int colorStride,
+						   uint8_t* dst, bool flip, uint16_t clipNear, uint16_t clipFar,
+						   int begin, int end) const;
+	template <bool Pinhole, bool Concurrent>
+	void		scatterRows(const uint16_t* depth, uint16_t clipNear, uint16_t clipFar,
+							int begin, int end);
+
+	rs2_intrinsics		myDepth;
+	rs2_intrinsics		myColor;
+	rs2_extrinsics		myExtrinsics;
+	float				myScale;
+	Direction			myDirection;
+	bool				myValid;
+	// The color camera has no distortion to apply, so projecting is only
+	// the pinhole division.
+	bool				myPinhole;
+
+	// Rotated rays per depth unit as separate planes. Through pixel centers
+	// for ColorToDepth, one per pixel. Through pixel corners for
+	// DepthToColor, (width + 1) x (height + 1) of them, the bottom right
+	// corner of a pixel being the top left of the one diagonally below it.
+	int					myTableWidth;
+	std::vector<float>	myRayX;
+	std::vector<float>	myRayY;
+	std::vector<float>	myRayZ;
+
+	// DepthToColor's depth buffer in depth units, 0xFFFF where empty.
+	std::unique_ptr<std::atomic<uint16_t>[]>	myBuffer;
+	size_t				myBufferSize;
+};
+
+// Whether convertColorRows() handles the format: BGRA8, RGBA8, BGR8 and
+// RGB8.
+bool	isColorFormatSupported(rs2_format format);
+
+// Copies rows [begin, end) of a color frame in a supported format into
+// BGRA8, flipping like the other modes when 'flip' is set.
+void	convertColorRows(const uint8_t* src, int stride, rs2_format format, int width,
+						 int height, uint8_t* dst, bool flip, int begin, int end);
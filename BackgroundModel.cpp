@@ -0,0 +1,222 @@
+#include "BackgroundModel.h"
+#include "SimdDetect.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const float Infinity = std::numeric_limits<float>::infinity();
+
+bool
+BackgroundModel::Settings::operator==(const Settings& other) const
+{
+	return statistic == other.statistic && deviations == other.deviations &&
+		margin == other.margin;
+}
+
+BackgroundModel::BackgroundModel() :
+	myWidth(0),
+	myHeight(0),
+	myLearning(false),
+	myHasModel(false),
+	myModelChanged(false),
+	myLearned(0),
+	myTarget(0)
+{
+}
+
+void
+BackgroundModel::resize(int width, int height)
+{
+	if (width == myWidth && height == myHeight)
+		return;
+
+	myWidth = width;
+	myHeight = height;
+	size_t count = (size_t)width * height;
+	myDepth.resize(count);
+	myCount.assign(count, 0.f);
+	myMean.assign(count, 0.f);
+	mySquares.assign(count, 0.f);
+	myMin.assign(count, Infinity);
+	myCutoff.assign(count, Infinity);
+
+	// Learning that was under way starts over at the new size.
+	myHasModel = false;
+	myModelChanged = false;
+	myLearned = 0;
+}
+
+void
+BackgroundModel::startLearning(int frames)
+{
+	std::fill(myCount.begin(), myCount.end(), 0.f);
+	std::fill(myMean.begin(), myMean.end(), 0.f);
+	std::fill(mySquares.begin(), mySquares.end(), 0.f);
+	std::fill(myMin.begin(), myMin.end(), Infinity);
+
+	myLearning = true;
+	myLearned = 0;
+	myTarget = std::max(frames, 1);
+}
+
+void
+BackgroundModel::learnRows(int begin, int end)
+{
+	size_t first = (size_t)begin * myWidth;
+	size_t last = (size_t)end * myWidth;
+	const float* depth = myDepth.data();
+	float* count = myCount.data();
+	float* mean = myMean.data();
+	float* squares = mySquares.data();
+	float* nearest = myMin.data();
+
+	// Only runs for the frames being learned, so it's left to the compiler.
+	// No branches, and the division only where there's depth.
+	for (size_t i = first; i < last; ++i)
+	{
+		float z = depth[i];
+		float valid = z > 0.f ? 1.f : 0.f;
+		float n = count[i] + valid;
+		float delta = z - mean[i];
+		float m = mean[i] + valid * delta / std::max(n, 1.f);
+		squares[i] += valid * delta * (z - m);
+		mean[i] = m;
+		count[i] = n;
+		nearest[i] = std::min(nearest[i], z > 0.f ? z : Infinity);
+	}
+}
+
+void
+BackgroundModel::finishFrame()
+{
+	if (!myLearning)
+		return;
+	if (++myLearned < myTarget)
+		return;
+
+	myLearning = false;
+	myHasModel = true;
+	myModelChanged = true;
+}
+
+bool
+BackgroundModel::configure(const Settings& settings)
+{
+	if (myLearning || !myHasModel)
+		return false;
+	if (!myModelChanged && settings == mySettings)
+		return false;
+
+	mySettings = settings;
+	myModelChanged = false;
+	return true;
+}
+
+void
+BackgroundModel::updateCutoffs(int begin, int end)
+{
+	size_t first = (size_t)begin * myWidth;
+	size_t last = (size_t)end * myWidth;
+	float deviations = std::max(mySettings.deviations, 0.f);
+	float margin = std::max(mySettings.margin, 0.f);
+
+	for (size_t i = first; i < last; ++i)
+	{
+		float n = myCount[i];
+		if (n <= 0.f)
+		{
+			myCutoff[i] = Infinity;
+			continue;
+		}
+
+		if (mySettings.statistic == Statistic::Nearest)
+			myCutoff[i] = myMin[i] - margin;
+		else
+		{
+			float sigma = std::sqrt(mySquares[i] / n);
+			myCutoff[i] = myMean[i] - std::max(deviations * sigma, margin);
+		}
+	}
+}
+
+void
+BackgroundModel::maskRows(uint8_t* dst, bool flip, int begin, int end) const
+{
+	for (int y = begin; y < end; ++y)
+	{
+		int row = flip ? myHeight - 1 - y : y;
+		const float* depth = &myDepth[(size_t)row * myWidth];
+		const float* cutoff = &myCutoff[(size_t)row * myWidth];
+		uint8_t* out = dst + (size_t)y * myWidth;
+
+		int x = 0;
+#if defined(SIMD_SSE2)
+		// The all-ones compare results saturate to 0xFF when packed down.
+		const __m128 zero = _mm_setzero_ps();
+		for (; x + 16 <= myWidth; x += 16)
+		{
+			__m128i m[4];
+			for (int i = 0; i < 4; i++)
+			{
+				__m128 z = _mm_loadu_ps(depth + x + i * 4);
+				__m128 c = _mm_loadu_ps(cutoff + x + i * 4);
+				m[i] = _mm_castps_si128(_mm_and_ps(_mm_cmpgt_ps(z, zero), _mm_cmplt_ps(z, c)));
+			}
+			__m128i bytes = _mm_packs_epi16(_mm_packs_epi32(m[0], m[1]),
+				_mm_packs_epi32(m[2], m[3]));
+			_mm_storeu_si128((__m128i*)(out + x), bytes);
+		}
+#elif defined(SIMD_NEON)
+		const float32x4_t zero = vdupq_n_f32(0.f);
+		for (; x + 16 <= myWidth; x += 16)
+		{
+			uint16x4_t m[4];
+			for (int i = 0; i < 4; i++)
+			{
+				float32x4_t z = vld1q_f32(depth + x + i * 4);
+				float32x4_t c = vld1q_f32(cutoff + x + i * 4);
+				m[i] = vmovn_u32(vandq_u32(vcgtq_f32(z, zero), vcltq_f32(z, c)));
+			}
+			uint8x16_t bytes = vcombine_u8(vmovn_u16(vcombine_u16(m[0], m[1])),
+				vmovn_u16(vcombine_u16(m[2], m[3])));
+			vst1q_u8(out + x, bytes);
+		}
+#endif
+		for (; x < myWidth; ++x)
+			out[x] = depth[x] > 0.f && depth[x] < cutoff[x] ? 255 : 0;
+	}
+}
+
+void
+BackgroundModel::maskDepthRows(float* dst, bool flip, int begin, int end) const
+{
+	for (int y = begin; y < end; ++y)
+	{
+		int row = flip ? myHeight - 1 - y : y;
+		const float* depth = &myDepth[(size_t)row * myWidth];
+		const float* cutoff = &myCutoff[(size_t)row * myWidth];
+		float* out = dst + (size_t)y * myWidth;
+
+		// No depth is 0 already, so only the cutoff needs comparing.
+		int x = 0;
+#if defined(SIMD_SSE2)
+		for (; x + 4 <= myWidth; x += 4)
+		{
+			__m128 z = _mm_loadu_ps(depth + x);
+			__m128 c = _mm_loadu_ps(cutoff + x);
+			_mm_storeu_ps(out + x, _mm_and_ps(z, _mm_cmplt_ps(z, c)));
+		}
+#elif defined(SIMD_NEON)
+		for (; x + 4 <= myWidth; x += 4)
+		{
+			float32x4_t z = vld1q_f32(depth + x);
+			float32x4_t c = vld1q_f32(cutoff + x);
+			uint32x4_t keep = vandq_u32(vreinterpretq_u32_f32(z), vcltq_f32(z, c));
+			vst1q_f32(out + x, vreinterpretq_f32_u32(keep));
+		}
+#endif
+		for (; x < myWidth; ++x)
+			out[x] = depth[x] < cutoff[x] ? depth[x] : 0.f;
+	}
+}
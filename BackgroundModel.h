@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// A per-pixel model of the empty scene's depth, for the foreground Image
+// modes.
+//
+// Learning takes a number of frames and keeps, per pixel, the mean and
+// variance of the depths seen (Welford's running update) and the nearest
+// one. Pixels where the background had no depth count as having none. Once
+// learned, each pixel gets one cutoff depth from the model and the Settings,
+// and a pixel with depth nearer than its cutoff is foreground, so masking a
+// frame is a single compare per pixel, done 16 pixels at a time with SSE2 or
+// NEON.
+//
+// Every plane of the model is an array of its own in camera row order, so
+// the learning and masking loops stream through them. Learning, cutoffs and
+// masking all work on rows [begin, end), and disjoint rows can run in
+// parallel, but only one of the three at a time.
+class BackgroundModel
+{
+public:
+	// In the order of the Background Model menu.
+	enum class Statistic : int32_t
+	{
+		// Nearer than the mean by more than Deviations standard deviations,
+		// and at least Margin.
+		MeanVariance = 0,
+		// Nearer than the nearest depth learned by more than Margin.
+		Nearest,
+
+		Count
+	};
+
+	struct Settings
+	{
+		Statistic	statistic = Statistic::MeanVariance;
+		float		deviations = 3.f;
+		// Meters.
+		float		margin = 0.05f;
+
+		bool		operator==(const Settings& other) const;
+		bool		operator!=(const Settings& other) const { return !(*this == other); }
+	};
+
+	BackgroundModel();
+
+	// Sizes the model for 'width' x 'height' pixels. A different size than
+	// before forgets the model, and until one is learned every pixel with
+	// depth is foreground.
+	void		resize(int width, int height);
+
+	// R32Float meters in camera row order, top row first, for the
+	// conversion to write before learning or masking.
+	float*		depth() { return myDepth.data(); }
+
+	// Replaces the model with one learned from the next 'frames' frames.
+	// Frames are masked against the previous model until it's done.
+	void		startLearning(int frames);
+	bool		learning() const { return myLearning; }
+	// Frames learned into the current or last model.
+	int			learnedFrames() const { return myLearned; }
+	bool		hasModel() const { return myHasModel; }
+
+	// Adds rows [begin, end) of depth() to the model being learned.
+	void		learnRows(int begin, int end);
+	// Once all rows of a frame are learned, on one thread.
+	void		finishFrame();
+
+	// Returns true if the cutoffs have to be rebuilt with updateCutoffs()
+	// for 'settings', because they or the model changed. Never while
+	// learning, the cutoffs then still belong to the previous model.
+	bool		configure(const Settings& settings);
+	void		updateCutoffs(int begin, int end);
+
+	// Writes output rows [begin, end) as R8Fixed, 255 where depth() is
+	// foreground and 0 elsewhere. With 'flip' output row y is camera row
+	// height - 1 - y.
+	void		maskRows(uint8_t* dst, bool flip, int begin, int end) const;
+	// The same as R32Float, the depth where foreground and 0 elsewhere.
+	void		maskDepthRows(float* dst, bool flip, int begin, int end) const;
+
+private:
+	int					myWidth;
+	int					myHeight;
+	std::vector<float>	myDepth;
+
+	// Frames with depth, and the running mean, sum of squared differences
+	// from the mean and minimum of the depth over them, per pixel.
+	std::vector<float>	myCount;
+	std::vector<float>	myMean;
+	std::vector<float>	mySquares;
+	std::vector<float>	myMin;
+
+	// Depth below which a pixel is foreground, infinity where every depth
+	// is.
+	std::vector<float>	myCutoff;
+
+	Settings			mySettings;
+	bool				myLearning;
+	bool				myHasModel;
+	// Set when learning finishes, until configure() picks it up.
+	bool				myModelChanged;
+	int					myLearned;
+	int					myTarget;
+};
@@ -0,0 +1,896 @@
+// Headless benchmark for the RealSense TOP.
+//
+// Cooks CPUMemoryTOP outside of TouchDesigner with synthetic depth frames
+// from a librealsense software device, so the whole path from the pipeline
+// callback through the capture thread to the published buffer is measured
+// without a camera. Every combination of resolution, image mode and thread
+// count is run for a number of frames and reported as one JSON object per
+// line on stdout. Progress and errors go to stderr.
+//
+//   rstop_benchmark [--frames=N] [--warmup=N] [--resolutions=848x480,...]
+//                   [--modes=Depth,Raw,...] [--threads=1,2,4,...] [--codec]
+//                   [--kernels]
+//
+// --codec measures the RVL depth codec against a plain memcpy of the same
+// frames instead, without cooking the TOP, after checking that it rejects
+// corrupt input and round-trips frames that are one long run. --kernels
+// measures every specialized conversion kernel against the generic
+// per-pixel conversion, on one thread.
+
+#include "Host.h"
+#include "CPUMemoryTOP.h"
+#include "Telemetry.h"
+#include "ConversionKernels.h"
+#include "DepthCodec.h"
+
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every allocation made through operator new anywhere in the process,
+// including librealsense's own.
+static std::atomic<int64_t> theAllocations(0);
+
+void*
+operator new(size_t size)
+{
+	theAllocations++;
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void
+operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+static const char* SerialNumber = "Benchmark";
+static const int FPS = 60;
+
+// How long to wait for a pushed frame to be published.
+static const std::chrono::milliseconds FrameTimeout(2000);
+// How long the device may take to open and publish the first frames.
+static const std::chrono::seconds WarmupTimeout(10);
+
+struct Resolution
+{
+	int		width;
+	int		height;
+};
+
+struct Options
+{
+	int							frames = 300;
+	int							warmup = 30;
+	std::vector<Resolution>		resolutions = { { 480, 270 }, { 848, 480 }, { 1280, 720 } };
+	// Empty means every item of the Image menu.
+	std::vector<std::string>	modes;
+	std::vector<int>			threads;
+	bool						codec = false;
+	bool						kernels = false;
+};
+
+// A tilted plane between 0.5 and 3.5m with about one pixel in eleven
+// missing, like the holes of a real depth image. 'noise' adds up to that
+// many depth units of deterministic jitter.
+static std::vector<uint16_t>
+syntheticDepth(int width, int height, int noise)
+{
+	std::vector<uint16_t> pixels((size_t)width * height);
+	uint32_t seed = 12345;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			int depth = 500 + (x * 7 + y * 3) % 3000;
+			if (noise > 0)
+			{
+				seed = seed * 1664525 + 1013904223;
+				depth += (int)(seed >> 16) % (2 * noise + 1) - noise;
+			}
+			if ((x * 31 + y * 17) % 11 == 0)
+				depth = 0;
+			pixels[(size_t)y * width + x] = (uint16_t)depth;
+		}
+	}
+	return pixels;
+}
+
+// A gradient with a grid on it, so misaligned color is easy to spot when
+// the output is looked at.
+static std::vector<uint8_t>
+syntheticColor(int width, int height)
+{
+	std::vector<uint8_t> pixels((size_t)width * height * 4);
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			uint8_t* p = &pixels[((size_t)y * width + x) * 4];
+			bool grid = x % 32 == 0 || y % 32 == 0;
+			p[0] = (uint8_t)(grid ? 255 : x * 255 / width);
+			p[1] = (uint8_t)(grid ? 255 : y * 255 / height);
+			p[2] = (uint8_t)(grid ? 255 : 128);
+			p[3] = 255;
+		}
+	}
+	return pixels;
+}
+
+// A software device with a Z16 depth stream, Y8 left and right infrared
+// streams and a BGRA8 color stream 15mm to the side of them at every
+// benchmarked resolution. It's added to the TOP's context, so it shows up
+// in the Sensor menu like a camera would.
+class SyntheticCamera
+{
+public:
+	explicit SyntheticCamera(const std::vector<Resolution>& resolutions) :
+		mySensor(myDevice.add_sensor("Depth")),
+		myInfraredSensor(myDevice.add_sensor("Infrared")),
+		myColorSensor(myDevice.add_sensor("Color")),
+		myFrameNumber(0)
+	{
+		myDevice.register_info(RS2_CAMERA_INFO_NAME, "Synthetic Depth Camera");
+		myDevice.register_info(RS2_CAMERA_INFO_SERIAL_NUMBER, SerialNumber);
+		mySensor.add_read_only_option(RS2_OPTION_DEPTH_UNITS, 0.001f);
+
+		int uid = 0;
+		for (const Resolution& resolution : resolutions)
+		{
+			Stream stream;
+			stream.width = resolution.width;
+			stream.height = resolution.height;
+
+			rs2_intrinsics intrinsics = {};
+			intrinsics.width = stream.width;
+			intrinsics.height = stream.height;
+			intrinsics.ppx = stream.width * 0.5f;
+			intrinsics.ppy = stream.height * 0.5f;
+			intrinsics.fx = stream.width * 0.75f;
+			intrinsics.fy = stream.width * 0.75f;
+			intrinsics.model = RS2_DISTORTION_BROWN_CONRADY;
+
+			rs2_video_stream vs = {};
+			vs.type = RS2_STREAM_DEPTH;
+			vs.index = 0;
+			vs.uid = uid++;
+			vs.width = stream.width;
+			vs.height = stream.height;
+			vs.fps = FPS;
+			vs.bpp = 2;
+			vs.fmt = RS2_FORMAT_Z16;
+			vs.intrinsics = intrinsics;
+			stream.profile = mySensor.add_video_stream(vs, myStreams.empty());
+
+			// librealsense numbers the left imager 1 and the right one 2.
+			for (int i = 0; i < 2; i++)
+			{
+				vs.type = RS2_STREAM_INFRARED;
+				vs.index = i + 1;
+				vs.uid = uid++;
+				vs.bpp = 1;
+				vs.fmt = RS2_FORMAT_Y8;
+				stream.infraredProfiles[i] = myInfraredSensor.add_video_stream(vs, myStreams.empty());
+			}
+
+			vs.type = RS2_STREAM_COLOR;
+			vs.index = 0;
+			vs.uid = uid++;
+			vs.bpp = 4;
+			vs.fmt = RS2_FORMAT_BGRA8;
+			intrinsics.model = RS2_DISTORTION_NONE;
+			vs.intrinsics = intrinsics;
+			stream.colorProfile = myColorSensor.add_video_stream(vs, myStreams.empty());
+
+			const rs2_extrinsics depthToColor = {
+				{ 1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f },
+				{ 0.015f, 0.f, 0.f },
+			};
+			stream.profile.register_extrinsics_to(stream.colorProfile, depthToColor);
+
+			stream.pixels = syntheticDepth(stream.width, stream.height, 0);
+			stream.colorPixels = syntheticColor(stream.width, stream.height);
+			stream.infraredPixels.resize((size_t)stream.width * stream.height);
+			for (size_t i = 0; i < stream.infraredPixels.size(); i++)
+				stream.infraredPixels[i] = stream.colorPixels[i * 4];
+			myStreams.push_back(std::move(stream));
+		}
+
+		myDevice.add_to(CPUMemoryTOP::deviceContext());
+		// Don't depend on the devices-changed callback having run before the
+		// Sensor menu is built.
+		DeviceCache::instance().refresh();
+	}
+
+	// Delivers the next depth, infrared and color frames at this resolution,
+	// with the same timestamp so they are paired up. Only arrive anywhere if the
+	// pipeline has the sensors open with those profiles.
+	void
+	push(int width, int height)
+	{
+		for (Stream& stream : myStreams)
+		{
+			if (stream.width != width || stream.height != height)
+				continue;
+
+			rs2_software_video_frame frame = {};
+			frame.pixels = stream.pixels.data();
+			// The pixels belong to the stream and outlive every frame.
+			frame.deleter = [](void*) {};
+			frame.stride = stream.width * 2;
+			frame.bpp = 2;
+			frame.timestamp = std::chrono::duration<double, std::milli>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+			frame.domain = RS2_TIMESTAMP_DOMAIN_SYSTEM_TIME;
+			frame.frame_number = ++myFrameNumber;
+			frame.profile = stream.profile.get();
+			frame.depth_units = 0.001f;
+			mySensor.on_video_frame(frame);
+
+			frame.pixels = stream.infraredPixels.data();
+			frame.stride = stream.width;
+			frame.bpp = 1;
+			for (const rs2::stream_profile& profile : stream.infraredProfiles)
+			{
+				frame.profile = profile.get();
+				myInfraredSensor.on_video_frame(frame);
+			}
+
+			frame.pixels = stream.colorPixels.data();
+			frame.stride = stream.width * 4;
+			frame.bpp = 4;
+			frame.profile = stream.colorProfile.get();
+			myColorSensor.on_video_frame(frame);
+			return;
+		}
+	}
+
+private:
+	struct Stream
+	{
+		int						width = 0;
+		int						height = 0;
+		rs2::stream_profile		profile;
+		rs2::stream_profile		colorProfile;
+		rs2::stream_profile		infraredProfiles[2];
+		std::vector<uint16_t>	pixels;
+		std::vector<uint8_t>	colorPixels;
+		std::vector<uint8_t>	infraredPixels;
+	};
+
+	rs2::software_device	myDevice;
+	rs2::software_sensor	mySensor;
+	// A sensor of its own, unlike on a real camera, so frames of infrared
+	// streams that aren't open never reach the pipeline with the depth.
+	rs2::software_sensor	myInfraredSensor;
+	rs2::software_sensor	myColorSensor;
+	std::vector<Stream>		myStreams;
+	int						myFrameNumber;
+};
+
+struct Case
+{
+	Resolution		resolution;
+	std::string		mode;
+	int				threads;
+};
+
+struct Result
+{
+	bool			ok = false;
+	std::string		error;
+	int				frames = 0;
+	int				cooks = 0;
+	size_t			bytesIn = 0;
+	size_t			bytesOut = 0;
+	double			convertMeanNs = 0.;
+	double			convertP99Ns = 0.;
+	double			executeMeanNs = 0.;
+	double			frameNs = 0.;
+	double			allocsPerFrame = 0.;
+	std::string		kernel;
+};
+
+static float
+infoChannel(const std::vector<std::pair<std::string, float>>& chans, const char* name)
+{
+	for (const auto& chan : chans)
+	{
+		if (chan.first == name)
+			return chan.second;
+	}
+	return 0.f;
+}
+
+static std::string
+infoRow(const std::vector<std::pair<std::string, std::string>>& rows, const char* name)
+{
+	for (const auto& row : rows)
+	{
+		if (row.first == name)
+			return row.second;
+	}
+	return std::string();
+}
+
+static Result
+runCase(SyntheticCamera& camera, const HostParameters& parameters, const Case& c, const Options& options)
+{
+	Result result;
+
+	OP_NodeInfo info = OP_NodeInfo();
+	info.opPath = "/benchmark/realsense1";
+	info.opID = 1;
+
+	CPUMemoryTOP top(&info);
+	HostInputs inputs(parameters);
+	HostOutput output;
+
+	std::stringstream resolution;
+	resolution << "R" << c.resolution.width << "x" << c.resolution.height;
+	if (!inputs.setMenu("Sensor", std::string("Sensor") + SerialNumber) ||
+		!inputs.setMenu("Resolution", resolution.str()) ||
+		!inputs.setMenu("Fps", "Fps" + std::to_string(FPS)) ||
+		!inputs.setMenu("Image", c.mode) ||
+		!inputs.setMenu("Queuepolicy", "Fifo") ||
+		!inputs.setValue("Threads", c.threads))
+	{
+		result.error = "parameters rejected";
+		return result;
+	}
+
+	int64_t executeNs = 0;
+	int64_t executeTotal = 0;
+	int cooks = 0;
+
+	// Pushes one frame and cooks until the TOP publishes it. Each frame is
+	// converted before the next is pushed, so nothing is dropped.
+	auto deliver = [&](std::chrono::steady_clock::duration timeout) -> bool
+	{
+		camera.push(c.resolution.width, c.resolution.height);
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			int32_t location = output.cook(&top, &inputs, executeNs);
+			executeTotal += executeNs;
+			cooks++;
+			if (location >= 0 && output.width() == c.resolution.width &&
+				output.height() == c.resolution.height)
+				return true;
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		return false;
+	};
+
+	// The device opens on the TOP's device thread while we keep pushing.
+	int warm = 0;
+	auto warmupEnd = std::chrono::steady_clock::now() + WarmupTimeout;
+	while (warm < options.warmup && std::chrono::steady_clock::now() < warmupEnd)
+	{
+		if (deliver(std::chrono::milliseconds(100)))
+			warm++;
+	}
+	if (warm < options.warmup)
+	{
+		const char* warning = top.getWarningString();
+		result.error = warning ? warning : "no frames published during warmup";
+		return result;
+	}
+
+	executeTotal = 0;
+	cooks = 0;
+	int64_t allocationsStart = theAllocations;
+	int64_t start = monotonicNanoseconds();
+
+	for (int i = 0; i < options.frames; i++)
+	{
+		if (!deliver(FrameTimeout))
+		{
+			result.error = "frame " + std::to_string(i) + " was not published";
+			return result;
+		}
+	}
+
+	int64_t elapsed = monotonicNanoseconds() - start;
+	int64_t allocations = theAllocations - allocationsStart;
+
+	// Read after the measurement, the Info CHOP allocates its channel names.
+	std::vector<std::pair<std::string, float>> chans = readInfoCHOP(&top);
+	std::vector<std::pair<std::string, std::string>> rows = readInfoDAT(&top);
+
+	result.ok = true;
+	result.frames = options.frames;
+	result.cooks = cooks;
+	// What the mode reads: depth, color or infrared, and depth and color
+	// for alignment.
+	size_t pixels = (size_t)c.resolution.width * c.resolution.height;
+	if (c.mode == "Color")
+		result.bytesIn = pixels * 4;
+	else if (c.mode == "Coloraligned" || c.mode == "Depthaligned")
+		result.bytesIn = pixels * (sizeof(uint16_t) + 4);
+	else if (c.mode == "Irleft" || c.mode == "Irright")
+		result.bytesIn = pixels;
+	else if (c.mode == "Irstereo")
+		result.bytesIn = pixels * 2;
+	else
+		result.bytesIn = pixels * sizeof(uint16_t);
+	result.bytesOut = output.bytesPerFrame();
+	// The TOP keeps a rolling window of the most recent conversions.
+	result.convertMeanNs = infoChannel(chans, "conversionTimeMean") * 1e6;
+	result.convertP99Ns = infoChannel(chans, "conversionTimeP99") * 1e6;
+	result.executeMeanNs = cooks ? (double)executeTotal / cooks : 0.;
+	result.frameNs = (double)elapsed / options.frames;
+	result.allocsPerFrame = (double)allocations / options.frames;
+	result.kernel = infoRow(rows, "depthKernel");
+	return result;
+}
+
+static void
+printResult(const Case& c, const Result& result)
+{
+	std::stringstream line;
+	line << "{\"width\":" << c.resolution.width
+		<< ",\"height\":" << c.resolution.height
+		<< ",\"mode\":\"" << c.mode << "\""
+		<< ",\"threads\":" << c.threads;
+
+	if (!result.ok)
+	{
+		line << ",\"error\":\"" << result.error << "\"}";
+		std::cout << line.str() << std::endl;
+		return;
+	}
+
+	line << ",\"kernel\":\"" << result.kernel << "\""
+		<< ",\"frames\":" << result.frames
+		<< ",\"cooks\":" << result.cooks
+		// Wall time from push to publish, including the 50us cook polling.
+		<< ",\"ns_per_frame\":" << (int64_t)result.frameNs
+		<< ",\"convert_ns_mean\":" << (int64_t)result.convertMeanNs
+		<< ",\"convert_ns_p99\":" << (int64_t)result.convertP99Ns
+		<< ",\"execute_ns_mean\":" << (int64_t)result.executeMeanNs
+		<< ",\"bytes_in_per_frame\":" << result.bytesIn
+		<< ",\"bytes_out_per_frame\":" << result.bytesOut
+		<< ",\"allocs_per_frame\":" << result.allocsPerFrame
+		<< "}";
+	std::cout << line.str() << std::endl;
+}
+
+// Times 'frames' calls of 'f' and returns the mean in nanoseconds.
+template <typename F>
+static double
+timeFrames(int frames, F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++)
+		f();
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / frames;
+}
+
+// Encodes and decodes the same frame over and over, next to a memcpy of it
+// as the floor any in-memory format has to beat.
+static bool
+runCodec(const Resolution& resolution, const Options& options)
+{
+	struct Scene
+	{
+		const char*	name;
+		int			noise;
+	};
+	const Scene scenes[] = { { "plane", 0 }, { "noisy", 8 } };
+
+	bool ok = true;
+	for (const Scene& scene : scenes)
+	{
+		std::vector<uint16_t> pixels = syntheticDepth(resolution.width, resolution.height, scene.noise);
+		size_t count = pixels.size();
+		size_t rawBytes = count * sizeof(uint16_t);
+
+		std::vector<uint8_t> encoded(DepthCodec::maxEncodedSize(count));
+		std::vector<uint16_t> decoded(count);
+		std::vector<uint16_t> copied(count);
+		size_t encodedBytes = 0;
+		bool decodedOk = true;
+
+		auto encode = [&] { encodedBytes = DepthCodec::encodeRVL(pixels.data(), count, encoded.data()); };
+		auto decode = [&] { decodedOk &= DepthCodec::decodeRVL(encoded.data(), encodedBytes, decoded.data(), count); };
+		auto copy = [&] { memcpy(copied.data(), pixels.data(), rawBytes); };
+
+		timeFrames(options.warmup, encode);
+		timeFrames(options.warmup, decode);
+		timeFrames(options.warmup, copy);
+		double encodeNs = timeFrames(options.frames, encode);
+		double decodeNs = timeFrames(options.frames, decode);
+		double copyNs = timeFrames(options.frames, copy);
+
+		std::stringstream line;
+		line << "{\"codec\":\"rvl\""
+			<< ",\"width\":" << resolution.width
+			<< ",\"height\":" << resolution.height
+			<< ",\"scene\":\"" << scene.name << "\"";
+
+		if (!decodedOk || decoded != pixels)
+		{
+			line << ",\"error\":\"decoded frame differs\"}";
+			std::cout << line.str() << std::endl;
+			ok = false;
+			continue;
+		}
+
+		// Megabytes of raw depth per second, so all three compare directly.
+		double megabytes = rawBytes / 1e6;
+		line << ",\"frames\":" << options.frames
+			<< ",\"bytes_raw\":" << rawBytes
+			<< ",\"bytes_encoded\":" << encodedBytes
+			<< ",\"ratio\":" << (double)rawBytes / encodedBytes
+			<< ",\"encode_ns_per_frame\":" << (int64_t)encodeNs
+			<< ",\"decode_ns_per_frame\":" << (int64_t)decodeNs
+			<< ",\"memcpy_ns_per_frame\":" << (int64_t)copyNs
+			<< ",\"encode_mb_per_s\":" << megabytes / (encodeNs * 1e-9)
+			<< ",\"decode_mb_per_s\":" << megabytes / (decodeNs * 1e-9)
+			<< ",\"memcpy_mb_per_s\":" << megabytes / (copyNs * 1e-9)
+			<< "}";
+		std::cout << line.str() << std::endl;
+	}
+	return ok;
+}
+
+// Streams decodeRVL() has to reject instead of reading or shifting past
+// what's there: one that ends early, and one whose values never end.
+static bool
+checkCorruptCodec()
+{
+	const size_t count = 64 * 64;
+	std::vector<uint16_t> pixels = syntheticDepth(64, 64, 8);
+	std::vector<uint8_t> encoded(DepthCodec::maxEncodedSize(count));
+	size_t encodedBytes = DepthCodec::encodeRVL(pixels.data(), count, encoded.data());
+	std::vector<uint16_t> decoded(count);
+
+	std::vector<uint8_t> endless(64, 0xFF);
+
+	bool ok = true;
+	if (DepthCodec::decodeRVL(encoded.data(), encodedBytes - 4, decoded.data(), count))
+	{
+		std::cout << "{\"codec\":\"rvl\",\"error\":\"truncated stream decoded\"}" << std::endl;
+		ok = false;
+	}
+	if (DepthCodec::decodeRVL(endless.data(), endless.size(), decoded.data(), count))
+	{
+		std::cout << "{\"codec\":\"rvl\",\"error\":\"endless value decoded\"}" << std::endl;
+		ok = false;
+	}
+	return ok;
+}
+
+// Whether 'pixels' comes back unchanged from encodeRVL() and decodeRVL().
+// Reports a failure as 'name'.
+static bool
+roundTripsCodec(const std::vector<uint16_t>& pixels, const std::string& name)
+{
+	size_t count = pixels.size();
+	std::vector<uint8_t> encoded(DepthCodec::maxEncodedSize(count));
+	size_t encodedBytes = DepthCodec::encodeRVL(pixels.data(), count, encoded.data());
+	std::vector<uint16_t> decoded(count);
+	if (DepthCodec::decodeRVL(encoded.data(), encodedBytes, decoded.data(), count) &&
+		decoded == pixels)
+		return true;
+
+	std::cout << "{\"codec\":\"rvl\",\"error\":\"" << name << " differs after decoding\"}"
+		<< std::endl;
+	return false;
+}
+
+// Frames that are one long run, which the synthetic scenes with their
+// regular holes never produce: nothing but holes, and no holes at all.
+static bool
+checkCodecRuns(const Resolution& resolution)
+{
+	std::stringstream size;
+	size << resolution.width << "x" << resolution.height;
+
+	std::vector<uint16_t> pixels((size_t)resolution.width * resolution.height, 0);
+	bool ok = roundTripsCodec(pixels, "empty " + size.str() + " frame");
+
+	pixels = syntheticDepth(resolution.width, resolution.height, 8);
+	for (uint16_t& pixel : pixels)
+		pixel = std::max<uint16_t>(pixel, 1);
+	ok &= roundTripsCodec(pixels, "full " + size.str() + " frame");
+	return ok;
+}
+
+// Run lengths around 2^18, where they go from 6 to 7 nibbles.
+static bool
+checkCodecLongRuns()
+{
+	bool ok = true;
+	const size_t lengths[] = { (1 << 18) - 1, 1 << 18, (1 << 18) + 1 };
+	for (size_t length : lengths)
+	{
+		std::vector<uint16_t> pixels(length + 1, 0);
+		pixels.back() = 1000;
+		ok &= roundTripsCodec(pixels, "run of " + std::to_string(length) + " holes");
+
+		std::fill(pixels.begin(), pixels.end(), 1000);
+		pixels[0] = 0;
+		ok &= roundTripsCodec(pixels, "run of " + std::to_string(length) + " depths");
+	}
+	return ok;
+}
+
+// Converts the same frame with the kernel ConversionKernels::select() picks
+// and with the generic conversion, for every output, row order, filter and
+// downsampling. Megapixels per second count camera pixels read.
+static bool
+runKernels(const Resolution& resolution, const Options& options)
+{
+	using ConversionKernels::Output;
+	using ConversionKernels::Reduction;
+	const char* outputNames[] = { "Depth", "Points", "PointsHalf", "Raw" };
+	const size_t outputBytes[] = { 4, 16, 8, 2 };
+	const char* reductionNames[] = { "median", "min" };
+
+	std::vector<uint16_t> pixels = syntheticDepth(resolution.width, resolution.height, 8);
+
+	// A D435-like lens, with the focal length scaled to the resolution.
+	rs2_intrinsics intrinsics = rs2_intrinsics();
+	intrinsics.width = resolution.width;
+	intrinsics.height = resolution.height;
+	intrinsics.ppx = resolution.width * 0.5f;
+	intrinsics.ppy = resolution.height * 0.5f;
+	intrinsics.fx = intrinsics.fy = resolution.width * 0.75f;
+	intrinsics.model = RS2_DISTORTION_BROWN_CONRADY;
+
+	bool ok = true;
+	for (int downsample = 1; downsample <= 8; downsample *= 2)
+	{
+		DeprojectionTable rays;
+		rays.update(ConversionKernels::downsampleIntrinsics(intrinsics, downsample));
+
+		ConversionKernels::Frame frame;
+		frame.src = pixels.data();
+		frame.width = resolution.width;
+		frame.height = resolution.height;
+		frame.downsample = downsample;
+		frame.scale = 0.001f;
+		frame.rays = &rays;
+		// 0.6m to 3m.
+		frame.clipNear = 600;
+		frame.clipFar = 3000;
+		size_t count = (size_t)frame.outputWidth() * frame.outputHeight();
+
+		// Without downsampling the reduction doesn't matter.
+		int reductions = downsample > 1 ? (int)Reduction::Count : 1;
+		for (int reduction = 0; reduction < reductions; reduction++)
+		{
+			for (int o = 0; o < (int)Output::Count; o++)
+			{
+				Output output = (Output)o;
+				std::vector<uint8_t> specialized(count * outputBytes[o]);
+				std::vector<uint8_t> generic(count * outputBytes[o]);
+
+				for (int flip = 0; flip < 2; flip++)
+				{
+					for (int clip = 0; clip < 2; clip++)
+					{
+						ConversionKernels::ConvertFunc convert = ConversionKernels::select(output,
+							flip != 0, clip != 0, downsample > 1, (Reduction)reduction);
+						ConversionKernels::Frame a = frame;
+						a.dst = specialized.data();
+						ConversionKernels::Frame b = frame;
+						b.dst = generic.data();
+
+						std::stringstream line;
+						line << "{\"kernels\":\"" << outputNames[o] << "\""
+							<< ",\"width\":" << resolution.width
+							<< ",\"height\":" << resolution.height
+							<< ",\"flip\":" << (flip ? "true" : "false")
+							<< ",\"clip\":" << (clip ? "true" : "false")
+							<< ",\"downsample\":" << downsample;
+						if (downsample > 1)
+							line << ",\"reduction\":\"" << reductionNames[reduction] << "\"";
+
+						if (!convert)
+						{
+							line << ",\"error\":\"no kernel\"}";
+							std::cout << line.str() << std::endl;
+							ok = false;
+							continue;
+						}
+
+						auto runSpecialized = [&] { convert(a, 0, a.outputHeight()); };
+						auto runGeneric = [&] {
+							ConversionKernels::convertGeneric(b, output, flip != 0, clip != 0,
+								(Reduction)reduction, 0, b.outputHeight());
+						};
+
+						timeFrames(options.warmup, runSpecialized);
+						timeFrames(options.warmup, runGeneric);
+						double specializedNs = timeFrames(options.frames, runSpecialized);
+						double genericNs = timeFrames(options.frames, runGeneric);
+
+						// Not an error if false: the SIMD kernels may round the
+						// last bit of a float or half differently.
+						double megapixels = pixels.size() / 1e6;
+						line << ",\"frames\":" << options.frames
+							<< ",\"identical\":" << (specialized == generic ? "true" : "false")
+							<< ",\"specialized_ns_per_frame\":" << (int64_t)specializedNs
+							<< ",\"generic_ns_per_frame\":" << (int64_t)genericNs
+							<< ",\"specialized_mpix_per_s\":" << megapixels / (specializedNs * 1e-9)
+							<< ",\"generic_mpix_per_s\":" << megapixels / (genericNs * 1e-9)
+							<< ",\"speedup\":" << genericNs / specializedNs
+							<< "}";
+						std::cout << line.str() << std::endl;
+					}
+				}
+			}
+		}
+	}
+	return ok;
+}
+
+static std::vector<std::string>
+split(const std::string& value)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(value);
+	std::string item;
+	while (std::getline(ss, item, ','))
+	{
+		if (!item.empty())
+			items.push_back(item);
+	}
+	return items;
+}
+
+static bool
+parseOptions(int argc, char** argv, Options& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		size_t equals = arg.find('=');
+		std::string key = arg.substr(0, equals);
+		std::string value = equals == std::string::npos ? std::string() : arg.substr(equals + 1);
+
+		if (key == "--frames")
+			options.frames = atoi(value.c_str());
+		else if (key == "--warmup")
+			options.warmup = atoi(value.c_str());
+		else if (key == "--modes")
+			options.modes = split(value);
+		else if (key == "--threads")
+		{
+			options.threads.clear();
+			for (const std::string& item : split(value))
+				options.threads.push_back(atoi(item.c_str()));
+		}
+		else if (key == "--codec")
+			options.codec = true;
+		else if (key == "--kernels")
+			options.kernels = true;
+		else if (key == "--resolutions")
+		{
+			options.resolutions.clear();
+			for (const std::string& item : split(value))
+			{
+				Resolution resolution;
+				if (sscanf(item.c_str(), "%dx%d", &resolution.width, &resolution.height) != 2)
+					return false;
+				options.resolutions.push_back(resolution);
+			}
+		}
+		else
+			return false;
+	}
+	return options.frames > 0 && !options.resolutions.empty();
+}
+
+int
+main(int argc, char** argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		std::cerr << "usage: rstop_benchmark [--frames=N] [--warmup=N] [--resolutions=WxH,...]"
+			" [--modes=Depth,...] [--threads=1,2,...] [--codec] [--kernels]" << std::endl;
+		return 2;
+	}
+
+	if (options.codec)
+	{
+		bool ok = checkCorruptCodec();
+		ok &= checkCodecLongRuns();
+		for (const Resolution& resolution : options.resolutions)
+		{
+			ok &= checkCodecRuns(resolution);
+			ok &= runCodec(resolution, options);
+		}
+		return ok ? 0 : 1;
+	}
+
+	if (options.kernels)
+	{
+		bool ok = true;
+		for (const Resolution& resolution : options.resolutions)
+			ok &= runKernels(resolution, options);
+		return ok ? 0 : 1;
+	}
+
+	if (options.threads.empty())
+	{
+		int cores = (int)std::thread::hardware_concurrency();
+		for (int threads = 1; threads < cores; threads *= 2)
+			options.threads.push_back(threads);
+		options.threads.push_back(std::max(cores, 1));
+	}
+
+	try
+	{
+		SyntheticCamera camera(options.resolutions);
+
+		// The parameters only depend on the attached devices, so one set
+		// serves every case.
+		HostParameters parameters;
+		{
+			OP_NodeInfo info = OP_NodeInfo();
+			CPUMemoryTOP top(&info);
+			top.setupParameters(&parameters);
+		}
+
+		if (options.modes.empty())
+		{
+			if (const HostParameters::Parameter* image = parameters.find("Image"))
+				options.modes = image->menu;
+		}
+
+		int failures = 0;
+		for (const Resolution& resolution : options.resolutions)
+		{
+			for (const std::string& mode : options.modes)
+			{
+				for (int threads : options.threads)
+				{
+					Case c;
+					c.resolution = resolution;
+					c.mode = mode;
+					c.threads = threads;
+
+					std::cerr << resolution.width << "x" << resolution.height << " "
+						<< mode << " " << threads << " threads" << std::endl;
+
+					Result result = runCase(camera, parameters, c, options);
+					if (!result.ok)
+						failures++;
+					printResult(c, result);
+				}
+			}
+		}
+		return failures ? 1 : 0;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "RS2 - Error: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,311 @@
+#include "Host.h"
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <string.h>
+
+const HostParameters::Parameter*
+HostParameters::find(const std::string& name) const
+{
+	for (const Parameter& parameter : myParameters)
+	{
+		if (parameter.name == name)
+			return &parameter;
+	}
+	return nullptr;
+}
+
+OP_ParAppendResult
+HostParameters::appendNumeric(const OP_NumericParameter& np, int32_t size)
+{
+	if (!np.name || find(np.name))
+		return OP_ParAppendResult::InvalidName;
+
+	Parameter parameter;
+	parameter.name = np.name;
+	for (int32_t i = 0; i < std::min(size, 4); i++)
+		parameter.defaultValues[i] = np.defaultValues[i];
+	myParameters.push_back(parameter);
+	return OP_ParAppendResult::Success;
+}
+
+OP_ParAppendResult
+HostParameters::appendText(const OP_StringParameter& sp, int32_t nitems, const char** names)
+{
+	if (!sp.name || find(sp.name))
+		return OP_ParAppendResult::InvalidName;
+
+	Parameter parameter;
+	parameter.name = sp.name;
+	if (sp.defaultValue)
+		parameter.defaultString = sp.defaultValue;
+	for (int32_t i = 0; i < nitems; i++)
+	{
+		parameter.menu.push_back(names[i]);
+		if (parameter.menu.back() == parameter.defaultString)
+			parameter.defaultValues[0] = i;
+	}
+	myParameters.push_back(parameter);
+	return OP_ParAppendResult::Success;
+}
+
+OP_ParAppendResult HostParameters::appendFloat(const OP_NumericParameter &np, int32_t size) { return appendNumeric(np, size); }
+OP_ParAppendResult HostParameters::appendInt(const OP_NumericParameter &np, int32_t size) { return appendNumeric(np, size); }
+OP_ParAppendResult HostParameters::appendXY(const OP_NumericParameter &np) { return appendNumeric(np, 2); }
+OP_ParAppendResult HostParameters::appendXYZ(const OP_NumericParameter &np) { return appendNumeric(np, 3); }
+OP_ParAppendResult HostParameters::appendUV(const OP_NumericParameter &np) { return appendNumeric(np, 2); }
+OP_ParAppendResult HostParameters::appendUVW(const OP_NumericParameter &np) { return appendNumeric(np, 3); }
+OP_ParAppendResult HostParameters::appendRGB(const OP_NumericParameter &np) { return appendNumeric(np, 3); }
+OP_ParAppendResult HostParameters::appendRGBA(const OP_NumericParameter &np) { return appendNumeric(np, 4); }
+OP_ParAppendResult HostParameters::appendToggle(const OP_NumericParameter &np) { return appendNumeric(np); }
+OP_ParAppendResult HostParameters::appendPulse(const OP_NumericParameter &np) { return appendNumeric(np); }
+OP_ParAppendResult HostParameters::appendString(const OP_StringParameter &sp) { return appendText(sp); }
+OP_ParAppendResult HostParameters::appendFile(const OP_StringParameter &sp) { return appendText(sp); }
+OP_ParAppendResult HostParameters::appendFolder(const OP_StringParameter &sp) { return appendText(sp); }
+OP_ParAppendResult HostParameters::appendDAT(const OP_StringParameter &sp) { return appendText(sp); }
+OP_ParAppendResult HostParameters::appendCHOP(const OP_StringParameter &sp) { return appendText(sp); }
+OP_ParAppendResult HostParameters::appendTOP(const OP_StringParameter &sp) { return appendText(sp); }
+OP_ParAppendResult HostParameters::appendObject(const OP_StringParameter &sp) { return appendText(sp); }
+
+OP_ParAppendResult
+HostParameters::appendMenu(const OP_StringParameter& sp, int32_t nitems,
+						const char** names, const char** labels)
+{
+	return appendText(sp, nitems, names);
+}
+
+OP_ParAppendResult
+HostParameters::appendStringMenu(const OP_StringParameter& sp, int32_t nitems,
+						const char** names, const char** labels)
+{
+	return appendText(sp, nitems, names);
+}
+
+
+HostInputs::HostInputs(const HostParameters& parameters) :
+	myParameters(parameters)
+{
+	for (const HostParameters::Parameter& parameter : parameters.parameters())
+	{
+		Value& value = myValues[parameter.name];
+		value.string = parameter.defaultString;
+		for (int i = 0; i < 4; i++)
+			value.numbers[i] = parameter.defaultValues[i];
+	}
+}
+
+bool
+HostInputs::setMenu(const char* name, const std::string& item)
+{
+	const HostParameters::Parameter* parameter = myParameters.find(name);
+	if (!parameter)
+		return false;
+
+	auto it = std::find(parameter->menu.begin(), parameter->menu.end(), item);
+	if (it == parameter->menu.end())
+		return false;
+
+	Value& value = myValues[name];
+	value.string = item;
+	value.numbers[0] = (double)(it - parameter->menu.begin());
+	return true;
+}
+
+bool
+HostInputs::setString(const char* name, const std::string& value)
+{
+	if (!myParameters.find(name))
+		return false;
+	myValues[name].string = value;
+	return true;
+}
+
+bool
+HostInputs::setValue(const char* name, double value, int32_t index)
+{
+	if (!myParameters.find(name) || index < 0 || index >= 4)
+		return false;
+	myValues[name].numbers[index] = value;
+	return true;
+}
+
+double
+HostInputs::getParDouble(const char* name, int32_t index)
+{
+	auto it = myValues.find(name);
+	if (it == myValues.end() || index < 0 || index >= 4)
+		return 0.;
+	return it->second.numbers[index];
+}
+
+bool
+HostInputs::getParDouble2(const char* name, double &v0, double &v1)
+{
+	v0 = getParDouble(name, 0);
+	v1 = getParDouble(name, 1);
+	return myValues.count(name) != 0;
+}
+
+bool
+HostInputs::getParDouble3(const char* name, double &v0, double &v1, double &v2)
+{
+	v0 = getParDouble(name, 0);
+	v1 = getParDouble(name, 1);
+	v2 = getParDouble(name, 2);
+	return myValues.count(name) != 0;
+}
+
+bool
+HostInputs::getParDouble4(const char* name, double &v0, double &v1, double &v2, double &v3)
+{
+	v0 = getParDouble(name, 0);
+	v1 = getParDouble(name, 1);
+	v2 = getParDouble(name, 2);
+	v3 = getParDouble(name, 3);
+	return myValues.count(name) != 0;
+}
+
+int32_t
+HostInputs::getParInt(const char* name, int32_t index)
+{
+	return (int32_t)getParDouble(name, index);
+}
+
+bool
+HostInputs::getParInt2(const char* name, int32_t &v0, int32_t &v1)
+{
+	v0 = getParInt(name, 0);
+	v1 = getParInt(name, 1);
+	return myValues.count(name) != 0;
+}
+
+bool
+HostInputs::getParInt3(const char* name, int32_t &v0, int32_t &v1, int32_t &v2)
+{
+	v0 = getParInt(name, 0);
+	v1 = getParInt(name, 1);
+	v2 = getParInt(name, 2);
+	return myValues.count(name) != 0;
+}
+
+bool
+HostInputs::getParInt4(const char* name, int32_t &v0, int32_t &v1, int32_t &v2, int32_t &v3)
+{
+	v0 = getParInt(name, 0);
+	v1 = getParInt(name, 1);
+	v2 = getParInt(name, 2);
+	v3 = getParInt(name, 3);
+	return myValues.count(name) != 0;
+}
+
+const char*
+HostInputs::getParString(const char* name)
+{
+	auto it = myValues.find(name);
+	return it == myValues.end() ? "" : it->second.string.c_str();
+}
+
+
+HostOutput::HostOutput() :
+	myWidth(0),
+	myHeight(0),
+	myBytes(0)
+{
+}
+
+void
+HostOutput::allocate(size_t bytes)
+{
+	for (Block& block : myBlocks)
+	{
+		block.storage.assign(bytes + 64, 0);
+		uintptr_t address = (uintptr_t)block.storage.data();
+		block.data = block.storage.data() + ((64 - address % 64) % 64);
+	}
+	myBytes = bytes;
+}
+
+int32_t
+HostOutput::cook(TOP_CPlusPlusBase* top, OP_Inputs* inputs, int64_t& executeNanoseconds)
+{
+	TOP_GeneralInfo ginfo = TOP_GeneralInfo();
+	top->getGeneralInfo(&ginfo);
+
+	TOP_OutputFormat format = TOP_OutputFormat();
+	top->getOutputFormat(&format);
+
+	size_t bytes = (size_t)format.width * format.height * bytesPerPixel(ginfo.memPixelType);
+	if (format.width != myWidth || format.height != myHeight || bytes != myBytes)
+	{
+		myWidth = format.width;
+		myHeight = format.height;
+		allocate(bytes);
+	}
+
+	TOP_OutputFormatSpecs specs = TOP_OutputFormatSpecs();
+	specs.width = myWidth;
+	specs.height = myHeight;
+	for (int i = 0; i < 3; i++)
+		specs.cpuPixelData[i] = myBlocks[i].data;
+	specs.newCPUPixelDataLocation = -1;
+
+	int64_t start = monotonicNanoseconds();
+	top->execute(&specs, inputs, nullptr);
+	executeNanoseconds = monotonicNanoseconds() - start;
+
+	int32_t location = specs.newCPUPixelDataLocation;
+	if (location >= 0 && location < 3)
+		std::swap(myBlocks[location], myBlocks[3]);
+	return location;
+}
+
+std::vector<std::pair<std::string, float>>
+readInfoCHOP(TOP_CPlusPlusBase* top)
+{
+	std::vector<std::pair<std::string, float>> chans;
+	int32_t count = top->getNumInfoCHOPChans();
+	for (int32_t i = 0; i < count; i++)
+	{
+		OP_InfoCHOPChan chan = OP_InfoCHOPChan();
+		top->getInfoCHOPChan(i, &chan);
+		if (chan.name)
+			chans.emplace_back(chan.name, chan.value);
+	}
+	return chans;
+}
+
+std::vector<std::pair<std::string, std::string>>
+readInfoDAT(TOP_CPlusPlusBase* top)
+{
+	std::vector<std::pair<std::string, std::string>> rows;
+	OP_InfoDATSize size = OP_InfoDATSize();
+	if (!top->getInfoDATSize(&size) || size.cols < 2 || size.byColumn)
+		return rows;
+
+	std::vector<char*> values(size.cols, nullptr);
+	for (int32_t i = 0; i < size.rows; i++)
+	{
+		OP_InfoDATEntries entries = OP_InfoDATEntries();
+		entries.values = values.data();
+		std::fill(values.begin(), values.end(), nullptr);
+		top->getInfoDATEntries(i, size.cols, &entries);
+		rows.emplace_back(values[0] ? values[0] : "", values[1] ? values[1] : "");
+	}
+	return rows;
+}
+
+int
+bytesPerPixel(OP_CPUMemPixelType type)
+{
+	switch (type)
+	{
+	case OP_CPUMemPixelType::BGRA8Fixed:	return 4;
+	case OP_CPUMemPixelType::RGBA8Fixed:	return 4;
+	case OP_CPUMemPixelType::RGBA32Float:	return 16;
+	case OP_CPUMemPixelType::R8Fixed:		return 1;
+	case OP_CPUMemPixelType::RG8Fixed:		return 2;
+	case OP_CPUMemPixelType::R32Float:		return 4;
+	case OP_CPUMemPixelType::RG32Float:		return 8;
+	default:								return 16;
+	}
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "TOP_CPlusPlusBase.h"
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Stand-ins for the parts of TouchDesigner a CPlusPlus TOP talks to, so the
+// plugin can be created, given parameters and cooked from a plain
+// executable.
+
+// Records the parameters a TOP appends in setupParameters().
+class HostParameters : public OP_ParameterManager
+{
+public:
+	struct Parameter
+	{
+		std::string					name;
+		std::string					defaultString;
+		// One per component.
+		double						defaultValues[4] = {};
+		// Item names, only for menus.
+		std::vector<std::string>	menu;
+	};
+
+	const Parameter*	find(const std::string& name) const;
+	const std::vector<Parameter>&	parameters() const { return myParameters; }
+
+	virtual OP_ParAppendResult	appendFloat(const OP_NumericParameter &np, int32_t size=1) override;
+	virtual OP_ParAppendResult	appendInt(const OP_NumericParameter &np, int32_t size=1) override;
+	virtual OP_ParAppendResult	appendXY(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendXYZ(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendUV(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendUVW(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendRGB(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendRGBA(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendToggle(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendPulse(const OP_NumericParameter &np) override;
+	virtual OP_ParAppendResult	appendString(const OP_StringParameter &sp) override;
+	virtual OP_ParAppendResult	appendFile(const OP_StringParameter &sp) override;
+	virtual OP_ParAppendResult	appendFolder(const OP_StringParameter &sp) override;
+	virtual OP_ParAppendResult	appendDAT(const OP_StringParameter &sp) override;
+	virtual OP_ParAppendResult	appendCHOP(const OP_StringParameter &sp) override;
+	virtual OP_ParAppendResult	appendTOP(const OP_StringParameter &sp) override;
+	virtual OP_ParAppendResult	appendObject(const OP_StringParameter &sp) override;
+	virtual OP_ParAppendResult	appendMenu(const OP_StringParameter &sp,
+									int32_t nitems, const char **names,
+									const char **labels) override;
+	virtual OP_ParAppendResult	appendStringMenu(const OP_StringParameter &sp,
+									int32_t nitems, const char **names,
+									const char **labels) override;
+
+private:
+	OP_ParAppendResult	appendNumeric(const OP_NumericParameter &np, int32_t size = 1);
+	OP_ParAppendResult	appendText(const OP_StringParameter &sp,
+							int32_t nitems = 0, const char **names = nullptr);
+
+	std::vector<Parameter>	myParameters;
+};
+
+// Parameter values for execute(), starting out at the defaults the TOP
+// declared. Like in TouchDesigner, getParInt() on a menu returns the index
+// of the selected item and getParString() its name.
+class HostInputs : public OP_Inputs
+{
+public:
+	explicit HostInputs(const HostParameters& parameters);
+
+	// Returns false if the parameter doesn't exist, or for menus, if
+	// 'item' isn't one of its items.
+	bool		setMenu(const char* name, const std::string& item);
+	bool		setString(const char* name, const std::string& value);
+	bool		setValue(const char* name, double value, int32_t index = 0);
+
+	virtual int32_t		getNumInputs() override { return 0; }
+	virtual const OP_TOPInput*		getInputTOP(int32_t index) override { return nullptr; }
+	virtual const OP_CHOPInput*		getInputCHOP(int32_t index) override { return nullptr; }
+
+	virtual const OP_DATInput*		getParDAT(const char *name) override { return nullptr; }
+	virtual const OP_TOPInput*		getParTOP(const char *name) override { return nullptr; }
+	virtual const OP_CHOPInput*		getParCHOP(const char *name) override { return nullptr; }
+	virtual const OP_ObjectInput*	getParObject(const char *name) override { return nullptr; }
+
+	virtual double		getParDouble(const char* name, int32_t index=0) override;
+	virtual bool		getParDouble2(const char* name, double &v0, double &v1) override;
+	virtual bool		getParDouble3(const char* name, double &v0, double &v1, double &v2) override;
+	virtual bool		getParDouble4(const char* name, double &v0, double &v1, double &v2, double &v3) override;
+
+	virtual int32_t		getParInt(const char* name, int32_t index=0) override;
+	virtual bool		getParInt2(const char* name, int32_t &v0, int32_t &v1) override;
+	virtual bool		getParInt3(const char* name, int32_t &v0, int32_t &v1, int32_t &v2) override;
+	virtual bool		getParInt4(const char* name, int32_t &v0, int32_t &v1, int32_t &v2, int32_t &v3) override;
+
+	virtual const char*	getParString(const char* name) override;
+	virtual const char*	getParFilePath(const char* name) override { return getParString(name); }
+
+	virtual bool		getRelativeTransform(const char* from_name, const char* to_name, double matrix[4][4]) override { return false; }
+	virtual void		enablePar(const char* name, bool onoff) override {}
+
+	virtual const OP_DATInput*		getDAT(const char *path) override { return nullptr; }
+	virtual const OP_TOPInput*		getTOP(const char *path) override { return nullptr; }
+	virtual const OP_CHOPInput*		getCHOP(const char *path) override { return nullptr; }
+	virtual const OP_ObjectInput*	getObject(const char *path) override { return nullptr; }
+
+	virtual void*		getTOPDataInCPUMemory(const OP_TOPInput *top,
+							const OP_TOPInputDownloadOptions *options) override { return nullptr; }
+
+private:
+	struct Value
+	{
+		std::string		string;
+		double			numbers[4] = {};
+	};
+
+	const HostParameters&			myParameters;
+	std::map<std::string, Value>	myValues;
+};
+
+// Plays TouchDesigner's side of a CPUMemWriteOnly cook. The TOP gets three
+// blocks of CPU memory. The block it publishes is "uploaded" and replaced
+// by a spare one, so a published pointer is never handed out again, just
+// like in TouchDesigner.
+class HostOutput
+{
+public:
+	HostOutput();
+
+	// Runs getGeneralInfo(), getOutputFormat() and execute(). Returns the
+	// location the TOP published, or -1. 'executeNanoseconds' is set to the
+	// time spent in execute().
+	int32_t		cook(TOP_CPlusPlusBase* top, OP_Inputs* inputs, int64_t& executeNanoseconds);
+
+	int32_t		width() const { return myWidth; }
+	int32_t		height() const { return myHeight; }
+	size_t		bytesPerFrame() const { return myBytes; }
+
+	// The block published by the last cook() that published one.
+	const void*	uploaded() const { return myBlocks[3].data; }
+
+private:
+	struct Block
+	{
+		std::vector<uint8_t>	storage;
+		// 'storage' aligned to a cache line.
+		uint8_t*				data = nullptr;
+	};
+
+	void		allocate(size_t bytes);
+
+	Block		myBlocks[4];
+	int32_t		myWidth;
+	int32_t		myHeight;
+	size_t		myBytes;
+};
+
+// The TOP's Info CHOP channels as name/value pairs.
+std::vector<std::pair<std::string, float>>	readInfoCHOP(TOP_CPlusPlusBase* top);
+
+// The TOP's Info DAT rows as name/value pairs.
+std::vector<std::pair<std::string, std::string>>	readInfoDAT(TOP_CPlusPlusBase* top);
+
+// Bytes per pixel of a CPU memory pixel type.
+int			bytesPerPixel(OP_CPUMemPixelType type);
@@ -0,0 +1,12 @@
+#pragma once
+
+// CPlusPlus_Common.h includes the macOS OpenGL framework's type header on
+// every platform other than Windows. The TOP only needs these few types,
+// so this stands in for it when building the benchmark on Linux. Like the
+// real header it also brings in the fixed width integer types.
+
+#include <stdint.h>
+
+typedef unsigned int	GLenum;
+typedef unsigned int	GLuint;
+typedef int				GLint;
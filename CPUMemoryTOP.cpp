@@ -9,6 +9,7 @@
  */
 
 #include "CPUMemoryTOP.h"
+#include "DepthKernels.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -18,6 +19,10 @@
 #include <iostream> // just for debugging
 #include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
 #include <sstream>
+#include <algorithm>
+#include <memory>
+#include <cctype>
+#include <vector>
 
 
 // These functions are basic C function, which the DLL loader can find
@@ -38,6 +43,10 @@ GetTOPPluginInfo(void)
 	// Change this to change the executeMode behavior of this plugin.
 	info.executeMode = TOP_ExecuteMode::CPUMemWriteOnly;
 
+	// Enumerate the cameras once while the plugin loads, instead of once
+	// per TOP.
+	DeviceCache::instance();
+
 	return info;
 }
 
@@ -63,341 +72,2762 @@ DestroyTOPInstance(TOP_CPlusPlusBase* instance, TOP_Context *context)
 };
 
 
-CPUMemoryTOP::CPUMemoryTOP(const OP_NodeInfo* info) : myNodeInfo(info)
+// Storage for the frame queue. Queuedepth can limit it further.
+static const size_t MaxQueueDepth = 8;
+
+// Used until a device reports its profile, and as the parameter defaults.
+static const int DefaultWidth = 848;
+static const int DefaultHeight = 480;
+static const int DefaultFPS = 60;
+
+// How long the device may take to deliver its first frame, how long a
+// running stream may go without frames, and how long to wait after an error
+// before trying again.
+static const std::chrono::seconds OpenTimeout(5);
+static const std::chrono::seconds StallTimeout(3);
+static const std::chrono::seconds RetryDelay(2);
+
+// The Sensor menu item that plays back the .bag or .rvl file from the File
+// parameter instead of streaming from a camera.
+static const char* FileSensor = "File";
+
+// Frames the recorder can hold while the disk catches up, half a second at
+// 60 FPS.
+static const size_t RecordBufferFrames = 30;
+
+// How long execute() waits for the next frame of non-real-time playback
+// before giving up on this cook.
+static const std::chrono::milliseconds StepTimeout(500);
+
+static const char*
+deviceStateName(DeviceState state)
 {
-	myExecuteCount = 0;
+	switch (state)
+	{
+	case DeviceState::Idle:			return "idle";
+	case DeviceState::Opening:		return "opening";
+	case DeviceState::Streaming:	return "streaming";
+	case DeviceState::Error:		return "error";
+	case DeviceState::Recovering:	return "recovering";
+	default:						return "unknown";
+	}
 }
 
-CPUMemoryTOP::~CPUMemoryTOP()
+// Menu names have to start with a letter, so the Resolution menu uses
+// names like "R848x480" and the FPS menu names like "Fps60".
+static bool
+parseResolution(const char* name, int& width, int& height)
 {
-	pipe.stop();
+	return sscanf(name, "R%dx%d", &width, &height) == 2;
 }
 
-void
-CPUMemoryTOP::getGeneralInfo(TOP_GeneralInfo* ginfo)
+static bool
+parseFPS(const char* name, int& fps)
 {
-	// Uncomment this line if you want the TOP to cook every frame even
-	// if none of it's inputs/parameters are changing.
-	ginfo->cookEveryFrame = true;
-	if (image_mode == 0) {
-		ginfo->memPixelType = OP_CPUMemPixelType::R32Float;
-	}
-	else {
-		ginfo->memPixelType = OP_CPUMemPixelType::RGBA32Float;
-	}
-    
-	ginfo->clearBuffers = false;
+	return sscanf(name, "Fps%d", &fps) == 1;
 }
 
-void CPUMemoryTOP::setupDevice(const char* sensorID) {
-	rs2::context ctx;
-	auto list = ctx.query_devices(); // Get a snapshot of currently connected devices
-	if (list.size() == 0)
-		throw std::runtime_error("No device detected. Is it plugged in?");
-
-	for (rs2::device temp : list) {
-
-		auto new_serial = temp.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
-		
-		std::stringstream ss;
-		ss << "Sensor";
-		ss << new_serial;
-
-		if (strcmp(ss.str().c_str(), sensorID) == 0) {
-			mySensorID = sensorID;
-
-			// stop the current stream/pipe if it's running
-			try {
-				// todo: Don't just try to stop it.
-				// Only stop it if it was started.
-				pipe.stop();
-			}
-			catch (const std::exception&e) {
-				std::cout << "RS2 - Error: " << e.what() << std::endl;
-			}
+// The Sensor menu names cameras "Sensor" followed by the serial number.
+static const char* SensorPrefix = "Sensor";
 
-			// todo: refuse to setup the device if it's already in use
-			// by a different cplusplus TOP
+static std::string
+sensorSerial(const std::string& sensorID)
+{
+	size_t length = strlen(SensorPrefix);
+	if (sensorID.compare(0, length, SensorPrefix) != 0)
+		return std::string();
+	return sensorID.substr(length);
+}
 
-			//dev.hardware_reset();
-			//rs2::device_hub hub(ctx);
-			//dev = hub.wait_for_device();
+// Index of a played back frame, from its timestamp relative to the first
+// frame of the file and the depth stream's frame rate. 'start' is set from
+// the first frame if it's negative.
+static int64_t
+playbackFrameIndex(const rs2::frame& frame, double& start)
+{
+	rs2::frame depth = frame;
+	if (rs2::frameset frames = frame.as<rs2::frameset>())
+	{
+		if (rs2::frame first = frames.first_or_default(RS2_STREAM_DEPTH))
+			depth = first;
+	}
 
-			int width = 848;
-			int height = 480;
-			int FPS = 60;
-			rs2::config config;
-			config.enable_device(new_serial);
-			config.enable_stream(RS2_STREAM_DEPTH, width, height, RS2_FORMAT_Z16, FPS);
+	if (start < 0.)
+		start = depth.get_timestamp();
 
-			rs2::pipeline_profile profile = pipe.start(config);
-			if (!profile) {
-				throw(-1);
-			}
+	int fps = depth.get_profile().fps();
+	int64_t index = (int64_t)std::llround((depth.get_timestamp() - start) * fps / 1000.);
+	return std::max<int64_t>(index, 0);
+}
 
-			rs2::device dev = profile.get_device();
+// Finds the device's Z16 depth profile matching the request. If the exact
+// combination isn't supported, keep the resolution and pick the closest
+// frame rate, and failing that take the closest resolution.
+static rs2::video_stream_profile
+findDepthProfile(const rs2::device& dev, int width, int height, int fps)
+{
+	rs2::video_stream_profile best;
+	long long bestScore = -1;
 
-			for (rs2::sensor& sensor : dev.query_sensors())
+	for (rs2::sensor& sensor : dev.query_sensors())
+	{
+		if (!sensor.is<rs2::depth_sensor>())
+			continue;
+
+		for (rs2::stream_profile& p : sensor.get_stream_profiles())
+		{
+			if (p.stream_type() != RS2_STREAM_DEPTH || p.format() != RS2_FORMAT_Z16 ||
+				!p.is<rs2::video_stream_profile>())
+				continue;
+
+			rs2::video_stream_profile vp = p.as<rs2::video_stream_profile>();
+			long long area = (long long)std::abs(vp.width() * vp.height() - width * height);
+			long long score = (area + std::abs(vp.width() - width)) * 1000 + std::abs(vp.fps() - fps);
+			if (bestScore < 0 || score < bestScore)
 			{
-				// Check if the sensor is a depth sensor
-				if (rs2::depth_sensor dpt = sensor.as<rs2::depth_sensor>())
-				{
-					depth_scale = dpt.get_depth_scale();
-					break;
-				}
+				best = vp;
+				bestScore = score;
 			}
-
-			break;
 		}
 	}
+	return best;
 }
 
-bool
-CPUMemoryTOP::getOutputFormat(TOP_OutputFormat* format)
+// Whether the Image mode needs the color stream.
+static bool
+usesColor(int mode)
 {
-	// In this function we could assign variable values to 'format' to specify
-	// the pixel format/resolution etc that we want to output to.
-	// If we did that, we'd want to return true to tell the TOP to use the settings we've
-	// specified.
-
-	format->width = 848;
-	format->height = 480;
-	format->bitsPerChannel = 16;
-	format->numColorBuffers = 1;
-	format->floatPrecision = true;
-
-	bool needOtherChannels = image_mode > 0; // true if point cloud mode
-
-	format->redChannel = true;
-	format->blueChannel = needOtherChannels;
-	format->greenChannel = needOtherChannels;
-	format->alphaChannel = needOtherChannels;
-
-	return true;
+	return mode == (int)ImageMode::Color || mode == (int)ImageMode::ColorAligned ||
+		mode == (int)ImageMode::DepthAligned;
 }
 
-void
-CPUMemoryTOP::execute(const TOP_OutputFormatSpecs* outputFormat,
-						OP_Inputs* inputs,
-						TOP_Context *context)
+static bool
+usesInfraredLeft(int mode)
 {
-	myExecuteCount++;
+	return mode == (int)ImageMode::InfraredLeft || mode == (int)ImageMode::InfraredStereo;
+}
 
-	try
-	{
+static bool
+usesInfraredRight(int mode)
+{
+	return mode == (int)ImageMode::InfraredRight || mode == (int)ImageMode::InfraredStereo;
+}
 
-		const char* currentSensor = inputs->getParString("Sensor");
+// Whether the Downsample parameter applies to the Image mode.
+static bool
+usesDownsample(int mode)
+{
+	return mode == (int)ImageMode::Depth || mode == (int)ImageMode::Pointcloud ||
+		mode == (int)ImageMode::PointcloudPacked || mode == (int)ImageMode::Raw ||
+		mode == (int)ImageMode::PointcloudCompact || mode == (int)ImageMode::Normals ||
+		mode == (int)ImageMode::NormalsFloat || mode == (int)ImageMode::ForegroundMask ||
+		mode == (int)ImageMode::ForegroundDepth;
+}
 
-		if (strcmp(mySensorID.c_str(), currentSensor) != 0) {
-			setupDevice(currentSensor);
-		}
+static bool
+usesBackground(int mode)
+{
+	return mode == (int)ImageMode::ForegroundMask || mode == (int)ImageMode::ForegroundDepth;
+}
 
-		rs2::frameset frames;
-		if (!pipe.poll_for_frames(&frames)) {
-			return;
-		}
-		rs2::frame depth_frame = frames.first(RS2_STREAM_DEPTH);
-		auto pixels = (const uint16_t*) depth_frame.get_data();
+static bool
+usesNormals(int mode)
+{
+	return mode == (int)ImageMode::Normals || mode == (int)ImageMode::NormalsFloat;
+}
 
-		int width = outputFormat->width;
-		int height = outputFormat->height;
+// Rows of a compact point cloud texture 'width' wide. With a maximum it
+// only needs the rows that many points fill.
+static int
+compactHeight(int width, int height, int maxPoints)
+{
+	if (maxPoints <= 0 || width <= 0)
+		return height;
+	return std::min(height, (maxPoints + width - 1) / width);
+}
 
-		int textureMemoryLocation = 0;
+// The frame the output takes its size from in the Image mode. Empty if a
+// stream the mode needs is missing, so the frames can't be converted.
+static rs2::frame
+sizingFrame(const CapturedFrames& frames, int mode)
+{
+	switch ((ImageMode)mode)
+	{
+	case ImageMode::Color:
+	case ImageMode::DepthAligned:
+		return frames.color;
+	case ImageMode::ColorAligned:
+		return frames.color ? frames.depth : rs2::frame();
+	case ImageMode::InfraredLeft:
+		return frames.infrared[0];
+	case ImageMode::InfraredRight:
+		return frames.infrared[1];
+	case ImageMode::InfraredStereo:
+		return frames.infrared[1] ? frames.infrared[0] : rs2::frame();
+	default:
+		return frames.depth;
+	}
+}
 
-		float* mem = (float*)outputFormat->cpuPixelData[textureMemoryLocation];
+// Finds the device's BGRA8 color profile to stream next to the given depth
+// profile. The frame rate has to match for frames to be paired up, so it
+// comes first, then the resolution closest to the depth stream's.
+static rs2::video_stream_profile
+findColorProfile(const rs2::device& dev, int width, int height, int fps)
+{
+	rs2::video_stream_profile best;
+	long long bestScore = -1;
 
-		if (image_mode == 0) {
-			// depth
-			for (int y = 0; y < height; ++y)
+	for (rs2::sensor& sensor : dev.query_sensors())
+	{
+		for (rs2::stream_profile& p : sensor.get_stream_profiles())
+		{
+			if (p.stream_type() != RS2_STREAM_COLOR || p.format() != RS2_FORMAT_BGRA8 ||
+				!p.is<rs2::video_stream_profile>())
+				continue;
+
+			rs2::video_stream_profile vp = p.as<rs2::video_stream_profile>();
+			long long area = (long long)std::abs(vp.width() * vp.height() - width * height);
+			long long score = (long long)std::abs(vp.fps() - fps) * 100000000LL + area;
+			if (bestScore < 0 || score < bestScore)
 			{
-				for (int x = 0; x < width; ++x)
-				{
-					float* pixel = &mem[(y*width + x)]; // or &mem[4*(y*width + x)] if RGBA
-
-					const uint16_t myDepth = pixels[(height - 1 - y)*width + x];
-
-					pixel[0] = depth_scale * myDepth;
-				}
+				best = vp;
+				bestScore = score;
 			}
-		} else {
-			// point cloud
-			points = pc.calculate(depth_frame);
-
-			auto vertices = points.get_vertices();
-
-			for (int y = 0; y < height; ++y)
-			{
-				for (int x = 0; x < width; ++x)
-				{
-					float* pixel = &mem[4 * (y*width + x)]; // or &mem[4*(y*width + x)] if RGBA
-
-					const uint16_t myDepth = pixels[(height - 1 - y)*width + x];
-
-					auto vertex = vertices[(height - 1 - y)*width + x];
+		}
+	}
+	return best;
+}
 
-					pixel[0] = vertex.x;
-					pixel[1] = vertex.y;
-					pixel[2] = vertex.z;
-					pixel[3] = 1.;
-				}
-			}
+// Whether the device has a Y8 profile for the infrared imager with this
+// index that matches the depth profile.
+static bool
+hasInfraredProfile(const rs2::device& dev, int index, const rs2::video_stream_profile& depth)
+{
+	for (rs2::sensor& sensor : dev.query_sensors())
+	{
+		for (rs2::stream_profile& p : sensor.get_stream_profiles())
+		{
+			if (p.stream_type() != RS2_STREAM_INFRARED || p.stream_index() != index ||
+				p.format() != RS2_FORMAT_Y8 || !p.is<rs2::video_stream_profile>())
+				continue;
+
+			rs2::video_stream_profile vp = p.as<rs2::video_stream_profile>();
+			if (vp.width() == depth.width() && vp.height() == depth.height() &&
+				vp.fps() == depth.fps())
+				return true;
 		}
+	}
+	return false;
+}
 
-		image_mode = inputs->getParInt("Image");
+rs2::context&
+CPUMemoryTOP::deviceContext()
+{
+	return DeviceCache::instance().context();
+}
 
-		outputFormat->newCPUPixelDataLocation = textureMemoryLocation;
-		textureMemoryLocation = !textureMemoryLocation;
-	}
-	catch (const std::exception&e)
+CPUMemoryTOP::CPUMemoryTOP(const OP_NodeInfo* info) :
+	myNodeInfo(info),
+	pipe(deviceContext()),
+	myFrameQueue(MaxQueueDepth),
+	myRecorder(RecordBufferFrames)
+{
+	myExecuteCount = 0;
+	image_mode = 0;
+
+	myStreamWidth = DefaultWidth;
+	myStreamHeight = DefaultHeight;
+	myStreamFPS = DefaultFPS;
+	pipeStarted = false;
+	mySubscription = -1;
+	depth_scale = 0.f;
+
+	myCaptureRunning = false;
+
+	myQueuePolicy = (int32_t)QueuePolicy::Latest;
+	myFlip = true;
+	myConvert = nullptr;
+	myConvertMode = -1;
+	myConvertFlip = false;
+	myConvertClip = false;
+	myConvertBlocks = false;
+	myConvertReduction = ConversionKernels::Reduction::Median;
+	myDownsample = 1;
+	myReduction = (int32_t)ConversionKernels::Reduction::Median;
+	myCompactMax = 0;
+	myNormalCurvature = false;
+	myNormalEdge = 0.05f;
+	myBackgroundRequestHandled = 0;
+	myBackgroundRequest = 0;
+	myBackgroundFrames = 30;
+	myBackgroundStatistic = (int32_t)BackgroundModel::Statistic::MeanVariance;
+	myBackgroundDeviations = 3.f;
+	myBackgroundMargin = 0.05f;
+	myBackgroundLearning = false;
+	myBackgroundFramesLearned = 0;
+	myCompactValid = 0;
+	myCompactKept = 0;
+	myThreadCount = 1;
+	myFramesReceived = 0;
+	myFramesDroppedQueue = 0;
+	myFramesDroppedStale = 0;
+	myFramesDroppedSlot = 0;
+	myFramesPublished = 0;
+	myLastPublishTime = 0;
+
+	myReadySequence = 0;
+	mySlotGeneration = 0;
+	mySlotWidth = 0;
+	mySlotHeight = 0;
+	mySlotMode = 0;
+
+	myPlaybackRealtime = true;
+	myPlaybackSpeed = 1.f;
+	mySeekFrame = 0;
+	mySeekRequested = false;
+	myAppliedRealtime = true;
+	myAppliedSpeed = 1.f;
+	myPlaybackStatus = RS2_PLAYBACK_STATUS_UNKNOWN;
+	myPlaybackFrame = -1;
+	myPlaybackStart = -1.;
+
+	myStepping = false;
+	myStepsGranted = 0;
+	myStepsTaken = 0;
+	myStepSeekTarget = -1;
+	myStepSeekBelow = false;
+
+	myRecordWanted = false;
+	myRecordStart = false;
+
+	myHasPendingRequest = false;
+	myStateStart = std::chrono::steady_clock::now();
+	for (double& duration : myStateDurations)
+		duration = 0.;
+	myDeviceState = (int32_t)DeviceState::Idle;
+	myLastFrameTime = 0;
+
+	myDeviceRunning = true;
+	myDeviceThread = std::thread(&CPUMemoryTOP::deviceLoop, this);
+}
+
+CPUMemoryTOP::~CPUMemoryTOP()
+{
 	{
-		std::cout << "RS - Error: " << e.what() << std::endl;
+		std::lock_guard<std::mutex> lock(myDeviceMutex);
+		myDeviceRunning = false;
 	}
+	myDeviceCondition.notify_all();
 
+	// The device thread closes the device on its way out.
+	if (myDeviceThread.joinable())
+		myDeviceThread.join();
 }
 
-int32_t
-CPUMemoryTOP::getNumInfoCHOPChans()
+void
+CPUMemoryTOP::getGeneralInfo(TOP_GeneralInfo* ginfo)
 {
-	// We return the number of channel we want to output to any Info CHOP
-	// connected to the TOP. In this example we are just going to send one channel.
-	return 1;
+	// Uncomment this line if you want the TOP to cook every frame even
+	// if none of it's inputs/parameters are changing.
+	ginfo->cookEveryFrame = true;
+	switch ((ImageMode)image_mode) {
+	case ImageMode::Depth:
+		ginfo->memPixelType = OP_CPUMemPixelType::R32Float;
+		break;
+	case ImageMode::PointcloudPacked:
+		ginfo->memPixelType = OP_CPUMemPixelType::RG32Float;
+		break;
+	case ImageMode::Raw:
+		ginfo->memPixelType = OP_CPUMemPixelType::RG8Fixed;
+		break;
+	case ImageMode::Color:
+	case ImageMode::ColorAligned:
+	case ImageMode::Normals:
+		ginfo->memPixelType = OP_CPUMemPixelType::BGRA8Fixed;
+		break;
+	case ImageMode::DepthAligned:
+	case ImageMode::ForegroundDepth:
+		ginfo->memPixelType = OP_CPUMemPixelType::R32Float;
+		break;
+	case ImageMode::InfraredLeft:
+	case ImageMode::InfraredRight:
+	case ImageMode::ForegroundMask:
+		ginfo->memPixelType = OP_CPUMemPixelType::R8Fixed;
+		break;
+	case ImageMode::InfraredStereo:
+		ginfo->memPixelType = OP_CPUMemPixelType::RG8Fixed;
+		break;
+	default:
+		ginfo->memPixelType = OP_CPUMemPixelType::RGBA32Float;
+		break;
+	}
+    
+	ginfo->clearBuffers = false;
 }
 
 void
-CPUMemoryTOP::getInfoCHOPChan(int32_t index, OP_InfoCHOPChan* chan)
+CPUMemoryTOP::postDeviceRequest(const DeviceRequest& request)
 {
-	// This function will be called once for each channel we said we'd want to return
-	// In this example it'll only be called once.
-
-	if (index == 0)
 	{
-		chan->name = "executeCount";
-		chan->value = (float)myExecuteCount;
+		std::lock_guard<std::mutex> lock(myDeviceMutex);
+		myPendingRequest = request;
+		myHasPendingRequest = true;
 	}
+	myDeviceCondition.notify_all();
 }
 
-bool		
-CPUMemoryTOP::getInfoDATSize(OP_InfoDATSize* infoSize)
+void
+CPUMemoryTOP::setDeviceState(DeviceState state, const std::string& message)
 {
-	infoSize->rows = 2;
-	infoSize->cols = 2;
-	// Setting this to false means we'll be assigning values to the table
-	// one row at a time. True means we'll do it one column at a time.
-	infoSize->byColumn = false;
-	return true;
+	std::lock_guard<std::mutex> lock(myDeviceMutex);
+
+	auto now = std::chrono::steady_clock::now();
+	DeviceState previous = (DeviceState)myDeviceState.load();
+	myStateDurations[(int)previous] = std::chrono::duration<double>(now - myStateStart).count();
+	myStateStart = now;
+
+	myDeviceState = (int32_t)state;
+	if (state == DeviceState::Error)
+		myDeviceError = message;
+	else if (state == DeviceState::Streaming)
+		myDeviceError.clear();
 }
 
 void
-CPUMemoryTOP::getInfoDATEntries(int32_t index,
-								int32_t nEntries,
-								OP_InfoDATEntries* entries)
+CPUMemoryTOP::deviceLoop()
 {
-	// It's safe to use static buffers here because Touch will make it's own
-	// copies of the strings immediately after this call returns
-	// (so the buffers can be reuse for each column/row)
-	static char tempBuffer1[4096];
-	static char tempBuffer2[4096];
+	uint64_t devicesSeen = DeviceCache::instance().generation();
 
-	if (index == 0)
+	while (myDeviceRunning)
 	{
-        // Set the value for the first column
-#ifdef WIN32
-        strcpy_s(tempBuffer1, "executeCount");
-#else // macOS
-        strlcpy(tempBuffer1, "executeCount", sizeof(tempBuffer1));
-#endif
-        entries->values[0] = tempBuffer1;
+		DeviceRequest request;
+		bool haveRequest;
+		{
+			std::unique_lock<std::mutex> lock(myDeviceMutex);
+			myDeviceCondition.wait_for(lock, std::chrono::milliseconds(100),
+				[this] {
+					return myHasPendingRequest || !myDeviceRunning || myRecordStart ||
+						(!myRecordWanted && myRecorder.recording());
+				});
+			if (!myDeviceRunning)
+				break;
+
+			haveRequest = myHasPendingRequest;
+			myHasPendingRequest = false;
+			if (haveRequest)
+				myActiveRequest = myPendingRequest;
+			request = myActiveRequest;
+		}
+
+		applyRecording();
+
+		if (haveRequest)
+		{
+			openDevice(request, DeviceState::Opening);
+			continue;
+		}
+
+		applyPlayback();
 
-        // Set the value for the second column
-#ifdef WIN32
-        sprintf_s(tempBuffer2, "%d", myExecuteCount);
-#else // macOS
-        snprintf(tempBuffer2, sizeof(tempBuffer2), "%d", myExecuteCount);
-#endif
-        entries->values[1] = tempBuffer2;
+		DeviceState state = (DeviceState)myDeviceState.load();
+		std::chrono::steady_clock::duration inState;
+		{
+			std::lock_guard<std::mutex> lock(myDeviceMutex);
+			inState = std::chrono::steady_clock::now() - myStateStart;
+		}
+		std::chrono::nanoseconds sinceFrame(monotonicNanoseconds() - myLastFrameTime);
+
+		// A camera was plugged in or unplugged since the last look.
+		uint64_t generation = DeviceCache::instance().generation();
+		bool devicesChanged = generation != devicesSeen;
+		devicesSeen = generation;
+		bool camera = request.sensorID != FileSensor;
+		DeviceCache::Device cached;
+
+		if ((state == DeviceState::Opening || state == DeviceState::Recovering) &&
+			inState > OpenTimeout)
+		{
+			failDevice("No frames received from " + request.sensorID + ".");
+		}
+		else if (state == DeviceState::Streaming && camera && devicesChanged &&
+			!DeviceCache::instance().find(sensorSerial(request.sensorID), cached))
+		{
+			failDevice(request.sensorID + " was unplugged.");
+		}
+		else if (state == DeviceState::Streaming && sinceFrame > StallTimeout && camera)
+		{
+			failDevice("Stream from " + request.sensorID + " stopped delivering frames.");
+		}
+		else if (state == DeviceState::Error &&
+			(inState > RetryDelay || (camera && devicesChanged)))
+		{
+			// Plugging the camera back in resumes right away.
+			openDevice(request, DeviceState::Recovering);
+		}
 	}
+
+	closeDevice();
 }
 
 void
-CPUMemoryTOP::setupParameters(OP_ParameterManager* manager)
+CPUMemoryTOP::closeDevice()
 {
+	// the capture thread owns the frames while it runs
+	stopCapture();
 
-	// Mode
-	{
-		OP_StringParameter	sp;
-
-		sp.name = "Image";
-		sp.label = "Image";
+	// a callback waiting for its playback step would keep the pipe from stopping
+	setStepping(false);
 
-		sp.defaultValue = "Depth";
+	myPlayer.stop();
 
-		const char *names[] = { "Depth", "Pointcloud"};
-		const char *labels[] = { "Depth", "Point Cloud"};
+	// Leave the shared stream. It stops once no other TOP is using it.
+	if (mySession) {
+		mySession->unsubscribe(mySubscription);
+		mySession.reset();
+	}
 
-		OP_ParAppendResult res = manager->appendMenu(sp, 2, names, labels);
-		assert(res == OP_ParAppendResult::Success);
+	// stop the current stream/pipe if it's running
+	if (pipeStarted) {
+		pipeStarted = false;
+		try {
+			pipe.stop();
+		}
+		catch (const std::exception&e) {
+			std::cout << "RS2 - Error: " << e.what() << std::endl;
+		}
 	}
 
-	// Sensor
-	{
-		OP_StringParameter	sp;
+	// nothing is producing anymore, so drop what's left over
+	QueuedFrame leftover;
+	while (myFrameQueue.pop(leftover)) {}
 
-		sp.name = "Sensor";
-		sp.label = "Sensor";
+	// Nothing is pushed anymore, so a recording that was turned off can
+	// finish.
+	if (!myRecordWanted)
+		myRecorder.stop();
 
-		sp.defaultValue = "";
+	myPlaybackDevice = rs2::device();
+	myPlaybackStatus = RS2_PLAYBACK_STATUS_UNKNOWN;
+	myPlaybackFrame = -1;
+}
+
+void
+CPUMemoryTOP::applyRecording()
+{
+	if (myRecordStart.exchange(false))
+	{
+		std::string path;
+		{
+			std::lock_guard<std::mutex> lock(mySlotMutex);
+			path = myRecordPath;
+		}
+		myRecorder.start(path);
+	}
+	else if (!myRecordWanted && myRecorder.recording())
+	{
+		myRecorder.stop();
+	}
+}
 
-		rs2::context ctx;
-		auto list = ctx.query_devices(); // Get a snapshot of currently connected devices
-		if (list.size() == 0)
-			throw std::runtime_error("No device detected. Is it plugged in?");
+void
+CPUMemoryTOP::setStepping(bool stepping)
+{
+	{
+		std::lock_guard<std::mutex> lock(myStepMutex);
+		myStepping = stepping;
+		myStepsGranted = 0;
+		myStepsTaken = 0;
+		myStepSeekTarget = -1;
+		myStepSeekBelow = false;
+	}
+	myStepCondition.notify_all();
+}
 
-		size_t numDevices = list.size();
-		std::vector<const char*> names;
-		std::vector<const char*> labels;
+void
+CPUMemoryTOP::applyPlayback()
+{
+	bool sequence = myPlayer.playing();
+	if (!myPlaybackDevice && !sequence)
+		return;
 
-		std::vector<std::string> names_strs;
-		std::vector<std::string> labels_strs;
+	try
+	{
+		std::unique_ptr<rs2::playback> playback;
+		if (!sequence)
+			playback.reset(new rs2::playback(myPlaybackDevice));
+
+		bool realtime = myPlaybackRealtime;
+		if (realtime != myAppliedRealtime)
+		{
+			// Close the gate first when going real time, so the callback
+			// isn't left waiting for a step.
+			if (realtime)
+				setStepping(false);
+			if (sequence)
+				myPlayer.setRealTime(realtime);
+			else
+				playback->set_real_time(realtime);
+			if (!realtime)
+				setStepping(true);
+			myAppliedRealtime = realtime;
+		}
 
-		for (auto dev : list) {
-			std::stringstream ss;
-			ss << "Sensor";
-			ss << dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
-			names_strs.push_back(ss.str());
-			labels_strs.push_back(ss.str());
+		float speed = myPlaybackSpeed;
+		if (speed != myAppliedSpeed)
+		{
+			if (sequence)
+				myPlayer.setSpeed(speed);
+			else
+				playback->set_playback_speed(speed);
+			myAppliedSpeed = speed;
 		}
 
-		// Convert to a vector of c-style strings
-		for (const auto& string : names_strs) names.push_back(string.c_str());
-		for (const auto& string : labels_strs) labels.push_back(string.c_str());
+		if (mySeekRequested.exchange(false))
+		{
+			int fps = std::max((int)myStreamFPS, 1);
+			int64_t frame = std::max(mySeekFrame.load(), 0);
 
-		sp.defaultValue = names[0];
+			if (myStepping)
+			{
+				// The callback drops what it's holding and everything else
+				// up to the target, then waits with that for the next cook.
+				{
+					std::lock_guard<std::mutex> lock(myStepMutex);
+					myStepSeekTarget = frame;
+					myStepSeekBelow = false;
+				}
+				myStepCondition.notify_all();
+			}
 
-		OP_ParAppendResult res = manager->appendMenu(sp, numDevices, names.data(), labels.data());
-		assert(res == OP_ParAppendResult::Success);
+			if (sequence)
+			{
+				// The index finds the frame directly.
+				myPlayer.seek((uint32_t)frame);
+			}
+			else
+			{
+				// Half a frame early, so the file's first frame starting a
+				// little after the recording doesn't make us land past the
+				// target.
+				double seconds = std::max(frame - 0.5, 0.) / fps;
+				playback->seek(std::chrono::nanoseconds((int64_t)(seconds * 1e9)));
+			}
+		}
 	}
-
-	// pulse
-	/*
+	catch (const std::exception&e)
 	{
-		OP_NumericParameter	np;
-
-		np.name = "Reset";
-		np.label = "Reset";
-		
-		OP_ParAppendResult res = manager->appendPulse(np);
-		assert(res == OP_ParAppendResult::Success);
+		std::cout << "RS2 - Error: " << e.what() << std::endl;
 	}
-	*/
+}
 
+void
+CPUMemoryTOP::failDevice(const std::string& message)
+{
+	std::cout << "RS2 - Error: " << message << std::endl;
+	// Whoever opens the camera next starts over instead of joining the
+	// stream that just failed.
+	if (mySession)
+		mySession->markFailed();
+	closeDevice();
+	setDeviceState(DeviceState::Error, message);
 }
 
 void
-CPUMemoryTOP::pulsePressed(const char* name)
+CPUMemoryTOP::openDevice(const DeviceRequest& request, DeviceState state)
 {
-	if (!strcmp(name, "Reset"))
+	setDeviceState(state);
+	closeDevice();
+
+	try
 	{
+		rs2::config config;
+		std::string warning;
+		auto addWarning = [&warning](const std::string& text) {
+			if (!warning.empty())
+				warning += " ";
+			warning += text;
+		};
+		bool playback = request.sensorID == FileSensor;
+		std::string serial;
+		DeviceSession::Streams streams;
+		rs2::video_stream_profile& depthProfile = streams.depth;
+
+		if (playback)
+		{
+			// Nothing to retry until a file is chosen.
+			if (request.file.empty())
+			{
+				{
+					std::lock_guard<std::mutex> lock(myDeviceMutex);
+					myDeviceWarning = "Choose a .bag or .rvl file to play back.";
+				}
+				setDeviceState(DeviceState::Idle);
+				return;
+			}
+
+			if (isDepthSequencePath(request.file))
+			{
+				openSequence(request);
+				return;
+			}
+
+			// The recording decides the resolution and frame rate, and the
+			// color format.
+			auto fileConfig = [&request](bool others) {
+				rs2::config c;
+				c.enable_device_from_file(request.file, request.loop);
+				c.enable_stream(RS2_STREAM_DEPTH);
+				if (others && request.color)
+					c.enable_stream(RS2_STREAM_COLOR);
+				if (others && request.infraredLeft)
+					c.enable_stream(RS2_STREAM_INFRARED, 1);
+				if (others && request.infraredRight)
+					c.enable_stream(RS2_STREAM_INFRARED, 2);
+				return c;
+			};
+			bool others = request.color || request.infraredLeft || request.infraredRight;
+			config = fileConfig(others);
+			if (others && !config.can_resolve(pipe))
+			{
+				config = fileConfig(false);
+				addWarning("The recording doesn't have the streams this Image mode needs.");
+			}
+		}
+		else
+		{
+			// The cache is kept current as cameras come and go, so this
+			// doesn't enumerate the devices again.
+			DeviceCache& cache = DeviceCache::instance();
+			DeviceCache::Device cached;
+			if (!cache.find(sensorSerial(request.sensorID), cached)) {
+				if (cache.devices().empty())
+					throw std::runtime_error("No device detected. Is it plugged in?");
+				throw std::runtime_error(request.sensorID + " is not connected.");
+			}
 
+			//dev.hardware_reset();
+			//rs2::device_hub hub(ctx);
+			//dev = hub.wait_for_device();
+
+			depthProfile = findDepthProfile(cached.device, request.width, request.height, request.fps);
+			if (!depthProfile) {
+				throw std::runtime_error("Device has no Z16 depth stream.");
+			}
+
+			if (depthProfile.width() != request.width || depthProfile.height() != request.height ||
+				depthProfile.fps() != request.fps)
+			{
+				std::stringstream ws;
+				ws << request.width << "x" << request.height << " @ " << request.fps
+					<< " is not supported by " << request.sensorID << ", using "
+					<< depthProfile.width() << "x" << depthProfile.height() << " @ "
+					<< depthProfile.fps() << ".";
+				warning = ws.str();
+			}
+
+			if (request.color)
+			{
+				streams.color = findColorProfile(cached.device, depthProfile.width(),
+					depthProfile.height(), depthProfile.fps());
+				if (!streams.color)
+					addWarning(request.sensorID + " has no color stream.");
+			}
+
+			// The infrared imagers are the ones depth is computed from, so
+			// they share its resolution and frame rate.
+			streams.infraredLeft = request.infraredLeft &&
+				hasInfraredProfile(cached.device, 1, depthProfile);
+			streams.infraredRight = request.infraredRight &&
+				hasInfraredProfile(cached.device, 2, depthProfile);
+			if (streams.infraredLeft != request.infraredLeft ||
+				streams.infraredRight != request.infraredRight)
+				addWarning(request.sensorID + " has no infrared stream at this resolution.");
+
+			serial = cached.serial;
+		}
+
+		// Playback numbers its frames from the first one. Without real time
+		// the gate has to be closed before the first frame can arrive.
+		myPlaybackStart = -1.;
+		myPlaybackFrame = playback ? 0 : -1;
+		bool realtime = myPlaybackRealtime;
+		setStepping(playback && !realtime);
+
+		if (playback)
+		{
+			rs2::pipeline_profile profile = pipe.start(config, [this](rs2::frame frame) {
+				onFrame(std::move(frame));
+			});
+			if (!profile) {
+				throw std::runtime_error("Failed to start the pipeline.");
+			}
+			pipeStarted = true;
+
+			myStreamFPS = profile.get_stream(RS2_STREAM_DEPTH).fps();
+
+			rs2::device dev = profile.get_device();
+
+			for (rs2::sensor& sensor : dev.query_sensors())
+			{
+				// Check if the sensor is a depth sensor
+				if (rs2::depth_sensor dpt = sensor.as<rs2::depth_sensor>())
+				{
+					depth_scale = dpt.get_depth_scale();
+					break;
+				}
+			}
+
+			rs2::playback file = dev.as<rs2::playback>();
+			file.set_status_changed_callback([this](rs2_playback_status status) {
+				myPlaybackStatus = (int32_t)status;
+			});
+			file.set_real_time(realtime);
+			myAppliedRealtime = realtime;
+			myAppliedSpeed = myPlaybackSpeed;
+			file.set_playback_speed(myAppliedSpeed);
+			myPlaybackDevice = dev;
+		}
+		else
+		{
+			// Another TOP may already be streaming from this camera. Then
+			// this one subscribes to that stream instead of opening the
+			// camera a second time.
+			mySession = DeviceSession::acquire(deviceContext(), serial);
+			mySubscription = mySession->subscribe([this](rs2::frame frame) {
+				onFrame(std::move(frame));
+			});
+
+			DeviceSession::Streams running = mySession->start(mySubscription, streams);
+			const rs2::video_stream_profile& streaming = running.depth;
+			if (streaming.width() != depthProfile.width() || streaming.height() != depthProfile.height() ||
+				streaming.fps() != depthProfile.fps())
+			{
+				std::stringstream ws;
+				ws << request.sensorID << " is shared with another TOP streaming at "
+					<< streaming.width() << "x" << streaming.height() << " @ " << streaming.fps()
+					<< ".";
+				warning = ws.str();
+			}
+			if ((streams.color && !running.color) ||
+				(streams.infraredLeft && !running.infraredLeft) ||
+				(streams.infraredRight && !running.infraredRight))
+			{
+				addWarning(request.sensorID + " is shared with another TOP that doesn't "
+					"stream what this Image mode needs.");
+			}
+
+			myStreamFPS = streaming.fps();
+			depth_scale = mySession->depthScale();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(myDeviceMutex);
+			myDeviceWarning = warning;
+		}
+
+		// Stays in 'state' until the capture thread sees the first frame.
+		myLastFrameTime = monotonicNanoseconds();
+		startCapture();
+	}
+	catch (const std::exception&e)
+	{
+		failDevice(e.what());
+	}
+}
+
+void
+CPUMemoryTOP::openSequence(const DeviceRequest& request)
+{
+	{
+		std::lock_guard<std::mutex> lock(myDeviceMutex);
+		myDeviceWarning.clear();
+		if (request.color || request.infraredLeft || request.infraredRight)
+			myDeviceWarning = ".rvl recordings only hold depth.";
+	}
+
+	myPlaybackStart = -1.;
+	myPlaybackFrame = 0;
+	bool realtime = myPlaybackRealtime;
+	setStepping(!realtime);
+
+	myAppliedRealtime = realtime;
+	myAppliedSpeed = myPlaybackSpeed;
+	myPlayer.start(request.file, request.loop, realtime, myAppliedSpeed,
+		[this](rs2::frame frame) {
+			onFrame(std::move(frame));
+		},
+		[this](rs2_playback_status status) {
+			myPlaybackStatus = (int32_t)status;
+		});
+
+	myStreamFPS = myPlayer.fps();
+	depth_scale = myPlayer.header().depthScale;
+
+	// Stays in the opening state until the capture thread sees the first
+	// frame.
+	myLastFrameTime = monotonicNanoseconds();
+	startCapture();
+}
+
+bool
+CPUMemoryTOP::getOutputFormat(TOP_OutputFormat* format)
+{
+	// In this function we could assign variable values to 'format' to specify
+	// the pixel format/resolution etc that we want to output to.
+	// If we did that, we'd want to return true to tell the TOP to use the settings we've
+	// specified.
+
+	// Only changes when a new profile starts streaming, so TouchDesigner
+	// keeps the same buffers from cook to cook.
+	format->width = myStreamWidth;
+	format->height = myStreamHeight;
+	format->bitsPerChannel = 16;
+	format->numColorBuffers = 1;
+	format->floatPrecision = true;
+
+	bool needOtherChannels = image_mode == (int)ImageMode::Pointcloud ||
+		image_mode == (int)ImageMode::PointcloudCompact || image_mode == (int)ImageMode::NormalsFloat;
+
+	format->redChannel = true;
+	format->blueChannel = needOtherChannels;
+	format->greenChannel = needOtherChannels;
+	format->alphaChannel = needOtherChannels;
+
+	if (image_mode == (int)ImageMode::PointcloudPacked) {
+		// The half floats are stored bit for bit in 32-bit float channels,
+		// so the texture must not be converted to a lower precision.
+		format->bitsPerChannel = 32;
+		format->greenChannel = true;
+	}
+
+	if (image_mode == (int)ImageMode::Raw) {
+		format->bitsPerChannel = 8;
+		format->floatPrecision = false;
+		format->greenChannel = true;
+	}
+
+	if (image_mode == (int)ImageMode::InfraredLeft || image_mode == (int)ImageMode::InfraredRight ||
+		image_mode == (int)ImageMode::InfraredStereo || image_mode == (int)ImageMode::ForegroundMask) {
+		format->bitsPerChannel = 8;
+		format->floatPrecision = false;
+		format->greenChannel = image_mode == (int)ImageMode::InfraredStereo;
+	}
+
+	if (image_mode == (int)ImageMode::Color || image_mode == (int)ImageMode::ColorAligned ||
+		image_mode == (int)ImageMode::Normals) {
+		format->bitsPerChannel = 8;
+		format->floatPrecision = false;
+		format->greenChannel = true;
+		format->blueChannel = true;
+		format->alphaChannel = true;
+	}
+
+	return true;
+}
+
+void
+CPUMemoryTOP::startCapture()
+{
+	myCaptureRunning = true;
+	myCaptureThread = std::thread(&CPUMemoryTOP::captureLoop, this);
+}
+
+void
+CPUMemoryTOP::stopCapture()
+{
+	myCaptureRunning = false;
+	if (myCaptureThread.joinable())
+		myCaptureThread.join();
+}
+
+void
+CPUMemoryTOP::invalidateSlots(std::unique_lock<std::mutex>& lock)
+{
+	mySlotCondition.wait(lock, [this] { return findSlot(SlotState::Writing) < 0; });
+
+	for (OutputSlot& slot : mySlots)
+	{
+		slot.data = nullptr;
+		slot.state = SlotState::Uploading;
+	}
+	mySlotGeneration++;
+}
+
+int
+CPUMemoryTOP::findSlot(SlotState state, bool newest) const
+{
+	int found = -1;
+	for (int i = 0; i < NumSlots; i++)
+	{
+		if (mySlots[i].state != state)
+			continue;
+		if (found < 0 ||
+			(newest ? mySlots[i].sequence > mySlots[found].sequence :
+				mySlots[i].sequence < mySlots[found].sequence))
+			found = i;
+	}
+	return found;
+}
+
+bool
+CPUMemoryTOP::waitForStep(int64_t index)
+{
+	std::unique_lock<std::mutex> lock(myStepMutex);
+	while (myStepping)
+	{
+		if (myStepSeekTarget >= 0)
+		{
+			if (index < myStepSeekTarget)
+			{
+				myStepSeekBelow = true;
+				return false;
+			}
+			// Still one read before the seek.
+			if (index > myStepSeekTarget && !myStepSeekBelow)
+				return false;
+			myStepSeekTarget = -1;
+		}
+
+		if (myStepsTaken < myStepsGranted)
+		{
+			myStepsTaken++;
+			return true;
+		}
+		myStepCondition.wait(lock);
+	}
+	return true;
+}
+
+void
+CPUMemoryTOP::onFrame(rs2::frame frame)
+{
+	// File playback: number the frame and, unless playing in real time,
+	// hold it until execute() asks for the next one.
+	if (myPlaybackFrame >= 0)
+	{
+		int64_t index = playbackFrameIndex(frame, myPlaybackStart);
+		if (myStepping && !waitForStep(index))
+			return;
+		myPlaybackFrame = index;
+	}
+
+	// The recorder copies the frame here and writes it on its own thread,
+	// so the disk never holds up this callback or the cook.
+	if (myRecorder.recording())
+	{
+		rs2::frame depth = frame;
+		if (rs2::frameset frames = frame.as<rs2::frameset>())
+			depth = frames.first_or_default(RS2_STREAM_DEPTH);
+		if (depth)
+			myRecorder.push(depth.as<rs2::video_frame>(), depth_scale);
+	}
+
+	myFramesReceived++;
+
+	// Frame timestamps are only comparable to the host clock when they're
+	// in the system or global time domain, not the camera's own clock.
+	if (frame.get_frame_timestamp_domain() != RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK)
+	{
+		double arrival;
+		if (frame.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL))
+			arrival = (double)frame.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL);
+		else
+			arrival = std::chrono::duration<double, std::milli>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+		myDeviceLatency.add(arrival - frame.get_timestamp());
+	}
+
+	QueuedFrame queued;
+	queued.frame = std::move(frame);
+	queued.queuedAt = monotonicNanoseconds();
+
+	if (!myFrameQueue.push(std::move(queued)))
+	{
+		myFramesDroppedQueue++;
+		return;
+	}
+	myFrameCondition.notify_one();
+}
+
+bool
+CPUMemoryTOP::nextFrame(QueuedFrame& frame)
+{
+	if (!myFrameQueue.pop(frame))
+	{
+		// The producer notifies without taking myFrameMutex, so a wakeup can
+		// slip in between the check and the wait. Keep the timeout short so
+		// that costs at most a couple of milliseconds.
+		std::unique_lock<std::mutex> lock(myFrameMutex);
+		myFrameCondition.wait_for(lock, std::chrono::milliseconds(2),
+			[this] { return myFrameQueue.size() > 0 || !myCaptureRunning; });
+		lock.unlock();
+
+		if (!myFrameQueue.pop(frame))
+			return false;
+	}
+
+	if ((QueuePolicy)myQueuePolicy.load() == QueuePolicy::Latest)
+	{
+		QueuedFrame newer;
+		while (myFrameQueue.pop(newer))
+		{
+			frame = std::move(newer);
+			myFramesDroppedStale++;
+		}
+	}
+
+	myQueueWait.add(elapsedMilliseconds(frame.queuedAt, monotonicNanoseconds()));
+	return true;
+}
+
+void
+CPUMemoryTOP::captureLoop()
+{
+	while (myCaptureRunning)
+	{
+		try
+		{
+			QueuedFrame queued;
+			if (!nextFrame(queued)) {
+				continue;
+			}
+
+			CapturedFrames captured;
+			captured.depth = queued.frame;
+			if (rs2::frameset frames = queued.frame.as<rs2::frameset>())
+			{
+				captured.depth = frames.first_or_default(RS2_STREAM_DEPTH);
+				captured.color = frames.first_or_default(RS2_STREAM_COLOR);
+				captured.infrared[0] = frames.get_infrared_frame(1);
+				captured.infrared[1] = frames.get_infrared_frame(2);
+			}
+			// With other streams running, librealsense can hand over a set
+			// without depth, e.g. while the streams start up.
+			rs2::frame& depth_frame = captured.depth;
+			if (!depth_frame)
+				continue;
+
+			DepthFilterChain::Settings filters;
+			{
+				std::lock_guard<std::mutex> lock(myFilterMutex);
+				filters = myFilterSettings;
+			}
+
+			// On its own, the Clip range is cheaper to apply while
+			// converting. With other filters it has to go in front of them,
+			// so e.g. the spatial filter doesn't smooth the background into
+			// the range.
+			bool clip = filters.threshold;
+			filters.threshold = clip && (filters.decimation || filters.spatial ||
+				filters.temporal || filters.holeFilling);
+			clip = clip && !filters.threshold;
+
+			myFilters.configure(filters);
+			if (myFilters.active())
+			{
+				int64_t start = monotonicNanoseconds();
+				depth_frame = myFilters.process(depth_frame);
+				myFilterTime.add(elapsedMilliseconds(start, monotonicNanoseconds()));
+			}
+			else
+				myFilterTime.clear();
+
+			myLastFrameTime = monotonicNanoseconds();
+			DeviceState state = (DeviceState)myDeviceState.load();
+			if (state == DeviceState::Opening || state == DeviceState::Recovering)
+				setDeviceState(DeviceState::Streaming);
+
+			// Some modes need other streams than depth, and are sized by
+			// them.
+			int sizeMode;
+			{
+				std::lock_guard<std::mutex> lock(mySlotMutex);
+				sizeMode = mySlotMode;
+			}
+			rs2::frame sizing = sizingFrame(captured, sizeMode);
+			if (!sizing)
+				continue;
+
+			// Let the output texture follow the frames that actually arrive.
+			// Until execute() sees the new size, frames are dropped below and
+			// the previous texture stays up.
+			rs2::video_frame video = sizing.as<rs2::video_frame>();
+			int downsample = usesDownsample(sizeMode) ? (int)myDownsample : 1;
+			if (video.get_width() < downsample || video.get_height() < downsample)
+				downsample = 1;
+			ConversionKernels::Reduction reduction = (ConversionKernels::Reduction)myReduction.load();
+			int frameWidth = video.get_width() / downsample;
+			int frameHeight = video.get_height() / downsample;
+			int maxPoints = myCompactMax;
+			if (sizeMode == (int)ImageMode::PointcloudCompact)
+				frameHeight = compactHeight(frameWidth, frameHeight, maxPoints);
+			myStreamWidth = frameWidth;
+			myStreamHeight = frameHeight;
+
+			int slot = -1;
+			void* dst;
+			int width, height, mode, generation;
+			bool flip;
+			{
+				std::unique_lock<std::mutex> lock(mySlotMutex);
+
+				while (myCaptureRunning)
+				{
+					// A playback step can't be dropped, so wait for execute()
+					// to size the slots for it.
+					if (myStepping && (frameWidth != mySlotWidth ||
+						frameHeight != mySlotHeight))
+					{
+						mySlotCondition.wait_for(lock, std::chrono::milliseconds(100));
+						continue;
+					}
+
+					// Prefer a slot that isn't holding an unpublished frame.
+					slot = findSlot(SlotState::Free);
+					if (slot >= 0)
+						break;
+
+					if ((QueuePolicy)myQueuePolicy.load() == QueuePolicy::Fifo)
+					{
+						// Keep order: wait for execute() to publish the
+						// ready frames and hand us fresh memory.
+						mySlotCondition.wait_for(lock, std::chrono::milliseconds(100));
+						continue;
+					}
+
+					// Otherwise replace the oldest unpublished frame with
+					// this newer one.
+					slot = findSlot(SlotState::Ready);
+					if (slot >= 0)
+						myFramesDroppedSlot++;
+					break;
+				}
+				if (slot < 0)
+					continue;
+
+				mySlots[slot].state = SlotState::Writing;
+				dst = mySlots[slot].data;
+				width = mySlotWidth;
+				height = mySlotHeight;
+				mode = mySlotMode;
+				flip = myFlip;
+				generation = mySlotGeneration;
+			}
+
+			myWorkers.setThreadCount(myThreadCount);
+
+			bool matches = frameWidth == width && frameHeight == height && mode == sizeMode;
+			if (matches)
+			{
+				int64_t start = monotonicNanoseconds();
+				convertFrame(captured, dst, downsample, reduction, mode, flip, clip,
+					filters.thresholdMin, filters.thresholdMax, maxPoints);
+				myConversionTime.add(elapsedMilliseconds(start, monotonicNanoseconds()));
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mySlotMutex);
+				OutputSlot& written = mySlots[slot];
+				if (generation != mySlotGeneration)
+					written.state = SlotState::Uploading;
+				else if (matches)
+				{
+					written.state = SlotState::Ready;
+					written.sequence = ++myReadySequence;
+				}
+				else
+					written.state = SlotState::Free;
+			}
+			mySlotCondition.notify_all();
+		}
+		catch (const std::exception&e)
+		{
+			std::cout << "RS - Error: " << e.what() << std::endl;
+		}
+	}
+}
+
+void
+CPUMemoryTOP::convertFrame(const CapturedFrames& frames, void* dst,
+							int downsample, ConversionKernels::Reduction reduction,
+							int mode, bool flip, bool clip, float clipNear, float clipFar,
+							int maxPoints)
+{
+	// Infrared is copied as is, without any of the depth processing.
+	if (usesInfraredLeft(mode) || usesInfraredRight(mode))
+	{
+		rs2::video_frame left = frames.infrared[0].as<rs2::video_frame>();
+		rs2::video_frame right = frames.infrared[1].as<rs2::video_frame>();
+		rs2::video_frame image = mode == (int)ImageMode::InfraredRight ? right : left;
+		const uint8_t* src = (const uint8_t*)image.get_data();
+		int stride = image.get_stride_in_bytes();
+		int width = image.get_width();
+		int height = image.get_height();
+
+		if (mode == (int)ImageMode::InfraredStereo)
+		{
+			if (right.get_width() != width || right.get_height() != height)
+				return;
+			const uint8_t* other = (const uint8_t*)right.get_data();
+			int otherStride = right.get_stride_in_bytes();
+			myWorkers.parallelFor(height, [&](int begin, int end) {
+				ConversionKernels::interleaveY8Rows(src, stride, other, otherStride, width, height,
+					(uint8_t*)dst, flip, begin, end);
+			});
+		}
+		else
+		{
+			myWorkers.parallelFor(height, [&](int begin, int end) {
+				ConversionKernels::copyY8Rows(src, stride, width, height, (uint8_t*)dst, flip,
+					begin, end);
+			});
+		}
+		return;
+	}
+
+	const rs2::frame& depth_frame = frames.depth;
+
+	// Depth units that still count as inside the Clip range.
+	uint16_t clipLow = 0;
+	uint16_t clipHigh = 0xFFFF;
+	float scale = depth_scale;
+	if (clip && scale > 0.f)
+	{
+		double nearest = std::ceil(clipNear / scale);
+		double farthest = std::floor(clipFar / scale);
+		clipLow = (uint16_t)std::min(std::max(nearest, 1.), 65535.);
+		clipHigh = (uint16_t)std::min(std::max(farthest, 0.), 65535.);
+	}
+
+	if (usesColor(mode))
+	{
+		convertColorFrame(frames, dst, mode, flip, clipLow, clipHigh);
+		return;
+	}
+
+	// The compact point cloud, the normals and the foreground modes convert
+	// to meters first, and work from that themselves.
+	bool compact = mode == (int)ImageMode::PointcloudCompact;
+	bool normals = usesNormals(mode);
+	ConversionKernels::Output output = compact || normals || usesBackground(mode) ?
+		ConversionKernels::Output::Depth :
+		(ConversionKernels::Output)mode;
+	// The background model stays in camera row order whatever Flip is set
+	// to, so it doesn't have to be learned again, and is flipped on output.
+	bool background = usesBackground(mode);
+	bool convertFlip = flip && !background;
+
+	bool blocks = downsample > 1;
+	if (mode != myConvertMode || convertFlip != myConvertFlip || clip != myConvertClip ||
+		blocks != myConvertBlocks || reduction != myConvertReduction || !myConvert)
+	{
+		myConvert = ConversionKernels::select(output, convertFlip, clip, blocks, reduction);
+		myConvertMode = mode;
+		myConvertFlip = convertFlip;
+		myConvertClip = clip;
+		myConvertBlocks = blocks;
+		myConvertReduction = reduction;
+	}
+	if (!myConvert)
+		return;
+
+	rs2::video_frame video = depth_frame.as<rs2::video_frame>();
+	ConversionKernels::Frame frame;
+	frame.src = (const uint16_t*)depth_frame.get_data();
+	frame.dst = dst;
+	frame.width = video.get_width();
+	frame.height = video.get_height();
+	frame.downsample = downsample;
+	frame.scale = scale;
+	frame.clipNear = clipLow;
+	frame.clipFar = clipHigh;
+
+	if (mode == (int)ImageMode::Pointcloud || mode == (int)ImageMode::PointcloudPacked ||
+		compact || normals)
+	{
+		rs2::video_stream_profile profile = depth_frame.get_profile().as<rs2::video_stream_profile>();
+		rs2_intrinsics intrinsics = profile.get_intrinsics();
+		if (blocks)
+			intrinsics = ConversionKernels::downsampleIntrinsics(intrinsics, downsample);
+		myDeprojection.update(intrinsics);
+		frame.rays = &myDeprojection;
+	}
+
+	// Every output row only depends on one input row, so the frame is
+	// split into bands of rows across the worker pool.
+	ConversionKernels::ConvertFunc convert = myConvert;
+	if (normals)
+	{
+		// Every normal needs the rows above and below it, so the whole
+		// frame is converted before any is estimated.
+		myNormals.resize(frame.outputWidth(), frame.outputHeight());
+		frame.dst = myNormals.depth();
+		myWorkers.parallelFor(frame.outputHeight(), [&](int begin, int end) {
+			convert(frame, begin, end);
+		});
+
+		NormalEstimator::Format format = mode == (int)ImageMode::NormalsFloat ?
+			NormalEstimator::Format::Float : NormalEstimator::Format::Fixed8;
+		bool curvature = myNormalCurvature;
+		float edgeRatio = myNormalEdge;
+		myWorkers.parallelFor(frame.outputHeight(), [&](int begin, int end) {
+			myNormals.estimateRows(myDeprojection, flip, format, curvature, edgeRatio, dst,
+				begin, end);
+		});
+		return;
+	}
+	if (background)
+	{
+		int height = frame.outputHeight();
+		myBackground.resize(frame.outputWidth(), height);
+		frame.dst = myBackground.depth();
+		myWorkers.parallelFor(height, [&](int begin, int end) {
+			convert(frame, begin, end);
+		});
+
+		// Learning starts with the frame after the pulse. The frames being
+		// learned are still masked, against the previous model.
+		int32_t request = myBackgroundRequest;
+		if (request != myBackgroundRequestHandled)
+		{
+			myBackgroundRequestHandled = request;
+			myBackground.startLearning(myBackgroundFrames);
+		}
+		if (myBackground.learning())
+		{
+			myWorkers.parallelFor(height, [&](int begin, int end) {
+				myBackground.learnRows(begin, end);
+			});
+			myBackground.finishFrame();
+		}
+		myBackgroundLearning = myBackground.learning();
+		myBackgroundFramesLearned = myBackground.learnedFrames();
+
+		BackgroundModel::Settings settings;
+		settings.statistic = (BackgroundModel::Statistic)myBackgroundStatistic.load();
+		settings.deviations = myBackgroundDeviations;
+		settings.margin = myBackgroundMargin;
+		if (myBackground.configure(settings))
+		{
+			myWorkers.parallelFor(height, [&](int begin, int end) {
+				myBackground.updateCutoffs(begin, end);
+			});
+		}
+
+		myWorkers.parallelFor(height, [&](int begin, int end) {
+			if (mode == (int)ImageMode::ForegroundMask)
+				myBackground.maskRows((uint8_t*)dst, flip, begin, end);
+			else
+				myBackground.maskDepthRows((float*)dst, flip, begin, end);
+		});
+		return;
+	}
+	if (!compact)
+	{
+		myWorkers.parallelFor(frame.outputHeight(), [&](int begin, int end) {
+			convert(frame, begin, end);
+		});
+		return;
+	}
+
+	// A few bands per thread, so a band that holds more points than the
+	// others doesn't leave the rest of the pool waiting in the second pass.
+	int width = frame.outputWidth();
+	int height = frame.outputHeight();
+	myCompactor.resize(width, height, myWorkers.threadCount() * 4);
+	frame.dst = myCompactor.depth();
+
+	myWorkers.parallelFor(myCompactor.bandCount(), [&](int begin, int end) {
+		for (int band = begin; band < end; band++)
+		{
+			convert(frame, myCompactor.bandBegin(band), myCompactor.bandEnd(band));
+			myCompactor.countBand(band);
+		}
+	});
+
+	int kept = myCompactor.prefixSum(maxPoints);
+
+	float* points = (float*)dst;
+	myWorkers.parallelFor(myCompactor.bandCount(), [&](int begin, int end) {
+		for (int band = begin; band < end; band++)
+			myCompactor.writeBand(band, myDeprojection, flip, points);
+	});
+
+	int capacity = width * compactHeight(width, height, maxPoints);
+	myWorkers.parallelFor(capacity - kept, [&](int begin, int end) {
+		myCompactor.clearTail(points, begin, end);
+	});
+
+	myCompactValid = myCompactor.validCount();
+	myCompactKept = kept;
+}
+
+void
+CPUMemoryTOP::convertColorFrame(const CapturedFrames& frames, void* dst, int mode, bool flip,
+								uint16_t clipNear, uint16_t clipFar)
+{
+	rs2::video_frame color = frames.color.as<rs2::video_frame>();
+	const uint8_t* colorData = (const uint8_t*)color.get_data();
+	int colorStride = color.get_stride_in_bytes();
+	int colorWidth = color.get_width();
+	int colorHeight = color.get_height();
+	rs2_format colorFormat = color.get_profile().format();
+	if (!isColorFormatSupported(colorFormat))
+		return;
+
+	if (mode == (int)ImageMode::Color)
+	{
+		myWorkers.parallelFor(colorHeight, [&](int begin, int end) {
+			convertColorRows(colorData, colorStride, colorFormat, colorWidth, colorHeight,
+				(uint8_t*)dst, flip, begin, end);
+		});
+		return;
+	}
+
+	rs2::video_frame depth = frames.depth.as<rs2::video_frame>();
+	rs2::video_stream_profile depthProfile = depth.get_profile().as<rs2::video_stream_profile>();
+	rs2::video_stream_profile colorProfile = color.get_profile().as<rs2::video_stream_profile>();
+	bool toColor = mode == (int)ImageMode::DepthAligned;
+
+	// Only rebuilt when the profiles change, e.g. with the Decimate filter.
+	AlignmentTable& table = myAlignment;
+	table.update(depthProfile.get_intrinsics(), colorProfile.get_intrinsics(),
+		depthProfile.get_extrinsics_to(colorProfile), depth_scale,
+		toColor ? AlignmentTable::Direction::DepthToColor : AlignmentTable::Direction::ColorToDepth);
+	if (table.depthWidth() != depth.get_width() || table.depthHeight() != depth.get_height() ||
+		table.colorWidth() != colorWidth || table.colorHeight() != colorHeight)
+		return;
+
+	const uint16_t* depthData = (const uint16_t*)depth.get_data();
+	if (toColor)
+	{
+		// Each pass has to finish on every band before the next one starts.
+		myWorkers.parallelFor(colorHeight, [&](int begin, int end) {
+			table.clearDepth(begin, end);
+		});
+		bool concurrent = myWorkers.threadCount() > 1;
+		myWorkers.parallelFor(depth.get_height(), [&](int begin, int end) {
+			table.scatterDepth(depthData, clipNear, clipFar, concurrent, begin, end);
+		});
+		myWorkers.parallelFor(colorHeight, [&](int begin, int end) {
+			table.resolveDepth((float*)dst, flip, begin, end);
+		});
+		return;
+	}
+
+	// Gathering reads BGRA8 pixels, anything else is converted first.
+	if (colorFormat != RS2_FORMAT_BGRA8)
+	{
+		myColorScratch.resize((size_t)colorWidth * colorHeight * 4);
+		uint8_t* scratch = myColorScratch.data();
+		myWorkers.parallelFor(colorHeight, [&](int begin, int end) {
+			convertColorRows(colorData, colorStride, colorFormat, colorWidth, colorHeight,
+				scratch, false, begin, end);
+		});
+		colorData = scratch;
+		colorStride = colorWidth * 4;
+	}
+
+	myWorkers.parallelFor(depth.get_height(), [&](int begin, int end) {
+		table.gatherColor(depthData, colorData, colorStride, (uint8_t*)dst, flip,
+			clipNear, clipFar, begin, end);
+	});
+}
+
+void
+CPUMemoryTOP::execute(const TOP_OutputFormatSpecs* outputFormat,
+						OP_Inputs* inputs,
+						TOP_Context *context)
+{
+	myExecuteCount++;
+	int64_t cookStart = monotonicNanoseconds();
+
+	try
+	{
+
+		DeviceRequest request = myRequest;
+		request.sensorID = inputs->getParString("Sensor");
+
+		bool playback = request.sensorID == FileSensor;
+		if (playback) {
+			request.width = request.height = request.fps = 0;
+			request.file = inputs->getParFilePath("File");
+			request.loop = inputs->getParInt("Loop") != 0;
+		} else {
+			parseResolution(inputs->getParString("Resolution"), request.width, request.height);
+			parseFPS(inputs->getParString("Fps"), request.fps);
+			request.file.clear();
+			request.loop = true;
+		}
+
+		// Color and infrared only stream while a mode needs them.
+		int newImageMode = inputs->getParInt("Image");
+		request.color = usesColor(newImageMode);
+		request.infraredLeft = usesInfraredLeft(newImageMode);
+		request.infraredRight = usesInfraredRight(newImageMode);
+
+		// Applied by the device thread without reopening the file.
+		bool realtime = inputs->getParInt("Realtime") != 0;
+		myPlaybackRealtime = realtime;
+		myPlaybackSpeed = (float)inputs->getParDouble("Speed");
+		mySeekFrame = inputs->getParInt("Seekframe");
+
+		// Only the parameters of the selected source apply.
+		inputs->enablePar("Resolution", !playback);
+		inputs->enablePar("Fps", !playback);
+		inputs->enablePar("File", playback);
+		inputs->enablePar("Realtime", playback);
+		inputs->enablePar("Loop", playback);
+		inputs->enablePar("Speed", playback && realtime);
+		inputs->enablePar("Seekframe", playback);
+		inputs->enablePar("Seek", playback);
+
+		// Opening the device happens on the device thread. Until the new
+		// stream delivers frames the last texture stays up.
+		if (request != myRequest) {
+			myRequest = request;
+			postDeviceRequest(request);
+		}
+
+		myQueuePolicy = inputs->getParInt("Queuepolicy");
+		myFrameQueue.setLimit(inputs->getParInt("Queuedepth"));
+		myThreadCount = inputs->getParInt("Threads");
+		myFlip = inputs->getParInt("Flip") != 0;
+		// The menu goes 1x, 2x, 4x, 8x.
+		myDownsample = 1 << std::min(std::max(inputs->getParInt("Downsample"), 0), 3);
+		myReduction = inputs->getParInt("Reduction");
+		inputs->enablePar("Downsample", usesDownsample(newImageMode));
+		inputs->enablePar("Reduction", myDownsample > 1 && usesDownsample(newImageMode));
+		myCompactMax = inputs->getParInt("Compactmax");
+		inputs->enablePar("Compactmax", newImageMode == (int)ImageMode::PointcloudCompact);
+		myNormalCurvature = inputs->getParInt("Normalcurvature") != 0;
+		myNormalEdge = (float)inputs->getParDouble("Normaledge");
+		inputs->enablePar("Normalcurvature", usesNormals(newImageMode));
+		inputs->enablePar("Normaledge", usesNormals(newImageMode));
+		myBackgroundFrames = inputs->getParInt("Backgroundframes");
+		myBackgroundStatistic = inputs->getParInt("Backgroundmodel");
+		myBackgroundDeviations = (float)inputs->getParDouble("Backgrounddeviations");
+		myBackgroundMargin = (float)inputs->getParDouble("Backgroundmargin");
+		inputs->enablePar("Learnbackground", usesBackground(newImageMode));
+		inputs->enablePar("Backgroundframes", usesBackground(newImageMode));
+		inputs->enablePar("Backgroundmodel", usesBackground(newImageMode));
+		inputs->enablePar("Backgrounddeviations", usesBackground(newImageMode) &&
+			myBackgroundStatistic == (int32_t)BackgroundModel::Statistic::MeanVariance);
+		inputs->enablePar("Backgroundmargin", usesBackground(newImageMode));
+		if (newImageMode != (int)ImageMode::PointcloudCompact) {
+			myCompactValid = 0;
+			myCompactKept = 0;
+		}
+
+		DepthFilterChain::Settings filters;
+		filters.threshold = inputs->getParInt("Clip") != 0;
+		filters.thresholdMin = (float)inputs->getParDouble("Cliprange", 0);
+		filters.thresholdMax = (float)inputs->getParDouble("Cliprange", 1);
+		inputs->enablePar("Cliprange", filters.threshold);
+
+		filters.decimation = inputs->getParInt("Decimate") != 0;
+		filters.decimationMagnitude = inputs->getParInt("Decimatemag");
+		inputs->enablePar("Decimatemag", filters.decimation);
+
+		filters.spatial = inputs->getParInt("Spatial") != 0;
+		filters.spatialMagnitude = inputs->getParInt("Spatialmag");
+		filters.spatialAlpha = (float)inputs->getParDouble("Spatialalpha");
+		filters.spatialDelta = inputs->getParInt("Spatialdelta");
+		filters.spatialHoles = inputs->getParInt("Spatialholes");
+		inputs->enablePar("Spatialmag", filters.spatial);
+		inputs->enablePar("Spatialalpha", filters.spatial);
+		inputs->enablePar("Spatialdelta", filters.spatial);
+		inputs->enablePar("Spatialholes", filters.spatial);
+
+		filters.temporal = inputs->getParInt("Temporal") != 0;
+		filters.temporalAlpha = (float)inputs->getParDouble("Temporalalpha");
+		filters.temporalDelta = inputs->getParInt("Temporaldelta");
+		filters.temporalPersistence = inputs->getParInt("Temporalpersist");
+		inputs->enablePar("Temporalalpha", filters.temporal);
+		inputs->enablePar("Temporaldelta", filters.temporal);
+		inputs->enablePar("Temporalpersist", filters.temporal);
+
+		filters.holeFilling = inputs->getParInt("Holefill") != 0;
+		filters.holeFillingMode = inputs->getParInt("Holefillmode");
+		inputs->enablePar("Holefillmode", filters.holeFilling);
+
+		{
+			std::lock_guard<std::mutex> filterLock(myFilterMutex);
+			myFilterSettings = filters;
+		}
+
+		// Turning Record on starts a new file, on the device thread. Reopening
+		// the device keeps the current one going.
+		bool record = inputs->getParInt("Record") != 0;
+
+		std::unique_lock<std::mutex> lock(mySlotMutex);
+
+		bool recordChanged = record != myRecordWanted;
+		if (record && !myRecordWanted)
+		{
+			myRecordPath = inputs->getParFilePath("Recordfile");
+			myRecordStart = true;
+		}
+		myRecordWanted = record;
+		// The device thread starts and stops the recorder.
+		if (recordChanged)
+			myDeviceCondition.notify_all();
+
+		if (outputFormat->width != mySlotWidth ||
+			outputFormat->height != mySlotHeight ||
+			image_mode != mySlotMode)
+		{
+			invalidateSlots(lock);
+			mySlotWidth = outputFormat->width;
+			mySlotHeight = outputFormat->height;
+			mySlotMode = image_mode;
+		}
+
+		// Pointers for locations we didn't upload last time are unchanged,
+		// the one we did upload has been replaced by a fresh block and is
+		// ours again.
+		for (int i = 0; i < NumSlots; i++)
+		{
+			OutputSlot& slot = mySlots[i];
+			if (slot.state == SlotState::Writing)
+				continue;
+
+			slot.data = outputFormat->cpuPixelData[i];
+			if (slot.state == SlotState::Uploading)
+				slot.state = slot.data ? SlotState::Free : SlotState::Uploading;
+		}
+
+		// Non-real-time playback advances exactly one frame per cook, and
+		// this cook shows it.
+		if (myStepping && findSlot(SlotState::Ready) < 0 &&
+			myPlaybackStatus != RS2_PLAYBACK_STATUS_STOPPED)
+		{
+			{
+				std::lock_guard<std::mutex> stepLock(myStepMutex);
+				if (myStepsGranted == myStepsTaken)
+					myStepsGranted++;
+			}
+			myStepCondition.notify_all();
+			mySlotCondition.notify_all();
+
+			mySlotCondition.wait_for(lock, StepTimeout,
+				[this] { return findSlot(SlotState::Ready) >= 0 || !myStepping; });
+		}
+
+		// Fifo shows every frame in order, Latest the newest one and drops
+		// the rest. Without a new frame the location stays -1 and the
+		// previous texture stays up.
+		bool fifo = (QueuePolicy)myQueuePolicy.load() == QueuePolicy::Fifo;
+		int ready = findSlot(SlotState::Ready, !fifo);
+		if (!fifo)
+		{
+			for (OutputSlot& slot : mySlots)
+			{
+				if (slot.state == SlotState::Ready && &slot != &mySlots[ready])
+				{
+					slot.state = SlotState::Free;
+					myFramesDroppedSlot++;
+				}
+			}
+		}
+
+		outputFormat->newCPUPixelDataLocation = -1;
+		if (ready >= 0)
+		{
+			// The uploaded location becomes invalid once we return.
+			outputFormat->newCPUPixelDataLocation = ready;
+			mySlots[ready].state = SlotState::Uploading;
+
+			myFramesPublished++;
+			if (myLastPublishTime)
+				myPublishInterval.add(elapsedMilliseconds(myLastPublishTime, cookStart));
+			myLastPublishTime = cookStart;
+		}
+		mySlotCondition.notify_all();
+
+		// A new image mode changes the pixel format, so TouchDesigner will
+		// hand us different memory on the next cook.
+		if (newImageMode != image_mode)
+		{
+			invalidateSlots(lock);
+			image_mode = newImageMode;
+		}
+	}
+	catch (const std::exception&e)
+	{
+		std::cout << "RS - Error: " << e.what() << std::endl;
+	}
+
+	myCookTime.add(elapsedMilliseconds(cookStart, monotonicNanoseconds()));
+}
+
+const char*
+CPUMemoryTOP::getWarningString()
+{
+	{
+		std::lock_guard<std::mutex> lock(myDeviceMutex);
+		myWarning = myDeviceError.empty() ? myDeviceWarning : myDeviceError;
+	}
+
+	if (myWarning.empty())
+	{
+		std::string recordError = myRecorder.error();
+		if (!recordError.empty())
+			myWarning = "Recording failed: " + recordError;
+	}
+
+	if (myWarning.empty())
+		return nullptr;
+	return myWarning.c_str();
+}
+
+// Adds name + "Min", "Mean" and "P99" channels for a rolling window.
+static void
+appendStats(std::vector<std::pair<std::string, float>>& chans, const char* name,
+			const RollingStats& stats)
+{
+	RollingStats::Summary summary = stats.summary();
+	chans.emplace_back(std::string(name) + "Min", (float)summary.min);
+	chans.emplace_back(std::string(name) + "Mean", (float)summary.mean);
+	chans.emplace_back(std::string(name) + "P99", (float)summary.p99);
+}
+
+int32_t
+CPUMemoryTOP::getNumInfoCHOPChans()
+{
+	// We return the number of channel we want to output to any Info CHOP
+	// connected to the TOP. The values are gathered here once per cook so
+	// every channel comes from the same moment.
+	myInfoChans.clear();
+
+	myInfoChans.emplace_back("executeCount", (float)myExecuteCount);
+	myInfoChans.emplace_back("framesReceived", (float)myFramesReceived);
+	myInfoChans.emplace_back("framesDroppedQueue", (float)myFramesDroppedQueue);
+	myInfoChans.emplace_back("framesDroppedStale", (float)myFramesDroppedStale);
+	myInfoChans.emplace_back("framesDroppedSlot", (float)myFramesDroppedSlot);
+	myInfoChans.emplace_back("framesDropped",
+		(float)(myFramesDroppedQueue + myFramesDroppedStale + myFramesDroppedSlot));
+	myInfoChans.emplace_back("framesPublished", (float)myFramesPublished);
+	myInfoChans.emplace_back("queueSize", (float)myFrameQueue.size());
+	myInfoChans.emplace_back("depthScale", (float)depth_scale);
+	myInfoChans.emplace_back("playbackFrame", (float)myPlaybackFrame);
+	myInfoChans.emplace_back("compactValidPoints", (float)myCompactValid);
+	myInfoChans.emplace_back("compactPoints", (float)myCompactKept);
+	myInfoChans.emplace_back("backgroundLearning", myBackgroundLearning ? 1.f : 0.f);
+	myInfoChans.emplace_back("backgroundFrames", (float)myBackgroundFramesLearned);
+
+	FrameRecorder::Stats record = myRecorder.stats();
+	myInfoChans.emplace_back("recording", myRecorder.recording() ? 1.f : 0.f);
+	myInfoChans.emplace_back("recordFramesWritten", (float)record.framesWritten);
+	myInfoChans.emplace_back("recordFramesDropped", (float)record.framesDropped);
+	myInfoChans.emplace_back("recordBytesWritten", (float)record.bytesWritten);
+	myInfoChans.emplace_back("recordBuffered", (float)record.buffered);
+	myInfoChans.emplace_back("recordHighWater", (float)record.highWater);
+	myInfoChans.emplace_back("recordCapacity", (float)record.capacity);
+
+	// All times in milliseconds.
+	appendStats(myInfoChans, "deviceLatency", myDeviceLatency);
+	appendStats(myInfoChans, "queueWait", myQueueWait);
+	appendStats(myInfoChans, "conversionTime", myConversionTime);
+	appendStats(myInfoChans, "filterTime", myFilterTime);
+	for (int i = 0; i < (int)DepthFilterChain::Stage::NumStages; i++)
+	{
+		DepthFilterChain::Stage stage = (DepthFilterChain::Stage)i;
+		std::string name = DepthFilterChain::stageName(stage);
+		name[0] = (char)toupper(name[0]);
+
+		RollingStats::Summary summary = myFilters.stageTime(stage);
+		myInfoChans.emplace_back("filter" + name + "TimeMean", (float)summary.mean);
+		myInfoChans.emplace_back("filter" + name + "TimeP99", (float)summary.p99);
+	}
+	appendStats(myInfoChans, "cookTime", myCookTime);
+
+	RollingStats::Summary interval = myPublishInterval.summary();
+	myInfoChans.emplace_back("effectiveFPS", interval.mean > 0. ? (float)(1000. / interval.mean) : 0.f);
+
+	return (int32_t)myInfoChans.size();
+}
+
+void
+CPUMemoryTOP::getInfoCHOPChan(int32_t index, OP_InfoCHOPChan* chan)
+{
+	// This function will be called once for each channel we said we'd want to return
+
+	if (index < 0 || index >= (int32_t)myInfoChans.size())
+		return;
+
+	chan->name = myInfoChans[index].first.c_str();
+	chan->value = myInfoChans[index].second;
+}
+
+bool		
+CPUMemoryTOP::getInfoDATSize(OP_InfoDATSize* infoSize)
+{
+	myInfoRows.clear();
+
+	myInfoRows.emplace_back("executeCount", std::to_string(myExecuteCount));
+	myInfoRows.emplace_back("depthKernel", DepthKernels::instructionSet());
+	myInfoRows.emplace_back("threads", std::to_string(myThreadCount));
+
+	{
+		std::lock_guard<std::mutex> lock(myDeviceMutex);
+
+		DeviceState state = (DeviceState)myDeviceState.load();
+		double inState = std::chrono::duration<double>(std::chrono::steady_clock::now() - myStateStart).count();
+
+		myInfoRows.emplace_back("deviceState", deviceStateName(state));
+		myInfoRows.emplace_back("deviceStateSeconds", std::to_string(inState));
+
+		// How long each state lasted the last time the device left it,
+		// e.g. lastOpeningSeconds is the time from request to first frame.
+		for (int i = 0; i < (int)DeviceState::NumStates; i++)
+		{
+			std::string name = deviceStateName((DeviceState)i);
+			name[0] = (char)toupper(name[0]);
+			myInfoRows.emplace_back("last" + name + "Seconds", std::to_string(myStateDurations[i]));
+		}
+
+		myInfoRows.emplace_back("deviceError", myDeviceError);
+	}
+
+	myInfoRows.emplace_back("recordFile", myRecorder.path());
+	myInfoRows.emplace_back("recordError", myRecorder.error());
+
+	infoSize->rows = (int32_t)myInfoRows.size();
+	infoSize->cols = 2;
+	// Setting this to false means we'll be assigning values to the table
+	// one row at a time. True means we'll do it one column at a time.
+	infoSize->byColumn = false;
+	return true;
+}
+
+void
+CPUMemoryTOP::getInfoDATEntries(int32_t index,
+								int32_t nEntries,
+								OP_InfoDATEntries* entries)
+{
+	if (index < 0 || index >= (int32_t)myInfoRows.size())
+		return;
+
+	// Touch makes its own copies of the strings immediately after this call
+	// returns, and myInfoRows isn't touched until the next getInfoDATSize().
+	entries->values[0] = (char*)myInfoRows[index].first.c_str();
+	entries->values[1] = (char*)myInfoRows[index].second.c_str();
+}
+
+void
+CPUMemoryTOP::setupParameters(OP_ParameterManager* manager)
+{
+
+	// Mode
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Image";
+		sp.label = "Image";
+
+		sp.defaultValue = "Depth";
+
+		const char *names[] = { "Depth", "Pointcloud", "Pointcloudpacked", "Raw", "Color",
+			"Coloraligned", "Depthaligned", "Irleft", "Irright", "Irstereo", "Pointcloudcompact",
+			"Normals", "Normalsfloat", "Foregroundmask", "Foregrounddepth" };
+		const char *labels[] = { "Depth", "Point Cloud", "Point Cloud (Packed Half)", "Raw Z16",
+			"Color", "Color Aligned to Depth", "Depth Aligned to Color", "Left IR", "Right IR",
+			"Stereo IR", "Point Cloud (Compact)", "Normals", "Normals (Float)",
+			"Foreground Mask", "Foreground Depth" };
+
+		OP_ParAppendResult res = manager->appendMenu(sp, 15, names, labels);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Flip
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Flip";
+		np.label = "Flip Vertically";
+
+		// TouchDesigner textures start at the bottom row. Turn this off to
+		// keep the camera's row order, e.g. when a shader flips anyway.
+		np.defaultValues[0] = 1;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Downsample
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Downsample";
+		sp.label = "Downsample";
+
+		// Each block of 2x2, 4x4 or 8x8 camera pixels becomes one output
+		// pixel, which also divides the conversion and upload.
+		sp.defaultValue = "X1";
+
+		const char *names[] = { "X1", "X2", "X4", "X8" };
+		const char *labels[] = { "1x", "2x", "4x", "8x" };
+
+		OP_ParAppendResult res = manager->appendMenu(sp, 4, names, labels);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Reduction
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Reduction";
+		sp.label = "Downsample Reduction";
+
+		// In the order of ConversionKernels::Reduction.
+		sp.defaultValue = "Median";
+
+		const char *names[] = { "Median", "Min" };
+		const char *labels[] = { "Median", "Nearest" };
+
+		OP_ParAppendResult res = manager->appendMenu(sp, 2, names, labels);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Compact max points
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Compactmax";
+		np.label = "Compact Max Points";
+
+		// 0 keeps every point with depth. Above that, points are dropped
+		// evenly across the frame down to this many, and the texture only
+		// has the rows they need.
+		np.defaultValues[0] = 0;
+		np.minSliders[0] = 0;
+		np.maxSliders[0] = 100000;
+		np.minValues[0] = 0;
+		np.clampMins[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Normal curvature
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Normalcurvature";
+		np.label = "Normal Curvature in Alpha";
+
+		// The angle between neighbouring normals in radians, 1 and above
+		// being 255 in the 8-bit mode.
+		np.defaultValues[0] = 0;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Normal edge ratio
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Normaledge";
+		np.label = "Normal Edge Ratio";
+
+		// A neighbour whose depth differs by more than this fraction of
+		// the pixel's depth is taken to be on another surface and left out
+		// of the normal.
+		np.defaultValues[0] = 0.05;
+		np.minSliders[0] = 0.0;
+		np.maxSliders[0] = 0.5;
+		np.minValues[0] = 0.0;
+		np.clampMins[0] = true;
+
+		OP_ParAppendResult res = manager->appendFloat(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Learn background
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Learnbackground";
+		np.label = "Learn Background";
+
+		// Learns from the next Background Frames frames, with the scene
+		// empty, for the foreground modes.
+		OP_ParAppendResult res = manager->appendPulse(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Background frames
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Backgroundframes";
+		np.label = "Background Frames";
+
+		np.defaultValues[0] = 30;
+		np.minSliders[0] = 1;
+		np.maxSliders[0] = 300;
+		np.minValues[0] = 1;
+		np.clampMins[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Background model
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Backgroundmodel";
+		sp.label = "Background Model";
+
+		// In the order of BackgroundModel::Statistic. Both are learned at
+		// once, so switching doesn't need learning again.
+		sp.defaultValue = "Meanvariance";
+
+		const char *names[] = { "Meanvariance", "Nearest" };
+		const char *labels[] = { "Mean and Variance", "Nearest" };
+
+		OP_ParAppendResult res = manager->appendMenu(sp, 2, names, labels);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Background deviations
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Backgrounddeviations";
+		np.label = "Background Deviations";
+
+		// Standard deviations nearer than the mean a pixel has to be to be
+		// foreground.
+		np.defaultValues[0] = 3.0;
+		np.minSliders[0] = 0.0;
+		np.maxSliders[0] = 10.0;
+		np.minValues[0] = 0.0;
+		np.clampMins[0] = true;
+
+		OP_ParAppendResult res = manager->appendFloat(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Background margin
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Backgroundmargin";
+		np.label = "Background Margin";
+
+		// Meters nearer than the background a pixel has to be at least,
+		// where the background barely varies.
+		np.defaultValues[0] = 0.05;
+		np.minSliders[0] = 0.0;
+		np.maxSliders[0] = 0.5;
+		np.minValues[0] = 0.0;
+		np.clampMins[0] = true;
+
+		OP_ParAppendResult res = manager->appendFloat(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Clip
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Clip";
+		np.label = "Clip";
+
+		np.defaultValues[0] = 0;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Clip range
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Cliprange";
+		np.label = "Clip Range";
+
+		// Near and far in meters. Depth outside becomes 0, like no depth.
+		for (int i = 0; i < 2; i++)
+		{
+			np.minSliders[i] = 0.0;
+			np.maxSliders[i] = 10.0;
+			np.minValues[i] = 0.0;
+			np.clampMins[i] = true;
+		}
+		np.defaultValues[0] = 0.1;
+		np.defaultValues[1] = 4.0;
+
+		OP_ParAppendResult res = manager->appendFloat(np, 2);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Filled in when the plugin was loaded and kept current since, so
+	// building the menus doesn't wait for USB.
+	std::vector<DeviceCache::Device> list = DeviceCache::instance().devices();
+
+	// Sensor
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Sensor";
+		sp.label = "Sensor";
+
+		sp.defaultValue = "";
+
+		std::vector<const char*> names;
+		std::vector<const char*> labels;
+
+		std::vector<std::string> names_strs;
+		std::vector<std::string> labels_strs;
+
+		for (const auto& dev : list) {
+			std::stringstream ss;
+			ss << SensorPrefix;
+			ss << dev.serial;
+			names_strs.push_back(ss.str());
+			labels_strs.push_back(ss.str());
+		}
+
+		// Plays back the File parameter instead of a camera. Also the
+		// default when no camera is attached.
+		names_strs.push_back(FileSensor);
+		labels_strs.push_back("File Playback");
+
+		// Convert to a vector of c-style strings
+		for (const auto& string : names_strs) names.push_back(string.c_str());
+		for (const auto& string : labels_strs) labels.push_back(string.c_str());
+
+		sp.defaultValue = names[0];
+
+		OP_ParAppendResult res = manager->appendMenu(sp, (int32_t)names.size(), names.data(), labels.data());
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Every Z16 depth resolution and frame rate the attached devices support
+	std::vector<std::pair<int, int>> resolutions;
+	std::vector<int> rates;
+	for (const auto& dev : list) {
+		for (const DeviceCache::DepthProfile& p : dev.depthProfiles) {
+			std::pair<int, int> resolution(p.width, p.height);
+			if (std::find(resolutions.begin(), resolutions.end(), resolution) == resolutions.end())
+				resolutions.push_back(resolution);
+			if (std::find(rates.begin(), rates.end(), p.fps) == rates.end())
+				rates.push_back(p.fps);
+		}
+	}
+	std::sort(resolutions.begin(), resolutions.end());
+	std::sort(rates.begin(), rates.end());
+
+	// Resolution
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Resolution";
+		sp.label = "Resolution";
+
+		std::vector<std::string> names_strs;
+		std::vector<std::string> labels_strs;
+
+		for (const auto& resolution : resolutions) {
+			std::stringstream name, label;
+			name << "R" << resolution.first << "x" << resolution.second;
+			label << resolution.first << " x " << resolution.second;
+			names_strs.push_back(name.str());
+			labels_strs.push_back(label.str());
+		}
+
+		std::stringstream defaultName;
+		defaultName << "R" << DefaultWidth << "x" << DefaultHeight;
+		if (std::find(names_strs.begin(), names_strs.end(), defaultName.str()) == names_strs.end()) {
+			names_strs.insert(names_strs.begin(), defaultName.str());
+			labels_strs.insert(labels_strs.begin(), defaultName.str().substr(1));
+		}
+		std::string defaultValue = defaultName.str();
+		sp.defaultValue = defaultValue.c_str();
+
+		std::vector<const char*> names;
+		std::vector<const char*> labels;
+		for (const auto& string : names_strs) names.push_back(string.c_str());
+		for (const auto& string : labels_strs) labels.push_back(string.c_str());
+
+		OP_ParAppendResult res = manager->appendMenu(sp, (int32_t)names.size(), names.data(), labels.data());
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// FPS
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Fps";
+		sp.label = "FPS";
+
+		if (std::find(rates.begin(), rates.end(), DefaultFPS) == rates.end())
+			rates.insert(rates.begin(), DefaultFPS);
+
+		std::vector<std::string> names_strs;
+		std::vector<std::string> labels_strs;
+
+		for (int rate : rates) {
+			names_strs.push_back("Fps" + std::to_string(rate));
+			labels_strs.push_back(std::to_string(rate));
+		}
+
+		std::string defaultValue = "Fps" + std::to_string(DefaultFPS);
+		sp.defaultValue = defaultValue.c_str();
+
+		std::vector<const char*> names;
+		std::vector<const char*> labels;
+		for (const auto& string : names_strs) names.push_back(string.c_str());
+		for (const auto& string : labels_strs) labels.push_back(string.c_str());
+
+		OP_ParAppendResult res = manager->appendMenu(sp, (int32_t)names.size(), names.data(), labels.data());
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// File
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "File";
+		sp.label = "Playback File";
+
+		sp.defaultValue = "";
+
+		OP_ParAppendResult res = manager->appendFile(sp);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Real time
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Realtime";
+		np.label = "Real Time";
+
+		// Off advances the file exactly one frame per cook, for offline
+		// renders that come out the same every time.
+		np.defaultValues[0] = 1;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Loop
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Loop";
+		np.label = "Loop";
+
+		np.defaultValues[0] = 1;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Speed
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Speed";
+		np.label = "Speed";
+
+		np.defaultValues[0] = 1.0;
+		np.minSliders[0] = 0.1;
+		np.maxSliders[0] = 4.0;
+		np.minValues[0] = 0.01;
+		np.maxValues[0] = 16.0;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendFloat(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Seek frame
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Seekframe";
+		np.label = "Seek Frame";
+
+		np.defaultValues[0] = 0;
+		np.minSliders[0] = 0;
+		np.maxSliders[0] = 1000;
+		np.minValues[0] = 0;
+		np.clampMins[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Seek
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Seek";
+		np.label = "Seek";
+
+		OP_ParAppendResult res = manager->appendPulse(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Record
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Record";
+		np.label = "Record";
+
+		// Each time this is turned on a new recording replaces Record File.
+		np.defaultValues[0] = 0;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Record file
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Recordfile";
+		sp.label = "Record File";
+
+		sp.defaultValue = "realsense.bag";
+
+		OP_ParAppendResult res = manager->appendFile(sp);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Queue policy
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Queuepolicy";
+		sp.label = "Queue Policy";
+
+		sp.defaultValue = "Latest";
+
+		const char *names[] = { "Latest", "Fifo" };
+		const char *labels[] = { "Always Latest", "FIFO" };
+
+		OP_ParAppendResult res = manager->appendMenu(sp, 2, names, labels);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Queue depth
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Queuedepth";
+		np.label = "Queue Depth";
+
+		np.defaultValues[0] = 2;
+		np.minSliders[0] = 1;
+		np.maxSliders[0] = (double)MaxQueueDepth;
+		np.minValues[0] = 1;
+		np.maxValues[0] = (double)MaxQueueDepth;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Threads
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Threads";
+		np.label = "Conversion Threads";
+
+		// Leave one physical core for TouchDesigner's main thread
+		int cores = WorkerPool::physicalCoreCount();
+		np.defaultValues[0] = std::max(cores - 1, 1);
+		np.minSliders[0] = 1;
+		np.maxSliders[0] = std::max(cores, 1);
+		np.minValues[0] = 1;
+		np.maxValues[0] = 64;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Decimate
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Decimate";
+		np.label = "Decimate";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 0;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Decimate Magnitude
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Decimatemag";
+		np.label = "Decimate Magnitude";
+		np.page = "Filters";
+
+		// Each magnitude x magnitude block becomes one pixel.
+		np.defaultValues[0] = 2;
+		np.minSliders[0] = 2;
+		np.maxSliders[0] = 8;
+		np.minValues[0] = 2;
+		np.maxValues[0] = 8;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Spatial Filter
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Spatial";
+		np.label = "Spatial Filter";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 0;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Spatial Magnitude
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Spatialmag";
+		np.label = "Spatial Magnitude";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 2;
+		np.minSliders[0] = 1;
+		np.maxSliders[0] = 5;
+		np.minValues[0] = 1;
+		np.maxValues[0] = 5;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Spatial Smooth Alpha
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Spatialalpha";
+		np.label = "Spatial Smooth Alpha";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 0.5;
+		np.minSliders[0] = 0.25;
+		np.maxSliders[0] = 1.0;
+		np.minValues[0] = 0.25;
+		np.maxValues[0] = 1.0;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendFloat(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Spatial Smooth Delta
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Spatialdelta";
+		np.label = "Spatial Smooth Delta";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 20;
+		np.minSliders[0] = 1;
+		np.maxSliders[0] = 50;
+		np.minValues[0] = 1;
+		np.maxValues[0] = 50;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Spatial Hole Fill
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Spatialholes";
+		np.label = "Spatial Hole Fill";
+		np.page = "Filters";
+
+		// Radius of holes the spatial filter fills, 0 is off and 5 unlimited.
+		np.defaultValues[0] = 0;
+		np.minSliders[0] = 0;
+		np.maxSliders[0] = 5;
+		np.minValues[0] = 0;
+		np.maxValues[0] = 5;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Temporal Filter
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Temporal";
+		np.label = "Temporal Filter";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 0;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Temporal Smooth Alpha
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Temporalalpha";
+		np.label = "Temporal Smooth Alpha";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 0.4;
+		np.minSliders[0] = 0.0;
+		np.maxSliders[0] = 1.0;
+		np.minValues[0] = 0.0;
+		np.maxValues[0] = 1.0;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendFloat(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Temporal Smooth Delta
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Temporaldelta";
+		np.label = "Temporal Smooth Delta";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 20;
+		np.minSliders[0] = 1;
+		np.maxSliders[0] = 100;
+		np.minValues[0] = 1;
+		np.maxValues[0] = 100;
+		np.clampMins[0] = true;
+		np.clampMaxes[0] = true;
+
+		OP_ParAppendResult res = manager->appendInt(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Temporal Persistence
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Temporalpersist";
+		sp.label = "Temporal Persistence";
+		sp.page = "Filters";
+
+		// A pixel without depth keeps its last depth if it had depth this often
+		// recently. In librealsense's order, so the index is its option value.
+		sp.defaultValue = "Valid2of4";
+
+		const char *names[] = { "Off", "Valid8of8", "Valid2of3", "Valid2of4", "Valid2of8", "Valid1of2", "Valid1of5", "Valid1of8", "Always" };
+		const char *labels[] = { "Off", "Valid in 8 of Last 8", "Valid in 2 of Last 3", "Valid in 2 of Last 4", "Valid in 2 of Last 8", "Valid in 1 of Last 2", "Valid in 1 of Last 5", "Valid in 1 of Last 8", "Always" };
+
+		OP_ParAppendResult res = manager->appendMenu(sp, 9, names, labels);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Hole Filling
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Holefill";
+		np.label = "Hole Filling";
+		np.page = "Filters";
+
+		np.defaultValues[0] = 0;
+
+		OP_ParAppendResult res = manager->appendToggle(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// Hole Filling Mode
+	{
+		OP_StringParameter	sp;
+
+		sp.name = "Holefillmode";
+		sp.label = "Hole Filling Mode";
+		sp.page = "Filters";
+
+		sp.defaultValue = "Farthest";
+
+		const char *names[] = { "Left", "Farthest", "Nearest" };
+		const char *labels[] = { "Fill From Left", "Farthest From Around", "Nearest From Around" };
+
+		OP_ParAppendResult res = manager->appendMenu(sp, 3, names, labels);
+		assert(res == OP_ParAppendResult::Success);
+	}
+
+	// pulse
+	/*
+	{
+		OP_NumericParameter	np;
+
+		np.name = "Reset";
+		np.label = "Reset";
+		
+		OP_ParAppendResult res = manager->appendPulse(np);
+		assert(res == OP_ParAppendResult::Success);
+	}
+	*/
+
+}
+
+void
+CPUMemoryTOP::pulsePressed(const char* name)
+{
+	if (!strcmp(name, "Reset"))
+	{
+
+	}
+
+	// Jumps to Seekframe, which execute() keeps up to date.
+	if (!strcmp(name, "Seek"))
+	{
+		mySeekRequested = true;
+	}
+
+	// The capture thread starts learning with its next frame.
+	if (!strcmp(name, "Learnbackground"))
+	{
+		myBackgroundRequest++;
 	}
 }
 
@@ -9,9 +9,198 @@
  */
 
 #include "TOP_CPlusPlusBase.h"
+#include "FrameQueue.h"
+#include "Deprojection.h"
+#include "ConversionKernels.h"
+#include "Alignment.h"
+#include "PointCompaction.h"
+#include "SurfaceNormals.h"
+#include "BackgroundModel.h"
+#include "DepthFilterChain.h"
+#include "WorkerPool.h"
+#include "Telemetry.h"
+#include "FrameRecorder.h"
+#include "DepthSequencePlayer.h"
+#include "DeviceSession.h"
+#include "DeviceCache.h"
 
 #include <librealsense2/rs.hpp> // Include RealSense Cross Platform API
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Index into the Image menu.
+enum class ImageMode : int32_t
+{
+	// R32Float depth in meters.
+	Depth = 0,
+
+	// RGBA32Float points in meters, alpha is always 1.
+	Pointcloud,
+
+	// Points packed as four half floats (x, y, z, valid) into RG32Float.
+	// Unpack in GLSL with unpackHalf2x16(floatBitsToUint(color.r)) for x/y
+	// and the same on color.g for z/valid.
+	PointcloudPacked,
+
+	// The camera's raw Z16 values as RG8Fixed, low byte in red and high
+	// byte in green. Multiply by the depthScale Info CHOP channel for meters.
+	Raw,
+
+	// The color camera's image as BGRA8Fixed, at its resolution.
+	Color,
+
+	// BGRA8Fixed at the depth stream's resolution, each pixel taking the
+	// color its point projects to in the color camera. Transparent black
+	// where there's no depth or the color camera doesn't see the point.
+	ColorAligned,
+
+	// R32Float depth in meters at the color stream's resolution, as the
+	// color camera would see it, 0 where no depth pixel lands.
+	DepthAligned,
+
+	// R8Fixed images of the left and right infrared imagers, at the depth
+	// stream's resolution.
+	InfraredLeft,
+	InfraredRight,
+
+	// Both infrared images as RG8Fixed, left in red and right in green.
+	InfraredStereo,
+
+	// RGBA32Float points like Pointcloud, but only those with depth, packed
+	// into the front of the texture in row order. Texels after the last
+	// point have alpha 0.
+	PointcloudCompact,
+
+	// Surface normals facing the camera, as BGRA8Fixed with each component
+	// mapped from [-1, 1] to [0, 255], or as RGBA32Float. Alpha is 1, or the
+	// curvature, where there's a normal, and the whole pixel is 0 where
+	// there isn't.
+	Normals,
+	NormalsFloat,
+
+	// Against a background learned with the Learn Background pulse, R8Fixed
+	// 1 where there's foreground and 0 elsewhere, or R32Float meters of only
+	// the foreground.
+	ForegroundMask,
+	ForegroundDepth,
+};
+
+// Lifecycle of the device, driven by the device thread.
+enum class DeviceState : int32_t
+{
+	// No device has been requested yet.
+	Idle = 0,
+
+	// Starting the pipeline and waiting for its first frame.
+	Opening,
+
+	// Frames are arriving.
+	Streaming,
+
+	// Opening failed or the stream stopped delivering frames. The device
+	// thread will retry after a short delay.
+	Error,
+
+	// Retrying the last request after an error.
+	Recovering,
+
+	NumStates,
+};
+
+// What the Sensor, Resolution and FPS parameters ask for.
+struct DeviceRequest
+{
+	std::string		sensorID;
+	int				width = 0;
+	int				height = 0;
+	int				fps = 0;
+
+	// Only used when sensorID is the File menu item. The recording decides
+	// the resolution and frame rate, so width, height and fps stay 0.
+	std::string		file;
+	bool			loop = true;
+
+	// Streams alongside depth, for the Image modes that use them.
+	bool			color = false;
+	bool			infraredLeft = false;
+	bool			infraredRight = false;
+
+	bool			operator==(const DeviceRequest& other) const
+					{
+						return sensorID == other.sensorID && width == other.width &&
+							height == other.height && fps == other.fps &&
+							file == other.file && loop == other.loop &&
+							color == other.color && infraredLeft == other.infraredLeft &&
+							infraredRight == other.infraredRight;
+					}
+	bool			operator!=(const DeviceRequest& other) const { return !(*this == other); }
+};
+
+// The frames of one frameset the capture thread converts from. Streams
+// that aren't running are left empty.
+struct CapturedFrames
+{
+	rs2::frame		depth;
+	rs2::frame		color;
+	// Left and right imager.
+	rs2::frame		infrared[2];
+};
+
+// A frame waiting in the queue between the librealsense callback and the
+// capture thread.
+struct QueuedFrame
+{
+	rs2::frame		frame;
+	// monotonicNanoseconds() when the callback queued it.
+	int64_t			queuedAt = 0;
+};
+
+// How the capture thread consumes the frames queued by librealsense.
+enum class QueuePolicy : int32_t
+{
+	// Skip to the newest queued frame and overwrite a converted frame that
+	// hasn't been uploaded yet. Lowest latency.
+	Latest = 0,
+
+	// Convert every queued frame in order, waiting for a free output slot.
+	// Frames are only dropped when more than 'Queuedepth' are waiting.
+	Fifo,
+};
+
+// Who owns one of the three cpuPixelData locations TouchDesigner gives us.
+enum class SlotState : int32_t
+{
+	// Ours, nothing unpublished in it.
+	Free = 0,
+
+	// The capture thread is converting a frame into it.
+	Writing,
+
+	// Holds a converted frame waiting for execute() to publish it.
+	Ready,
+
+	// TouchDesigner's: it's uploading what we published last cook, or we
+	// haven't been given memory for the current format yet. execute()
+	// takes the location back with the pointer of the next cook.
+	Uploading,
+};
+
+struct OutputSlot
+{
+	void*		data = nullptr;
+	SlotState	state = SlotState::Uploading;
+	// Orders the Ready slots by when their frames were converted.
+	int64_t		sequence = 0;
+};
+
 class CPUMemoryTOP : public TOP_CPlusPlusBase
 {
 public:
@@ -39,10 +228,83 @@ public:
 	virtual void		setupParameters(OP_ParameterManager *manager) override;
 	virtual void		pulsePressed(const char *name) override;
 
-	virtual void CPUMemoryTOP::setupDevice(const char* sensorID);
+	virtual const char*	getWarningString() override;
+
+	// The librealsense context every instance opens devices through, owned
+	// by DeviceCache. Devices added to it, like the benchmark's software
+	// device, show up in the Sensor menu.
+	static rs2::context&	deviceContext();
 
 private:
 
+	// The device thread opens, closes and reopens the device so that none
+	// of that blocks execute(). execute() only posts requests to it.
+	void				postDeviceRequest(const DeviceRequest& request);
+	void				deviceLoop();
+
+	// Starts streaming depth from the sensor with the given menu name, using
+	// the Z16 profile closest to the requested resolution and frame rate.
+	// Only called on the device thread.
+	void				openDevice(const DeviceRequest& request, DeviceState state);
+	// Plays an .rvl depth sequence through myPlayer. Throws on failure.
+	void				openSequence(const DeviceRequest& request);
+	void				closeDevice();
+	void				failDevice(const std::string& message);
+
+	// Records how long the previous state lasted.
+	void				setDeviceState(DeviceState state, const std::string& message = std::string());
+
+	// Applies the Realtime, Speed and Seek parameters to the playback
+	// device or player. Only called on the device thread.
+	void				applyPlayback();
+	// Starts or stops the recorder for the Record parameter. Only called on
+	// the device thread.
+	void				applyRecording();
+
+	// Opens or closes the gate that holds non-real-time playback to one
+	// frame per cook.
+	void				setStepping(bool stepping);
+
+	// The capture thread receives frames from the pipeline and converts
+	// them directly into one of the cpuPixelData blocks that TouchDesigner
+	// handed us in the previous execute() call.
+	void				startCapture();
+	void				stopCapture();
+	void				captureLoop();
+
+	// Called on a librealsense thread for every frame the pipeline delivers.
+	void				onFrame(rs2::frame frame);
+
+	// Blocks the librealsense callback until execute() grants the next
+	// playback step for the frame with this playback index. Returns false
+	// if the frame should be dropped because a seek hasn't reached its
+	// target yet.
+	bool				waitForStep(int64_t index);
+
+	// Waits briefly for the next frame from myFrameQueue, applying the
+	// current QueuePolicy. Returns false if nothing arrived.
+	bool				nextFrame(QueuedFrame& frame);
+
+	// Converts the frames for 'mode' into an output 'downsample' times
+	// smaller on each side. Only the depth modes downsample. 'maxPoints' is
+	// the Compact Max Points parameter.
+	void				convertFrame(const CapturedFrames& frames, void* dst,
+									int downsample, ConversionKernels::Reduction reduction,
+									int mode, bool flip, bool clip, float clipNear, float clipFar,
+									int maxPoints);
+	// The part of convertFrame() for the color modes, with the clip range
+	// already in depth units.
+	void				convertColorFrame(const CapturedFrames& frames, void* dst, int mode,
+										 bool flip, uint16_t clipNear, uint16_t clipFar);
+
+	// Must be called with mySlotMutex held. Waits for an in-flight
+	// conversion to finish and forgets every slot pointer we were given.
+	void				invalidateSlots(std::unique_lock<std::mutex>& lock);
+
+	// Must be called with mySlotMutex held. The first slot in 'state', or
+	// for Ready the one with the oldest or newest frame. -1 if there is none.
+	int					findSlot(SlotState state, bool newest = false) const;
+
     // We don't need to store this pointer, but we do for the example.
     // The OP_NodeInfo class store information about the node that's using
     // this instance of the class (like its name).
@@ -52,13 +314,209 @@ private:
     // function is called, then passes back to the TOP 
     int						 myExecuteCount;
 
+	// Only used for .bag playback. Cameras are streamed through mySession,
+	// which other TOPs on the same camera share.
 	rs2::pipeline pipe;
-	float depth_scale;
+	// Whether pipe has been started and needs to be stopped.
+	bool pipeStarted;
+	std::shared_ptr<DeviceSession>	mySession;
+	int								mySubscription;
+	std::atomic<float> depth_scale;
+
+	// Only touched by the capture thread.
+	DeprojectionTable myDeprojection;
+	AlignmentTable myAlignment;
+	PointCompactor myCompactor;
+	NormalEstimator myNormals;
+	BackgroundModel myBackground;
+	// The myBackgroundRequest the model was last learned for.
+	int32_t myBackgroundRequestHandled;
+	// Color frames in formats other than BGRA8, converted for alignment.
+	std::vector<uint8_t> myColorScratch;
+	WorkerPool myWorkers;
+
+	// The conversion for the current settings, looked up again when they
+	// change. Only touched by the capture thread.
+	ConversionKernels::ConvertFunc	myConvert;
+	int								myConvertMode;
+	bool							myConvertFlip;
+	bool							myConvertClip;
+	bool							myConvertBlocks;
+	ConversionKernels::Reduction	myConvertReduction;
 
-	rs2::pointcloud pc;
-	rs2::points points;
+	// Threads parameter, applied to myWorkers by the capture thread.
+	std::atomic<int32_t>	myThreadCount;
 	int image_mode;
 
-	//const char* mySensorID = "";
-	std::string mySensorID;
+	std::thread				myCaptureThread;
+	std::atomic<bool>		myCaptureRunning;
+
+	// Frames handed over from the librealsense callback. The mutex and
+	// condition are only used to put the capture thread to sleep while the
+	// queue is empty; pushing and popping never take a lock.
+	FrameQueue<QueuedFrame>	myFrameQueue;
+	std::mutex				myFrameMutex;
+	std::condition_variable	myFrameCondition;
+
+	std::atomic<int32_t>	myQueuePolicy;
+
+	// Flip parameter. Rows are written bottom-up when set.
+	std::atomic<bool>		myFlip;
+	// Downsample parameter as a factor, and the Reduction menu index.
+	std::atomic<int32_t>	myDownsample;
+	std::atomic<int32_t>	myReduction;
+	// Compact Max Points parameter, 0 for all of them.
+	std::atomic<int32_t>	myCompactMax;
+	// Normal Curvature and Normal Edge Ratio parameters.
+	std::atomic<bool>		myNormalCurvature;
+	std::atomic<float>		myNormalEdge;
+	// Bumped by the Learn Background pulse, the capture thread starts
+	// learning when it sees a new value.
+	std::atomic<int32_t>	myBackgroundRequest;
+	// Background Frames, and the Background Model menu index, Deviations
+	// and Margin.
+	std::atomic<int32_t>	myBackgroundFrames;
+	std::atomic<int32_t>	myBackgroundStatistic;
+	std::atomic<float>		myBackgroundDeviations;
+	std::atomic<float>		myBackgroundMargin;
+	// The Clip parameters and the Filters page, copied in by execute() and
+	// applied to myFilters by the capture thread.
+	std::mutex					myFilterMutex;
+	DepthFilterChain::Settings	myFilterSettings;
+	// Only touched by the capture thread.
+	DepthFilterChain			myFilters;
+
+	std::atomic<int64_t>	myFramesReceived;
+	// Rejected by the callback because the queue was full.
+	std::atomic<int64_t>	myFramesDroppedQueue;
+	// Skipped by the Latest policy because a newer frame was queued.
+	std::atomic<int64_t>	myFramesDroppedStale;
+	// Converted frames replaced before execute() could publish them.
+	std::atomic<int64_t>	myFramesDroppedSlot;
+	// Points with depth in the last compacted frame, and how many of them
+	// made it into the output.
+	std::atomic<int32_t>	myCompactValid;
+	std::atomic<int32_t>	myCompactKept;
+	// Whether the background is being learned, and from how many frames so
+	// far or in total.
+	std::atomic<bool>		myBackgroundLearning;
+	std::atomic<int32_t>	myBackgroundFramesLearned;
+	// Frames execute() handed to TouchDesigner for upload.
+	int64_t					myFramesPublished;
+	int64_t					myLastPublishTime;
+
+	// Rolling windows for the Info CHOP, all in milliseconds.
+	// Frame timestamp to arrival on the host. Only measured when the
+	// timestamps are in the host's time domain.
+	RollingStats			myDeviceLatency;
+	// Queued by the callback to picked up by the capture thread.
+	RollingStats			myQueueWait;
+	RollingStats			myConversionTime;
+	// The whole filter chain, per filter times are kept by myFilters.
+	RollingStats			myFilterTime;
+	RollingStats			myCookTime;
+	// Between frames published by execute(), for the effective FPS.
+	RollingStats			myPublishInterval;
+
+	// Channels of the Info CHOP, gathered in getNumInfoCHOPChans().
+	std::vector<std::pair<std::string, float>>	myInfoChans;
+
+	// Everything below is shared between execute() and the capture thread
+	// and is guarded by mySlotMutex.
+	std::mutex				mySlotMutex;
+	std::condition_variable	mySlotCondition;
+
+	static const int		NumSlots = 3;
+	OutputSlot				mySlots[NumSlots];
+	int64_t					myReadySequence;
+
+	// Incremented whenever the slot pointers stop being usable, so a
+	// conversion that started against stale pointers is never published.
+	int						mySlotGeneration;
+	int						mySlotWidth;
+	int						mySlotHeight;
+	int						mySlotMode;
+
+	// Record File parameter, read when a recording starts.
+	std::string				myRecordPath;
+
+	// The last request execute() posted. Only used on the cook thread.
+	DeviceRequest			myRequest;
+
+	// Size of the frames that are actually arriving, divided by the
+	// Downsample factor they were converted with. The output texture
+	// follows these, so it only changes once a new profile delivers its
+	// first frame and the last good texture is kept until then.
+	std::atomic<int32_t>	myStreamWidth;
+	std::atomic<int32_t>	myStreamHeight;
+	std::atomic<int32_t>	myStreamFPS;
+
+	std::thread				myDeviceThread;
+	std::atomic<bool>		myDeviceRunning;
+
+	// Guards everything below it up to myDeviceState.
+	std::mutex				myDeviceMutex;
+	std::condition_variable	myDeviceCondition;
+	DeviceRequest			myPendingRequest;
+	bool					myHasPendingRequest;
+	// The request the device thread is serving, retried after errors.
+	DeviceRequest			myActiveRequest;
+	std::string				myDeviceWarning;
+	std::string				myDeviceError;
+	std::chrono::steady_clock::time_point	myStateStart;
+	// How long each state lasted the last time it was left, in seconds.
+	double					myStateDurations[(int)DeviceState::NumStates];
+
+	// Readable without the lock, e.g. from the capture thread per frame.
+	std::atomic<int32_t>	myDeviceState;
+	std::atomic<int64_t>	myLastFrameTime;
+
+	// File playback. The device and player are only touched by the device
+	// thread, the parameters are copied into the atomics by execute().
+	// .rvl files go through myPlayer instead of the pipeline.
+	rs2::device				myPlaybackDevice;
+	DepthSequencePlayer		myPlayer;
+	std::atomic<bool>		myPlaybackRealtime;
+	std::atomic<float>		myPlaybackSpeed;
+	std::atomic<int32_t>	mySeekFrame;
+	// Set by the Seek pulse, cleared by the device thread.
+	std::atomic<bool>		mySeekRequested;
+	bool					myAppliedRealtime;
+	float					myAppliedSpeed;
+	std::atomic<int32_t>	myPlaybackStatus;
+	// Index of the last frame played back, from its timestamp relative to
+	// the first frame of the file. -1 when not playing a file.
+	std::atomic<int64_t>	myPlaybackFrame;
+	// Only touched by the librealsense callback.
+	double					myPlaybackStart;
+
+	// In non-real-time playback the librealsense callback waits for
+	// execute() to grant each step, so every cook advances exactly one
+	// frame. Guarded by myStepMutex.
+	std::mutex				myStepMutex;
+	std::condition_variable	myStepCondition;
+	std::atomic<bool>		myStepping;
+	int64_t					myStepsGranted;
+	int64_t					myStepsTaken;
+	// Frame a seek is waiting for, or -1. Frames are dropped until the
+	// target arrives, or a later frame right after an earlier one in case
+	// the recording skipped the target.
+	int64_t					myStepSeekTarget;
+	bool					myStepSeekBelow;
+
+	// Writes the incoming stream to a .bag file while Record is on. The
+	// device thread starts and stops it, so waiting for the last recording
+	// to finish never holds up the librealsense callback, which only copies
+	// each frame in and moves on.
+	FrameRecorder			myRecorder;
+	// Record parameter, and a new recording asked for by turning it on.
+	std::atomic<bool>		myRecordWanted;
+	std::atomic<bool>		myRecordStart;
+
+	// Copied from myDeviceWarning/myDeviceError for getWarningString(),
+	// which has to return a pointer that stays valid after it returns.
+	std::string				myWarning;
+
+	// Rows of the Info DAT, gathered in getInfoDATSize().
+	std::vector<std::pair<std::string, std::string>>	myInfoRows;
 };
@@ -0,0 +1,593 @@
+#include "ConversionKernels.h"
+#include "DepthKernels.h"
+#include "SimdDetect.h"
+
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+using ConversionKernels::Frame;
+using ConversionKernels::Output;
+using ConversionKernels::Reduction;
+
+// Pixels filtered or reduced at a time, small enough to stay in L1 between
+// that and the conversion.
+const int FilterChunk = 512;
+
+// Largest block a frame can be downsampled by.
+const int MaxDownsample = 8;
+
+// Zeroes depth outside [nearest, farthest], without branches.
+inline void
+clipRun(const uint16_t* src, uint16_t* dst, int count, uint16_t nearest, uint16_t farthest)
+{
+	int x = 0;
+#if defined(SIMD_SSE2)
+	// SSE2 only compares signed 16-bit values. A saturating subtraction is
+	// zero exactly when the unsigned one doesn't underflow.
+	const __m128i lo = _mm_set1_epi16((short)nearest);
+	const __m128i hi = _mm_set1_epi16((short)farthest);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i outside = _mm_or_si128(_mm_subs_epu16(lo, v), _mm_subs_epu16(v, hi));
+		__m128i keep = _mm_cmpeq_epi16(outside, zero);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_and_si128(v, keep));
+	}
+#elif defined(SIMD_NEON)
+	const uint16x8_t lo = vdupq_n_u16(nearest);
+	const uint16x8_t hi = vdupq_n_u16(farthest);
+	for (; x + 8 <= count; x += 8)
+	{
+		uint16x8_t v = vld1q_u16(src + x);
+		uint16x8_t keep = vandq_u16(vcgeq_u16(v, lo), vcleq_u16(v, hi));
+		vst1q_u16(dst + x, vandq_u16(v, keep));
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		uint16_t v = src[x];
+		uint16_t keep = (uint16_t)-(int)((v >= nearest) & (v <= farthest));
+		dst[x] = v & keep;
+	}
+}
+
+// Converts 'count' pixels starting at column 'x' of ray row 'row' into
+// output row 'y'. The 'if's only depend on the template argument and are
+// resolved at compile time.
+template <Output O>
+inline void
+convertRun(const Frame& f, const uint16_t* src, int row, int y, int x, int count)
+{
+	size_t offset = (size_t)y * f.outputWidth() + x;
+
+	if (O == Output::Depth)
+	{
+		DepthKernels::scaleRow(src, (float*)f.dst + offset, count, f.scale);
+	}
+	else if (O == Output::Points)
+	{
+		DepthKernels::deprojectRow(src, f.rays->rayX(row) + x, f.rays->rayY(row) + x,
+			(float*)f.dst + 4 * offset, count, f.scale);
+	}
+	else if (O == Output::PointsHalf)
+	{
+		DepthKernels::deprojectHalfRow(src, f.rays->rayX(row) + x, f.rays->rayY(row) + x,
+			(uint16_t*)f.dst + 4 * offset, count, f.scale);
+	}
+	else if (O == Output::Raw)
+	{
+		memcpy((uint16_t*)f.dst + offset, src, count * sizeof(uint16_t));
+	}
+}
+
+template <Output O, bool Flip, bool Clip>
+void
+convertRows(const Frame& f, int begin, int end)
+{
+	// Unfiltered rows go through in one piece.
+	const int step = Clip ? FilterChunk : f.width;
+	uint16_t filtered[Clip ? FilterChunk : 1];
+
+	for (int y = begin; y < end; ++y)
+	{
+		int row = Flip ? f.height - 1 - y : y;
+		const uint16_t* src = f.src + (size_t)row * f.width;
+
+		for (int x = 0; x < f.width; x += step)
+		{
+			int count = std::min(step, f.width - x);
+			const uint16_t* in = src + x;
+			if (Clip)
+			{
+				clipRun(in, filtered, count, f.clipNear, f.clipFar);
+				in = filtered;
+			}
+			convertRun<O>(f, in, row, y, x, count);
+		}
+	}
+}
+
+// Blocks are reduced on keys, depth - 1 with 16-bit wraparound, so no
+// depth and depth outside the clip range become the largest key and sort
+// behind every valid depth. Adding 1 back turns a block without valid depth
+// into 0 on its own.
+template <bool Clip>
+inline uint16_t
+depthKey(const Frame& f, uint16_t v)
+{
+	if (Clip)
+		v = (v >= f.clipNear && v <= f.clipFar) ? v : 0;
+	return (uint16_t)(v - 1);
+}
+
+// dst[x] = the key of src[x].
+template <bool Clip>
+inline void
+keyRun(const Frame& f, const uint16_t* src, int count, uint16_t* dst)
+{
+	int x = 0;
+#if defined(SIMD_SSE2)
+	const __m128i lo = _mm_set1_epi16((short)f.clipNear);
+	const __m128i hi = _mm_set1_epi16((short)f.clipFar);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+		if (Clip)
+		{
+			__m128i outside = _mm_or_si128(_mm_subs_epu16(lo, v), _mm_subs_epu16(v, hi));
+			v = _mm_and_si128(v, _mm_cmpeq_epi16(outside, zero));
+		}
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_sub_epi16(v, one));
+	}
+#elif defined(SIMD_NEON)
+	const uint16x8_t lo = vdupq_n_u16(f.clipNear);
+	const uint16x8_t hi = vdupq_n_u16(f.clipFar);
+	const uint16x8_t one = vdupq_n_u16(1);
+	for (; x + 8 <= count; x += 8)
+	{
+		uint16x8_t v = vld1q_u16(src + x);
+		if (Clip)
+			v = vandq_u16(v, vandq_u16(vcgeq_u16(v, lo), vcleq_u16(v, hi)));
+		vst1q_u16(dst + x, vsubq_u16(v, one));
+	}
+#endif
+	for (; x < count; ++x)
+		dst[x] = depthKey<Clip>(f, src[x]);
+}
+
+// dst[x] = the smallest key in column x of 'rows' camera rows starting at
+// 'src', for 'count' columns.
+template <bool Clip>
+inline void
+minKeyRows(const Frame& f, const uint16_t* src, int rows, int count, uint16_t* dst)
+{
+	int x = 0;
+#if defined(SIMD_SSE2)
+	const __m128i lo = _mm_set1_epi16((short)f.clipNear);
+	const __m128i hi = _mm_set1_epi16((short)f.clipFar);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i nearest = _mm_set1_epi16(-1);
+		for (int r = 0; r < rows; ++r)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(src + (size_t)r * f.width + x));
+			if (Clip)
+			{
+				__m128i outside = _mm_or_si128(_mm_subs_epu16(lo, v), _mm_subs_epu16(v, hi));
+				v = _mm_and_si128(v, _mm_cmpeq_epi16(outside, zero));
+			}
+			__m128i key = _mm_sub_epi16(v, one);
+			// SSE2 has no unsigned 16-bit minimum. a - max(a - b, 0) is one.
+			nearest = _mm_sub_epi16(nearest, _mm_subs_epu16(nearest, key));
+		}
+		_mm_storeu_si128((__m128i*)(dst + x), nearest);
+	}
+#elif defined(SIMD_NEON)
+	const uint16x8_t lo = vdupq_n_u16(f.clipNear);
+	const uint16x8_t hi = vdupq_n_u16(f.clipFar);
+	const uint16x8_t one = vdupq_n_u16(1);
+	for (; x + 8 <= count; x += 8)
+	{
+		uint16x8_t nearest = vdupq_n_u16(0xFFFF);
+		for (int r = 0; r < rows; ++r)
+		{
+			uint16x8_t v = vld1q_u16(src + (size_t)r * f.width + x);
+			if (Clip)
+				v = vandq_u16(v, vandq_u16(vcgeq_u16(v, lo), vcleq_u16(v, hi)));
+			nearest = vminq_u16(nearest, vsubq_u16(v, one));
+		}
+		vst1q_u16(dst + x, nearest);
+	}
+#endif
+	for (; x < count; ++x)
+	{
+		uint16_t nearest = 0xFFFF;
+		for (int r = 0; r < rows; ++r)
+			nearest = std::min(nearest, depthKey<Clip>(f, src[(size_t)r * f.width + x]));
+		dst[x] = nearest;
+	}
+}
+
+// Lanes sorted side by side by the median reduction, one output pixel each.
+const int SortLanes = 8;
+
+// Orders a[i] <= b[i] in every lane.
+inline void
+compareSwap(uint16_t* a, uint16_t* b)
+{
+#if defined(SIMD_SSE2)
+	__m128i x = _mm_load_si128((const __m128i*)a);
+	__m128i y = _mm_load_si128((const __m128i*)b);
+	// max(x - y, 0) takes x down to the minimum and y up to the maximum.
+	__m128i d = _mm_subs_epu16(x, y);
+	_mm_store_si128((__m128i*)a, _mm_sub_epi16(x, d));
+	_mm_store_si128((__m128i*)b, _mm_add_epi16(y, d));
+#elif defined(SIMD_NEON)
+	uint16x8_t x = vld1q_u16(a);
+	uint16x8_t y = vld1q_u16(b);
+	vst1q_u16(a, vminq_u16(x, y));
+	vst1q_u16(b, vmaxq_u16(x, y));
+#else
+	for (int i = 0; i < SortLanes; ++i)
+	{
+		uint16_t x = a[i];
+		uint16_t y = b[i];
+		a[i] = std::min(x, y);
+		b[i] = std::max(x, y);
+	}
+#endif
+}
+
+// Batcher's odd-even merge sort for a power of two number of values, as
+// the pairs to compare and swap in order. Sorting networks don't branch on
+// the data, so every lane can be sorted at once.
+class SortNetwork
+{
+public:
+	explicit SortNetwork(int size)
+	{
+		for (int p = 1; p < size; p <<= 1)
+		{
+			for (int k = p; k >= 1; k >>= 1)
+			{
+				for (int j = k % p; j + k < size; j += 2 * k)
+				{
+					for (int i = 0; i < k && i + j + k < size; ++i)
+					{
+						if ((i + j) / (2 * p) == (i + j + k) / (2 * p))
+							myPairs.push_back(std::make_pair(i + j, i + j + k));
+					}
+				}
+			}
+		}
+	}
+
+	void	sort(uint16_t (*values)[SortLanes]) const
+	{
+		for (const std::pair<int, int>& pair : myPairs)
+			compareSwap(values[pair.first], values[pair.second]);
+	}
+
+	// For blocks of n x n.
+	static const SortNetwork&	forBlock(int n)
+	{
+		static const SortNetwork networks[] = {
+			SortNetwork(1), SortNetwork(4), SortNetwork(16), SortNetwork(64),
+		};
+		return networks[n >= 8 ? 3 : n >= 4 ? 2 : n >= 2 ? 1 : 0];
+	}
+
+private:
+	std::vector<std::pair<int, int>>	myPairs;
+};
+
+// Takes the lower median of the valid depths in each N x N block starting
+// at 'src', for 'count' blocks. Sorts the keys of SortLanes blocks side by
+// side, the valid ones end up in front.
+template <bool Clip, int N>
+inline void
+medianRun(const Frame& f, const uint16_t* src, int count, uint16_t* dst)
+{
+	const SortNetwork& network = SortNetwork::forBlock(N);
+	alignas(16) uint16_t keys[N * N][SortLanes];
+	uint16_t row[N * SortLanes];
+
+	for (int i = 0; i < count; i += SortLanes)
+	{
+		int lanes = std::min(SortLanes, count - i);
+		if (lanes < SortLanes)
+		{
+			for (int j = 0; j < N * N; ++j)
+				std::fill(keys[j], keys[j] + SortLanes, (uint16_t)0xFFFF);
+		}
+
+		const uint16_t* block = src + (size_t)i * N;
+		for (int r = 0; r < N; ++r, block += f.width)
+		{
+			keyRun<Clip>(f, block, lanes * N, row);
+			for (int lane = 0; lane < lanes; ++lane)
+			{
+				for (int k = 0; k < N; ++k)
+					keys[r * N + k][lane] = row[lane * N + k];
+			}
+		}
+
+		network.sort(keys);
+
+		int valid[SortLanes];
+		for (int lane = 0; lane < SortLanes; ++lane)
+			valid[lane] = N * N;
+		for (int j = 0; j < N * N; ++j)
+		{
+			for (int lane = 0; lane < SortLanes; ++lane)
+				valid[lane] -= keys[j][lane] == 0xFFFF;
+		}
+
+		for (int lane = 0; lane < lanes; ++lane)
+			dst[i + lane] = valid[lane] ? (uint16_t)(keys[(valid[lane] - 1) / 2][lane] + 1) : 0;
+	}
+}
+
+// Reduces the blocks of block row 'b' that become output columns
+// [x, x + count) into 'dst'.
+template <bool Clip, Reduction R>
+inline void
+reduceRun(const Frame& f, int b, int x, int count, uint16_t* dst)
+{
+	const int n = f.downsample;
+	const uint16_t* src = f.src + (size_t)b * n * f.width + (size_t)x * n;
+
+	if (R == Reduction::Min)
+	{
+		// The columns first, down all rows of the blocks at once, then
+		// across each block.
+		uint16_t columns[FilterChunk * MaxDownsample];
+		minKeyRows<Clip>(f, src, n, count * n, columns);
+		for (int i = 0; i < count; ++i)
+		{
+			const uint16_t* block = columns + i * n;
+			uint16_t nearest = block[0];
+			for (int k = 1; k < n; ++k)
+				nearest = std::min(nearest, block[k]);
+			dst[i] = (uint16_t)(nearest + 1);
+		}
+	}
+	else if (R == Reduction::Median)
+	{
+		switch (n)
+		{
+		case 2:		medianRun<Clip, 2>(f, src, count, dst); break;
+		case 4:		medianRun<Clip, 4>(f, src, count, dst); break;
+		case 8:		medianRun<Clip, 8>(f, src, count, dst); break;
+		default:	std::fill(dst, dst + count, (uint16_t)0); break;
+		}
+	}
+}
+
+// Downsampled conversion. Every output row reduces one row of blocks into a
+// small buffer that goes straight on to the row kernel.
+template <Output O, bool Flip, bool Clip, Reduction R>
+void
+convertBlocks(const Frame& f, int begin, int end)
+{
+	const int width = f.outputWidth();
+	const int height = f.outputHeight();
+	uint16_t reduced[FilterChunk];
+
+	for (int y = begin; y < end; ++y)
+	{
+		int b = Flip ? height - 1 - y : y;
+		for (int x = 0; x < width; x += FilterChunk)
+		{
+			int count = std::min(FilterChunk, width - x);
+			reduceRun<Clip, R>(f, b, x, count, reduced);
+			convertRun<O>(f, reduced, b, y, x, count);
+		}
+	}
+}
+
+template <Output O>
+struct Table
+{
+	static const ConversionKernels::ConvertFunc	functions[2][2];
+	static const ConversionKernels::ConvertFunc	blockFunctions[2][2][(int)Reduction::Count];
+};
+
+template <Output O>
+const ConversionKernels::ConvertFunc Table<O>::functions[2][2] = {
+	{ convertRows<O, false, false>, convertRows<O, false, true> },
+	{ convertRows<O, true, false>, convertRows<O, true, true> },
+};
+
+template <Output O>
+const ConversionKernels::ConvertFunc Table<O>::blockFunctions[2][2][(int)Reduction::Count] = {
+	{
+		{ convertBlocks<O, false, false, Reduction::Median>, convertBlocks<O, false, false, Reduction::Min> },
+		{ convertBlocks<O, false, true, Reduction::Median>, convertBlocks<O, false, true, Reduction::Min> },
+	},
+	{
+		{ convertBlocks<O, true, false, Reduction::Median>, convertBlocks<O, true, false, Reduction::Min> },
+		{ convertBlocks<O, true, true, Reduction::Median>, convertBlocks<O, true, true, Reduction::Min> },
+	},
+};
+
+template <Output O>
+ConversionKernels::ConvertFunc
+lookup(bool flip, bool clip, bool downsample, Reduction reduction)
+{
+	if (!downsample)
+		return Table<O>::functions[flip][clip];
+	if ((int)reduction < 0 || reduction >= Reduction::Count)
+		return nullptr;
+	return Table<O>::blockFunctions[flip][clip][(int)reduction];
+}
+
+}
+
+namespace ConversionKernels
+{
+
+ConvertFunc
+select(Output output, bool flip, bool clip, bool downsample, Reduction reduction)
+{
+	switch (output)
+	{
+	case Output::Depth:			return lookup<Output::Depth>(flip, clip, downsample, reduction);
+	case Output::Points:		return lookup<Output::Points>(flip, clip, downsample, reduction);
+	case Output::PointsHalf:	return lookup<Output::PointsHalf>(flip, clip, downsample, reduction);
+	case Output::Raw:			return lookup<Output::Raw>(flip, clip, downsample, reduction);
+	default:					return nullptr;
+	}
+}
+
+void
+convertGeneric(const Frame& f, Output output, bool flip, bool clip, Reduction reduction,
+			   int begin, int end)
+{
+	const int n = f.downsample;
+	const int width = f.outputWidth();
+	const int height = f.outputHeight();
+	std::vector<uint16_t> values;
+
+	for (int y = begin; y < end; ++y)
+	{
+		int row = flip ? height - 1 - y : y;
+		for (int x = 0; x < width; ++x)
+		{
+			uint16_t v = 0;
+			if (n == 1)
+			{
+				v = f.src[(size_t)row * f.width + x];
+				if (clip && (v < f.clipNear || v > f.clipFar))
+					v = 0;
+			}
+			else
+			{
+				values.clear();
+				for (int r = 0; r < n; ++r)
+				{
+					for (int k = 0; k < n; ++k)
+					{
+						uint16_t d = f.src[(size_t)(row * n + r) * f.width + x * n + k];
+						if (d == 0 || (clip && (d < f.clipNear || d > f.clipFar)))
+							continue;
+						values.push_back(d);
+					}
+				}
+				if (!values.empty())
+				{
+					std::sort(values.begin(), values.end());
+					v = reduction == Reduction::Min ? values.front() : values[(values.size() - 1) / 2];
+				}
+			}
+
+			size_t offset = (size_t)y * width + x;
+			float z = f.scale * v;
+			switch (output)
+			{
+			case Output::Depth:
+				((float*)f.dst)[offset] = z;
+				break;
+			case Output::Points:
+			{
+				float* pixel = (float*)f.dst + 4 * offset;
+				pixel[0] = z * f.rays->rayX(row)[x];
+				pixel[1] = z * f.rays->rayY(row)[x];
+				pixel[2] = z;
+				pixel[3] = 1.f;
+				break;
+			}
+			case Output::PointsHalf:
+			{
+				uint16_t* pixel = (uint16_t*)f.dst + 4 * offset;
+				pixel[0] = DepthKernels::floatToHalf(z * f.rays->rayX(row)[x]);
+				pixel[1] = DepthKernels::floatToHalf(z * f.rays->rayY(row)[x]);
+				pixel[2] = DepthKernels::floatToHalf(z);
+				pixel[3] = DepthKernels::floatToHalf(z > 0.f ? 1.f : 0.f);
+				break;
+			}
+			case Output::Raw:
+				((uint16_t*)f.dst)[offset] = v;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+rs2_intrinsics
+downsampleIntrinsics(const rs2_intrinsics& intrinsics, int factor)
+{
+	// Output pixel u covers camera pixels [u * factor, u * factor + factor),
+	// so its center is camera pixel (u + 0.5) * factor - 0.5. The
+	// distortion coefficients work on normalized coordinates and stay.
+	rs2_intrinsics scaled = intrinsics;
+	scaled.width = intrinsics.width / factor;
+	scaled.height = intrinsics.height / factor;
+	scaled.fx = intrinsics.fx / factor;
+	scaled.fy = intrinsics.fy / factor;
+	scaled.ppx = (intrinsics.ppx + 0.5f) / factor - 0.5f;
+	scaled.ppy = (intrinsics.ppy + 0.5f) / factor - 0.5f;
+	return scaled;
+}
+
+void
+copyY8Rows(const uint8_t* src, int stride, int width, int height, uint8_t* dst, bool flip,
+		   int begin, int end)
+{
+	for (int y = begin; y < end; y++)
+	{
+		int row = flip ? height - 1 - y : y;
+		memcpy(dst + (size_t)y * width, src + (size_t)row * stride, (size_t)width);
+	}
+}
+
+void
+interleaveY8Rows(const uint8_t* red, int redStride, const uint8_t* green, int greenStride,
+				 int width, int height, uint8_t* dst, bool flip, int begin, int end)
+{
+	for (int y = begin; y < end; y++)
+	{
+		int row = flip ? height - 1 - y : y;
+		const uint8_t* r = red + (size_t)row * redStride;
+		const uint8_t* g = green + (size_t)row * greenStride;
+		uint8_t* out = dst + (size_t)y * width * 2;
+
+		int x = 0;
+#if defined(SIMD_SSE2)
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i vr = _mm_loadu_si128((const __m128i*)(r + x));
+			__m128i vg = _mm_loadu_si128((const __m128i*)(g + x));
+			_mm_storeu_si128((__m128i*)(out + 2 * x), _mm_unpacklo_epi8(vr, vg));
+			_mm_storeu_si128((__m128i*)(out + 2 * x + 16), _mm_unpackhi_epi8(vr, vg));
+		}
+#elif defined(SIMD_NEON)
+		for (; x + 16 <= width; x += 16)
+		{
+			uint8x16x2_t pair;
+			pair.val[0] = vld1q_u8(r + x);
+			pair.val[1] = vld1q_u8(g + x);
+			vst2q_u8(out + 2 * x, pair);
+		}
+#endif
+		for (; x < width; x++)
+		{
+			out[2 * x] = r[x];
+			out[2 * x + 1] = g[x];
+		}
+	}
+}
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Deprojection.h"
+
+#include <stdint.h>
+
+// Whole-frame conversion from Z16 depth to the TOP's output formats.
+//
+// Each combination of output format, row order and depth filter is its own
+// instantiation of one template, so none of them branches on those options
+// per row or per pixel. The capture thread picks the function for the
+// current settings from a table whenever they change and calls it for bands
+// of rows in parallel. The rows themselves are converted by the SIMD kernels
+// in DepthKernels.
+//
+// Downsampled output reduces each block of camera pixels to one depth value
+// in the same pass, right before that row is converted, so the full
+// resolution frame is only read once.
+namespace ConversionKernels
+{
+	// In the order of the TOP's Image menu.
+	enum class Output : int32_t
+	{
+		// R32Float meters.
+		Depth = 0,
+		// RGBA32Float points.
+		Points,
+		// Four half floats per point.
+		PointsHalf,
+		// The Z16 values unchanged.
+		Raw,
+
+		Count
+	};
+
+	// How a block of camera pixels becomes one output pixel when
+	// downsampling. Pixels without depth, or outside the clip range, are
+	// ignored, and a block with none left has no depth.
+	enum class Reduction : int32_t
+	{
+		// The lower median of the remaining depths.
+		Median = 0,
+		// The nearest remaining depth.
+		Min,
+
+		Count
+	};
+
+	struct Frame
+	{
+		const uint16_t*				src = nullptr;
+		void*						dst = nullptr;
+		// Of the camera image in src.
+		int							width = 0;
+		int							height = 0;
+		// 1, or 2, 4 or 8 for the size of the square blocks that become one
+		// output pixel. Output rows and columns are the camera's divided by
+		// it, rounded down.
+		int							downsample = 1;
+		// Meters per depth unit.
+		float						scale = 0.f;
+		// Rays of the depth stream, only used for Points and PointsHalf.
+		// When downsampling, a table for the output size, see
+		// downsampleIntrinsics().
+		const DeprojectionTable*	rays = nullptr;
+		// With the clip filter, depth outside [clipNear, clipFar] in depth
+		// units becomes 0, i.e. no depth.
+		uint16_t					clipNear = 0;
+		uint16_t					clipFar = 0xFFFF;
+
+		int							outputWidth() const { return width / downsample; }
+		int							outputHeight() const { return height / downsample; }
+	};
+
+	// Converts output rows [begin, end). With 'flip' output row y comes
+	// from input row height - 1 - y, or the block row counted from the
+	// bottom when downsampling. Disjoint row ranges of one frame can be
+	// converted in parallel.
+	typedef void (*ConvertFunc)(const Frame& frame, int begin, int end);
+
+	// 'reduction' only matters for frames with a downsample above 1, which
+	// need a function selected with 'downsample' set.
+	ConvertFunc	select(Output output, bool flip, bool clip,
+					   bool downsample = false, Reduction reduction = Reduction::Median);
+
+	// Gives the same result as the selected function, but checks every
+	// option per pixel and converts with plain C++. The reference the
+	// benchmark measures the specialized kernels against.
+	void		convertGeneric(const Frame& frame, Output output, bool flip, bool clip,
+							   Reduction reduction, int begin, int end);
+
+	// Intrinsics of the output pixels of a frame downsampled by 'factor',
+	// each looking through the center of its block.
+	rs2_intrinsics	downsampleIntrinsics(const rs2_intrinsics& intrinsics, int factor);
+
+	// Infrared images are already 8 bits per pixel, so they are only copied,
+	// in the same row order as the depth outputs. 'width' and 'height' are
+	// of both the image and the output, and rows [begin, end) are written.
+
+	// Y8 into R8, a memcpy per row.
+	void		copyY8Rows(const uint8_t* src, int stride, int width, int height,
+						   uint8_t* dst, bool flip, int begin, int end);
+
+	// Two Y8 images into RG8, 'red' in the first byte of every pixel.
+	void		interleaveY8Rows(const uint8_t* red, int redStride, const uint8_t* green,
+								 int greenStride, int width, int height, uint8_t* dst,
+								 bool flip, int begin, int end);
+}
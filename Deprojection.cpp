@@ -0,0 +1,42 @@
+#include "Deprojection.h"
+
+#include <librealsense2/rsutil.h>
+
+#include <string.h>
+
+DeprojectionTable::DeprojectionTable() :
+	myValid(false)
+{
+	memset(&myIntrinsics, 0, sizeof(myIntrinsics));
+}
+
+bool
+DeprojectionTable::update(const rs2_intrinsics& intrinsics)
+{
+	if (myValid && memcmp(&intrinsics, &myIntrinsics, sizeof(intrinsics)) == 0)
+		return false;
+
+	myIntrinsics = intrinsics;
+	myValid = true;
+
+	size_t count = (size_t)intrinsics.width * intrinsics.height;
+	myRayX.resize(count);
+	myRayY.resize(count);
+
+	// Same pixel convention as rs2::pointcloud, so the output matches what
+	// it used to produce.
+	for (int y = 0; y < intrinsics.height; ++y)
+	{
+		for (int x = 0; x < intrinsics.width; ++x)
+		{
+			const float pixel[2] = { (float)x, (float)y };
+			float point[3];
+			rs2_deproject_pixel_to_point(point, &intrinsics, pixel, 1.f);
+
+			size_t i = (size_t)y * intrinsics.width + x;
+			myRayX[i] = point[0];
+			myRayY[i] = point[1];
+		}
+	}
+	return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <vector>
+
+// Caches the ray through every pixel of a depth stream at a depth of 1m.
+// Every distortion model librealsense supports deprojects linearly in depth,
+// so a point is just depth * (rayX, rayY, 1) and the per-pixel distortion
+// math only has to run when the stream's intrinsics change.
+class DeprojectionTable
+{
+public:
+	DeprojectionTable();
+
+	// Rebuilds the table if 'intrinsics' differ from the ones it was built
+	// from. Returns true if it was rebuilt.
+	bool			update(const rs2_intrinsics& intrinsics);
+
+	int				width() const { return myIntrinsics.width; }
+	int				height() const { return myIntrinsics.height; }
+
+	// Rays for one row of the camera image, top row first.
+	const float*	rayX(int row) const { return &myRayX[row * width()]; }
+	const float*	rayY(int row) const { return &myRayY[row * width()]; }
+
+private:
+	rs2_intrinsics		myIntrinsics;
+	bool				myValid;
+
+	// Kept as separate planes so the kernels can load them as vectors.
+	std::vector<float>	myRayX;
+	std::vector<float>	myRayY;
+};
@@ -0,0 +1,309 @@
+#include "DepthCodec.h"
+#include "SimdDetect.h"
+
+#include <string.h>
+#include <algorithm>
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+namespace
+{
+
+// Number of pixels converted to zigzag deltas at a time.
+const size_t DeltaChunk = 64;
+
+inline int
+countTrailingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return (int)index;
+#else
+	return __builtin_ctzll(value);
+#endif
+}
+
+// Length of the run of zeros, or with 'valid' of non-zero pixels, at the
+// start of 'p'.
+size_t
+runLength(const uint16_t* p, size_t n, bool valid)
+{
+	size_t i = 0;
+
+#if defined(SIMD_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+		// Two bits per pixel, set where the pixel is zero.
+		uint32_t zeros = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero));
+		uint32_t ends = valid ? zeros : ~zeros & 0xFFFF;
+		if (ends)
+			return i + countTrailingZeros(ends) / 2;
+	}
+#elif defined(SIMD_NEON)
+	for (; i + 8 <= n; i += 8)
+	{
+		uint16x8_t zeros16 = vceqq_u16(vld1q_u16(p + i), vdupq_n_u16(0));
+		// One byte per pixel, 0xFF where the pixel is zero.
+		uint64_t zeros = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(zeros16, 4)), 0);
+		uint64_t ends = valid ? zeros : ~zeros;
+		if (ends)
+			return i + countTrailingZeros(ends) / 8;
+	}
+#endif
+
+	if (valid)
+	{
+		for (; i < n && p[i] != 0; i++) {}
+	}
+	else
+	{
+		for (; i < n && p[i] == 0; i++) {}
+	}
+	return i;
+}
+
+// Writes the zigzag coded difference of each pixel to the one before it.
+// Returns the last pixel.
+uint16_t
+zigzagDeltas(const uint16_t* src, size_t count, uint16_t previous, uint16_t* dst)
+{
+	size_t i = 0;
+
+#if defined(SIMD_SSE2)
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i current = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i before = _mm_insert_epi16(_mm_slli_si128(current, 2), previous, 0);
+		__m128i delta = _mm_sub_epi16(current, before);
+		__m128i zigzag = _mm_xor_si128(_mm_slli_epi16(delta, 1), _mm_srai_epi16(delta, 15));
+		_mm_storeu_si128((__m128i*)(dst + i), zigzag);
+		previous = src[i + 7];
+	}
+#elif defined(SIMD_NEON)
+	for (; i + 8 <= count; i += 8)
+	{
+		uint16x8_t current = vld1q_u16(src + i);
+		uint16x8_t before = vextq_u16(vdupq_n_u16(previous), current, 7);
+		int16x8_t delta = vreinterpretq_s16_u16(vsubq_u16(current, before));
+		int16x8_t zigzag = veorq_s16(vshlq_n_s16(delta, 1), vshrq_n_s16(delta, 15));
+		vst1q_u16(dst + i, vreinterpretq_u16_s16(zigzag));
+		previous = src[i + 7];
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		int16_t delta = (int16_t)(uint16_t)(src[i] - previous);
+		dst[i] = (uint16_t)(((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15));
+		previous = src[i];
+	}
+	return previous;
+}
+
+class NibbleWriter
+{
+public:
+	explicit NibbleWriter(uint8_t* out) : myOut(out), myStart(out), myBits(0), myCount(0) {}
+
+	void		put(uint32_t value)
+				{
+					// The whole number is assembled in a register first, the
+					// first group ending up in the highest nibble. A run
+					// length can take up to 11 nibbles.
+					uint64_t code = 0;
+					int nibbles = 0;
+					do
+					{
+						uint32_t nibble = value & 7;
+						value >>= 3;
+						if (value)
+							nibble |= 8;
+						code = (code << 4) | nibble;
+						nibbles++;
+					} while (value);
+
+					int bits = 4 * nibbles;
+					if (bits > 32)
+					{
+						putBits(code >> 32, bits - 32);
+						bits = 32;
+					}
+					putBits(code & 0xFFFFFFFF, bits);
+				}
+
+	// Returns the number of bytes written.
+	size_t		finish()
+				{
+					if (myCount)
+					{
+						uint32_t word = (uint32_t)(myBits << (32 - myCount));
+						memcpy(myOut, &word, 4);
+						myOut += 4;
+						myCount = 0;
+					}
+					return (size_t)(myOut - myStart);
+				}
+
+private:
+	// At most 32 bits, so they fit next to the fewer than 32 left over.
+	void		putBits(uint64_t code, int bits)
+				{
+					myBits = (myBits << bits) | code;
+					myCount += bits;
+					if (myCount >= 32)
+					{
+						myCount -= 32;
+						uint32_t word = (uint32_t)(myBits >> myCount);
+						memcpy(myOut, &word, 4);
+						myOut += 4;
+					}
+				}
+
+	uint8_t*	myOut;
+	uint8_t*	myStart;
+	// Bits not written yet are the low myCount bits.
+	uint64_t	myBits;
+	int			myCount;
+};
+
+class NibbleReader
+{
+public:
+	NibbleReader(const uint8_t* in, size_t size) :
+		myIn(in), myEnd(in + size), myWord(0), myNibbles(0), myOk(true) {}
+
+	bool		ok() const { return myOk; }
+
+	// Reads a value that fits in 'bits' bits, at most 32. Anything longer
+	// is a corrupt stream, and shifting on would overflow.
+	uint32_t	get(int bits)
+				{
+					uint64_t value = 0;
+					int shift = 0;
+					uint32_t nibble;
+					do
+					{
+						if (shift >= bits)
+						{
+							myOk = false;
+							return 0;
+						}
+						if (!myNibbles)
+						{
+							if (myEnd - myIn < 4)
+							{
+								myOk = false;
+								return 0;
+							}
+							memcpy(&myWord, myIn, 4);
+							myIn += 4;
+							myNibbles = 8;
+						}
+						nibble = myWord >> 28;
+						myWord <<= 4;
+						myNibbles--;
+
+						value |= (uint64_t)(nibble & 7) << shift;
+						shift += 3;
+					} while (nibble & 8);
+
+					if (value >> bits)
+					{
+						myOk = false;
+						return 0;
+					}
+					return (uint32_t)value;
+				}
+
+private:
+	const uint8_t*	myIn;
+	const uint8_t*	myEnd;
+	uint32_t		myWord;
+	int				myNibbles;
+	bool			myOk;
+};
+
+}
+
+namespace DepthCodec
+{
+
+size_t
+maxEncodedSize(size_t count)
+{
+	// At most 6 nibbles per pixel for its delta, and for each pair of runs
+	// at most one nibble per pixel in them plus one each.
+	size_t nibbles = 9 * count + 2;
+	return (nibbles + 7) / 8 * 4;
+}
+
+size_t
+encodeRVL(const uint16_t* src, size_t count, uint8_t* dst)
+{
+	NibbleWriter writer(dst);
+	uint16_t deltas[DeltaChunk];
+	uint16_t previous = 0;
+
+	const uint16_t* p = src;
+	const uint16_t* end = src + count;
+	while (p < end)
+	{
+		size_t zeros = runLength(p, end - p, false);
+		writer.put((uint32_t)zeros);
+		p += zeros;
+
+		size_t valid = runLength(p, end - p, true);
+		writer.put((uint32_t)valid);
+
+		for (size_t done = 0; done < valid; done += DeltaChunk)
+		{
+			size_t n = std::min(DeltaChunk, valid - done);
+			previous = zigzagDeltas(p + done, n, previous, deltas);
+			for (size_t i = 0; i < n; i++)
+				writer.put(deltas[i]);
+		}
+		p += valid;
+	}
+	return writer.finish();
+}
+
+bool
+decodeRVL(const uint8_t* src, size_t size, uint16_t* dst, size_t count)
+{
+	NibbleReader reader(src, size);
+	uint16_t previous = 0;
+	size_t remaining = count;
+
+	while (remaining)
+	{
+		// Run lengths count pixels, and only the deltas are 16 bit.
+		uint32_t zeros = reader.get(32);
+		if (!reader.ok() || zeros > remaining)
+			return false;
+		memset(dst, 0, zeros * sizeof(uint16_t));
+		dst += zeros;
+		remaining -= zeros;
+
+		uint32_t valid = reader.get(32);
+		if (!reader.ok() || valid > remaining)
+			return false;
+		for (uint32_t i = 0; i < valid; i++)
+		{
+			uint16_t zigzag = (uint16_t)reader.get(16);
+			uint16_t delta = (uint16_t)((zigzag >> 1) ^ (uint16_t)-(int)(zigzag & 1));
+			previous = (uint16_t)(previous + delta);
+			*dst++ = previous;
+		}
+		if (!reader.ok())
+			return false;
+		remaining -= valid;
+	}
+	return true;
+}
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lossless compression for Z16 depth images, after RVL (A. Wilson, "Fast
+// Lossless Depth Image Compression", 2017).
+//
+// A frame alternates between a run of zeros and a run of valid pixels. Both
+// run lengths are stored, followed by each valid pixel as the zigzag coded
+// difference to the previous valid pixel, modulo 2^16. Every number is
+// written as groups of 3 bits, low bits first, each with a continuation bit,
+// and the 4-bit groups are packed into 32-bit little-endian words starting
+// at the most significant end.
+namespace DepthCodec
+{
+	// Upper bound on the encoded size of 'count' pixels, in bytes.
+	size_t		maxEncodedSize(size_t count);
+
+	// Returns the encoded size in bytes, a multiple of 4. 'dst' must have
+	// room for maxEncodedSize(count) bytes.
+	size_t		encodeRVL(const uint16_t* src, size_t count, uint8_t* dst);
+
+	// Returns false if the 'size' bytes at 'src' are corrupt or don't hold
+	// exactly 'count' pixels.
+	bool		decodeRVL(const uint8_t* src, size_t size, uint16_t* dst, size_t count);
+}
@@ -0,0 +1,170 @@
+#include "DepthFilterChain.h"
+
+#include <iostream>
+
+bool
+DepthFilterChain::Settings::operator==(const Settings& other) const
+{
+	return decimation == other.decimation &&
+		decimationMagnitude == other.decimationMagnitude &&
+		threshold == other.threshold &&
+		thresholdMin == other.thresholdMin &&
+		thresholdMax == other.thresholdMax &&
+		spatial == other.spatial &&
+		spatialMagnitude == other.spatialMagnitude &&
+		spatialAlpha == other.spatialAlpha &&
+		spatialDelta == other.spatialDelta &&
+		spatialHoles == other.spatialHoles &&
+		temporal == other.temporal &&
+		temporalAlpha == other.temporalAlpha &&
+		temporalDelta == other.temporalDelta &&
+		temporalPersistence == other.temporalPersistence &&
+		holeFilling == other.holeFilling &&
+		holeFillingMode == other.holeFillingMode;
+}
+
+// Creates the filter in 'filter' if 'on' and it doesn't exist yet, or
+// destroys it if not. Returns true if the filter exists afterwards.
+template <typename T, typename... Args>
+static bool
+enable(std::unique_ptr<T>& filter, bool on, Args... args)
+{
+	if (!on)
+	{
+		filter.reset();
+		return false;
+	}
+	if (!filter)
+		filter.reset(new T(args...));
+	return true;
+}
+
+// librealsense rejects values outside an option's range. A bad value leaves
+// that option as it was, but doesn't keep the rest from being applied.
+static void
+setOption(const rs2::options& filter, rs2_option option, float value)
+{
+	try
+	{
+		filter.set_option(option, value);
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "RS2 - Error: " << e.what() << std::endl;
+	}
+}
+
+void
+DepthFilterChain::configure(const Settings& settings)
+{
+	if (settings == mySettings)
+		return;
+	mySettings = settings;
+
+	if (enable(myDecimation, settings.decimation))
+		setOption(*myDecimation, RS2_OPTION_FILTER_MAGNITUDE, (float)settings.decimationMagnitude);
+
+	if (enable(myThreshold, settings.threshold))
+	{
+		setOption(*myThreshold, RS2_OPTION_MIN_DISTANCE, settings.thresholdMin);
+		setOption(*myThreshold, RS2_OPTION_MAX_DISTANCE, settings.thresholdMax);
+	}
+
+	bool disparity = settings.spatial || settings.temporal;
+	enable(myToDisparity, disparity, true);
+	enable(myToDepth, disparity, false);
+
+	if (enable(mySpatial, settings.spatial))
+	{
+		setOption(*mySpatial, RS2_OPTION_FILTER_MAGNITUDE, (float)settings.spatialMagnitude);
+		setOption(*mySpatial, RS2_OPTION_FILTER_SMOOTH_ALPHA, settings.spatialAlpha);
+		setOption(*mySpatial, RS2_OPTION_FILTER_SMOOTH_DELTA, (float)settings.spatialDelta);
+		setOption(*mySpatial, RS2_OPTION_HOLES_FILL, (float)settings.spatialHoles);
+	}
+
+	// A temporal filter that was off starts without history, instead of
+	// blending in whatever it saw before it was turned off.
+	if (enable(myTemporal, settings.temporal))
+	{
+		setOption(*myTemporal, RS2_OPTION_FILTER_SMOOTH_ALPHA, settings.temporalAlpha);
+		setOption(*myTemporal, RS2_OPTION_FILTER_SMOOTH_DELTA, (float)settings.temporalDelta);
+		setOption(*myTemporal, RS2_OPTION_HOLES_FILL, (float)settings.temporalPersistence);
+	}
+
+	if (enable(myHoleFilling, settings.holeFilling))
+		setOption(*myHoleFilling, RS2_OPTION_HOLES_FILL, (float)settings.holeFillingMode);
+
+	// The Info CHOP shouldn't keep showing the cost of a filter that's off.
+	const bool on[(int)Stage::NumStages] = {
+		settings.decimation, settings.threshold, settings.spatial || settings.temporal,
+		settings.spatial, settings.temporal, settings.holeFilling,
+	};
+	for (int i = 0; i < (int)Stage::NumStages; i++)
+	{
+		if (!on[i])
+			myTimes[i].clear();
+	}
+}
+
+bool
+DepthFilterChain::active() const
+{
+	return mySettings.decimation || mySettings.threshold || mySettings.spatial ||
+		mySettings.temporal || mySettings.holeFilling;
+}
+
+double
+DepthFilterChain::run(const rs2::filter& filter, rs2::frame& frame)
+{
+	int64_t start = monotonicNanoseconds();
+	frame = filter.process(frame);
+	return elapsedMilliseconds(start, monotonicNanoseconds());
+}
+
+rs2::frame
+DepthFilterChain::process(const rs2::frame& depth)
+{
+	rs2::frame frame = depth;
+
+	if (myDecimation)
+		myTimes[(int)Stage::Decimation].add(run(*myDecimation, frame));
+	if (myThreshold)
+		myTimes[(int)Stage::Threshold].add(run(*myThreshold, frame));
+
+	if (myToDisparity && myToDepth)
+	{
+		double disparity = run(*myToDisparity, frame);
+		if (mySpatial)
+			myTimes[(int)Stage::Spatial].add(run(*mySpatial, frame));
+		if (myTemporal)
+			myTimes[(int)Stage::Temporal].add(run(*myTemporal, frame));
+		disparity += run(*myToDepth, frame);
+		myTimes[(int)Stage::Disparity].add(disparity);
+	}
+
+	if (myHoleFilling)
+		myTimes[(int)Stage::HoleFilling].add(run(*myHoleFilling, frame));
+
+	return frame;
+}
+
+RollingStats::Summary
+DepthFilterChain::stageTime(Stage stage) const
+{
+	return myTimes[(int)stage].summary();
+}
+
+const char*
+DepthFilterChain::stageName(Stage stage)
+{
+	switch (stage)
+	{
+	case Stage::Decimation:		return "decimation";
+	case Stage::Threshold:		return "threshold";
+	case Stage::Disparity:		return "disparity";
+	case Stage::Spatial:		return "spatial";
+	case Stage::Temporal:		return "temporal";
+	case Stage::HoleFilling:	return "holeFilling";
+	default:					return "unknown";
+	}
+}
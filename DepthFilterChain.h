@@ -0,0 +1,109 @@
+#pragma once
+
+#include "Telemetry.h"
+
+#include <librealsense2/rs.hpp>
+
+#include <stdint.h>
+#include <memory>
+
+// librealsense's depth post-processing filters, in the order librealsense
+// recommends, run by the capture thread on each frame before it's
+// converted. Filtering on the CPU at camera resolution replaces doing the
+// same in GLSL TOPs on the uploaded float texture, and decimation shrinks
+// what gets converted and uploaded in the first place.
+//
+// Spatial and Temporal work on disparity rather than depth, so the chain
+// converts to disparity in front of them and back to Z16 depth behind
+// them. Decimation changes the frame size and intrinsics; the output
+// texture follows.
+//
+// configure() and process() must be called from the same thread.
+class DepthFilterChain
+{
+public:
+	enum class Stage : int32_t
+	{
+		Decimation = 0,
+		Threshold,
+		// Both transforms around Spatial and Temporal.
+		Disparity,
+		Spatial,
+		Temporal,
+		HoleFilling,
+
+		NumStages,
+	};
+
+	// Ranges and defaults follow librealsense's.
+	struct Settings
+	{
+		bool	decimation = false;
+		// Reduces each magnitude x magnitude block to one pixel, 2-8.
+		int		decimationMagnitude = 2;
+
+		bool	threshold = false;
+		// Meters.
+		float	thresholdMin = 0.1f;
+		float	thresholdMax = 4.f;
+
+		bool	spatial = false;
+		// Filter passes, 1-5.
+		int		spatialMagnitude = 2;
+		// Weight of the current pixel against its smoothed neighbor, 0.25-1.
+		float	spatialAlpha = 0.5f;
+		// Disparity step, in depth units, treated as an edge, 1-50.
+		int		spatialDelta = 20;
+		// Radius of holes filled along the way, 0 is off and 5 unlimited.
+		int		spatialHoles = 0;
+
+		bool	temporal = false;
+		// Weight of the current frame against the history, 0-1.
+		float	temporalAlpha = 0.4f;
+		// Disparity step treated as a change in the scene, 1-100.
+		int		temporalDelta = 20;
+		// When a pixel without depth takes its last valid value, 0-8, see
+		// librealsense's temporal filter.
+		int		temporalPersistence = 3;
+
+		bool	holeFilling = false;
+		// 0 fills from the left neighbor, 1 from the farthest and 2 from the
+		// nearest of the surrounding pixels.
+		int		holeFillingMode = 1;
+
+		bool	operator==(const Settings& other) const;
+		bool	operator!=(const Settings& other) const { return !(*this == other); }
+	};
+
+	// Creates filters that were turned on and drops the ones turned off,
+	// along with their history and frame pools.
+	void		configure(const Settings& settings);
+
+	// Whether any filter is on.
+	bool		active() const;
+
+	// Returns the filtered frame, or 'depth' itself when nothing is on.
+	rs2::frame	process(const rs2::frame& depth);
+
+	// Milliseconds each stage took over recent frames. Stages that are off
+	// have no samples. Safe to call from any thread.
+	RollingStats::Summary	stageTime(Stage stage) const;
+
+	static const char*		stageName(Stage stage);
+
+private:
+	// Runs one filter on 'frame' and returns the milliseconds it took.
+	static double	run(const rs2::filter& filter, rs2::frame& frame);
+
+	Settings		mySettings;
+
+	std::unique_ptr<rs2::decimation_filter>		myDecimation;
+	std::unique_ptr<rs2::threshold_filter>		myThreshold;
+	std::unique_ptr<rs2::disparity_transform>	myToDisparity;
+	std::unique_ptr<rs2::spatial_filter>		mySpatial;
+	std::unique_ptr<rs2::temporal_filter>		myTemporal;
+	std::unique_ptr<rs2::disparity_transform>	myToDepth;
+	std::unique_ptr<rs2::hole_filling_filter>	myHoleFilling;
+
+	RollingStats	myTimes[(int)Stage::NumStages];
+};
@@ -0,0 +1,535 @@
+#include "DepthKernels.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define DEPTHKERNELS_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#define DEPTHKERNELS_NEON
+	#include <arm_neon.h>
+#endif
+
+// MSVC lets any function use any intrinsic. GCC and Clang need to be told
+// which functions may use instructions beyond the compiler's baseline.
+#ifdef _MSC_VER
+	#define DEPTHKERNELS_TARGET(isa)
+#else
+	#define DEPTHKERNELS_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace
+{
+
+struct CpuFeatures
+{
+	bool	sse2 = false;
+	bool	avx2 = false;
+	bool	avx512 = false;
+	bool	f16c = false;
+	bool	neon = false;
+};
+
+#ifdef DEPTHKERNELS_X86
+
+void
+cpuid(int info[4], int leaf, int subleaf)
+{
+#ifdef _MSC_VER
+	__cpuidex(info, leaf, subleaf);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	info[0] = (int)a;
+	info[1] = (int)b;
+	info[2] = (int)c;
+	info[3] = (int)d;
+#endif
+}
+
+// Which register states the OS saves on a context switch.
+uint64_t
+xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+#endif
+
+CpuFeatures
+detectCpuFeatures()
+{
+	CpuFeatures features;
+
+#ifdef DEPTHKERNELS_X86
+	int info[4];
+	cpuid(info, 0, 0);
+	int maxLeaf = info[0];
+
+	cpuid(info, 1, 0);
+	features.sse2 = (info[3] & (1 << 26)) != 0;
+
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	uint64_t xcr0 = osxsave ? xgetbv0() : 0;
+	bool ymmState = (xcr0 & 0x6) == 0x6;
+	bool zmmState = (xcr0 & 0xE6) == 0xE6;
+	features.f16c = avx && ymmState && (info[2] & (1 << 29)) != 0;
+
+	if (maxLeaf >= 7)
+	{
+		cpuid(info, 7, 0);
+		features.avx2 = avx && ymmState && (info[1] & (1 << 5)) != 0;
+		features.avx512 = zmmState && (info[1] & (1 << 16)) != 0;
+	}
+#elif defined(DEPTHKERNELS_NEON)
+	features.neon = true;
+#endif
+
+	return features;
+}
+
+#ifdef DEPTHKERNELS_X86
+
+// The output blocks are write-only memory that's uploaded to the GPU, so the
+// vector loops use streaming stores once the destination is aligned and
+// keep the source rows in cache instead.
+
+void
+scaleRowSSE2(const uint16_t* src, float* dst, int count, float scale)
+{
+	int x = 0;
+	for (; x < count && ((uintptr_t)(dst + x) & 15); x++)
+		dst[x] = scale * src[x];
+
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero));
+		__m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(d, zero));
+		_mm_stream_ps(dst + x, _mm_mul_ps(lo, vscale));
+		_mm_stream_ps(dst + x + 4, _mm_mul_ps(hi, vscale));
+	}
+
+	for (; x < count; x++)
+		dst[x] = scale * src[x];
+
+	_mm_sfence();
+}
+
+DEPTHKERNELS_TARGET("avx2")
+void
+scaleRowAVX2(const uint16_t* src, float* dst, int count, float scale)
+{
+	int x = 0;
+	for (; x < count && ((uintptr_t)(dst + x) & 31); x++)
+		dst[x] = scale * src[x];
+
+	const __m256 vscale = _mm256_set1_ps(scale);
+	for (; x + 16 <= count; x += 16)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(src + x + 8));
+		__m256 flo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(lo));
+		__m256 fhi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(hi));
+		_mm256_stream_ps(dst + x, _mm256_mul_ps(flo, vscale));
+		_mm256_stream_ps(dst + x + 8, _mm256_mul_ps(fhi, vscale));
+	}
+
+	for (; x < count; x++)
+		dst[x] = scale * src[x];
+
+	_mm_sfence();
+}
+
+DEPTHKERNELS_TARGET("avx512f")
+void
+scaleRowAVX512(const uint16_t* src, float* dst, int count, float scale)
+{
+	int x = 0;
+	for (; x < count && ((uintptr_t)(dst + x) & 63); x++)
+		dst[x] = scale * src[x];
+
+	const __m512 vscale = _mm512_set1_ps(scale);
+	for (; x + 32 <= count; x += 32)
+	{
+		__m256i lo = _mm256_loadu_si256((const __m256i*)(src + x));
+		__m256i hi = _mm256_loadu_si256((const __m256i*)(src + x + 16));
+		__m512 flo = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(lo));
+		__m512 fhi = _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(hi));
+		_mm512_stream_ps(dst + x, _mm512_mul_ps(flo, vscale));
+		_mm512_stream_ps(dst + x + 16, _mm512_mul_ps(fhi, vscale));
+	}
+
+	for (; x < count; x++)
+		dst[x] = scale * src[x];
+
+	_mm_sfence();
+}
+
+void
+deprojectRowSSE2(const uint16_t* src, const float* rayX, const float* rayY,
+				float* dst, int count, float scale)
+{
+	int x = 0;
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128i zero = _mm_setzero_si128();
+
+	// Every pixel is a whole 16 byte vector, so the stores can stream as
+	// soon as the block itself is aligned.
+	if (((uintptr_t)dst & 15) == 0)
+	{
+		for (; x + 4 <= count; x += 4)
+		{
+			__m128i d = _mm_loadl_epi64((const __m128i*)(src + x));
+			__m128 z = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero)), vscale);
+			__m128 px = _mm_mul_ps(z, _mm_loadu_ps(rayX + x));
+			__m128 py = _mm_mul_ps(z, _mm_loadu_ps(rayY + x));
+			__m128 pw = _mm_set1_ps(1.f);
+
+			_MM_TRANSPOSE4_PS(px, py, z, pw);
+
+			_mm_stream_ps(dst + 4 * x, px);
+			_mm_stream_ps(dst + 4 * x + 4, py);
+			_mm_stream_ps(dst + 4 * x + 8, z);
+			_mm_stream_ps(dst + 4 * x + 12, pw);
+		}
+		_mm_sfence();
+	}
+
+	DepthKernels::deprojectRowScalar(src + x, rayX + x, rayY + x, dst + 4 * x, count - x, scale);
+}
+
+DEPTHKERNELS_TARGET("avx2")
+void
+deprojectRowAVX2(const uint16_t* src, const float* rayX, const float* rayY,
+				float* dst, int count, float scale)
+{
+	int x = 0;
+	const __m256 vscale = _mm256_set1_ps(scale);
+	const __m256 one = _mm256_set1_ps(1.f);
+
+	if (((uintptr_t)dst & 31) == 0)
+	{
+		for (; x + 8 <= count; x += 8)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i*)(src + x));
+			__m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(d)), vscale);
+			__m256 px = _mm256_mul_ps(z, _mm256_loadu_ps(rayX + x));
+			__m256 py = _mm256_mul_ps(z, _mm256_loadu_ps(rayY + x));
+
+			// Interleave into x y z w per pixel. Each 128 bit lane is
+			// transposed on its own, then the lanes are put back in order.
+			__m256 xy0 = _mm256_unpacklo_ps(px, py);
+			__m256 zw0 = _mm256_unpacklo_ps(z, one);
+			__m256 xy1 = _mm256_unpackhi_ps(px, py);
+			__m256 zw1 = _mm256_unpackhi_ps(z, one);
+			__m256 p04 = _mm256_shuffle_ps(xy0, zw0, 0x44);
+			__m256 p15 = _mm256_shuffle_ps(xy0, zw0, 0xEE);
+			__m256 p26 = _mm256_shuffle_ps(xy1, zw1, 0x44);
+			__m256 p37 = _mm256_shuffle_ps(xy1, zw1, 0xEE);
+
+			_mm256_stream_ps(dst + 4 * x, _mm256_permute2f128_ps(p04, p15, 0x20));
+			_mm256_stream_ps(dst + 4 * x + 8, _mm256_permute2f128_ps(p26, p37, 0x20));
+			_mm256_stream_ps(dst + 4 * x + 16, _mm256_permute2f128_ps(p04, p15, 0x31));
+			_mm256_stream_ps(dst + 4 * x + 24, _mm256_permute2f128_ps(p26, p37, 0x31));
+		}
+		_mm_sfence();
+	}
+
+	DepthKernels::deprojectRowScalar(src + x, rayX + x, rayY + x, dst + 4 * x, count - x, scale);
+}
+
+DEPTHKERNELS_TARGET("avx2,f16c")
+void
+deprojectHalfRowF16C(const uint16_t* src, const float* rayX, const float* rayY,
+					uint16_t* dst, int count, float scale)
+{
+	int x = 0;
+	const __m256 vscale = _mm256_set1_ps(scale);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+
+	// Eight bytes per pixel, so two pixels fill one aligned 16 byte store.
+	if (((uintptr_t)dst & 15) == 0)
+	{
+		for (; x + 8 <= count; x += 8)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i*)(src + x));
+			__m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(d)), vscale);
+			__m256 px = _mm256_mul_ps(z, _mm256_loadu_ps(rayX + x));
+			__m256 py = _mm256_mul_ps(z, _mm256_loadu_ps(rayY + x));
+			__m256 valid = _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GT_OQ), one);
+
+			// Same interleave as deprojectRowAVX2.
+			__m256 xy0 = _mm256_unpacklo_ps(px, py);
+			__m256 zw0 = _mm256_unpacklo_ps(z, valid);
+			__m256 xy1 = _mm256_unpackhi_ps(px, py);
+			__m256 zw1 = _mm256_unpackhi_ps(z, valid);
+			__m256 p04 = _mm256_shuffle_ps(xy0, zw0, 0x44);
+			__m256 p15 = _mm256_shuffle_ps(xy0, zw0, 0xEE);
+			__m256 p26 = _mm256_shuffle_ps(xy1, zw1, 0x44);
+			__m256 p37 = _mm256_shuffle_ps(xy1, zw1, 0xEE);
+
+			const int rtne = _MM_FROUND_TO_NEAREST_INT;
+			__m128i* out = (__m128i*)(dst + 4 * x);
+			_mm_stream_si128(out, _mm256_cvtps_ph(_mm256_permute2f128_ps(p04, p15, 0x20), rtne));
+			_mm_stream_si128(out + 1, _mm256_cvtps_ph(_mm256_permute2f128_ps(p26, p37, 0x20), rtne));
+			_mm_stream_si128(out + 2, _mm256_cvtps_ph(_mm256_permute2f128_ps(p04, p15, 0x31), rtne));
+			_mm_stream_si128(out + 3, _mm256_cvtps_ph(_mm256_permute2f128_ps(p26, p37, 0x31), rtne));
+		}
+		_mm_sfence();
+	}
+
+	DepthKernels::deprojectHalfRowScalar(src + x, rayX + x, rayY + x, dst + 4 * x, count - x, scale);
+}
+
+#endif
+
+#ifdef DEPTHKERNELS_NEON
+
+void
+scaleRowNEON(const uint16_t* src, float* dst, int count, float scale)
+{
+	int x = 0;
+	for (; x + 8 <= count; x += 8)
+	{
+		uint16x8_t d = vld1q_u16(src + x);
+		float32x4_t lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(d)));
+		float32x4_t hi = vcvtq_f32_u32(vmovl_u16(vget_high_u16(d)));
+		vst1q_f32(dst + x, vmulq_n_f32(lo, scale));
+		vst1q_f32(dst + x + 4, vmulq_n_f32(hi, scale));
+	}
+
+	for (; x < count; x++)
+		dst[x] = scale * src[x];
+}
+
+void
+deprojectRowNEON(const uint16_t* src, const float* rayX, const float* rayY,
+				float* dst, int count, float scale)
+{
+	int x = 0;
+	for (; x + 4 <= count; x += 4)
+	{
+		float32x4x4_t p;
+		p.val[2] = vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(src + x))), scale);
+		p.val[0] = vmulq_f32(p.val[2], vld1q_f32(rayX + x));
+		p.val[1] = vmulq_f32(p.val[2], vld1q_f32(rayY + x));
+		p.val[3] = vdupq_n_f32(1.f);
+		vst4q_f32(dst + 4 * x, p);
+	}
+
+	DepthKernels::deprojectRowScalar(src + x, rayX + x, rayY + x, dst + 4 * x, count - x, scale);
+}
+
+// Half float conversions are only part of the base instruction set on 64-bit ARM.
+#ifdef __aarch64__
+	#define DEPTHKERNELS_NEON_HALF
+
+void
+deprojectHalfRowNEON(const uint16_t* src, const float* rayX, const float* rayY,
+					uint16_t* dst, int count, float scale)
+{
+	int x = 0;
+	const float32x4_t zero = vdupq_n_f32(0.f);
+	const float32x4_t one = vdupq_n_f32(1.f);
+	for (; x + 4 <= count; x += 4)
+	{
+		float32x4_t z = vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vld1_u16(src + x))), scale);
+		float32x4_t valid = vbslq_f32(vcgtq_f32(z, zero), one, zero);
+
+		uint16x4x4_t p;
+		p.val[0] = vreinterpret_u16_f16(vcvt_f16_f32(vmulq_f32(z, vld1q_f32(rayX + x))));
+		p.val[1] = vreinterpret_u16_f16(vcvt_f16_f32(vmulq_f32(z, vld1q_f32(rayY + x))));
+		p.val[2] = vreinterpret_u16_f16(vcvt_f16_f32(z));
+		p.val[3] = vreinterpret_u16_f16(vcvt_f16_f32(valid));
+		vst4_u16(dst + 4 * x, p);
+	}
+
+	DepthKernels::deprojectHalfRowScalar(src + x, rayX + x, rayY + x, dst + 4 * x, count - x, scale);
+}
+
+#endif
+
+#endif
+
+const char* theInstructionSet = "Scalar";
+
+const CpuFeatures theCpuFeatures = detectCpuFeatures();
+
+DepthKernels::ScaleRowFunc
+selectScaleRow()
+{
+	const CpuFeatures& features = theCpuFeatures;
+	(void)features;
+
+#ifdef DEPTHKERNELS_X86
+	if (features.avx512)
+	{
+		theInstructionSet = "AVX-512";
+		return scaleRowAVX512;
+	}
+	if (features.avx2)
+	{
+		theInstructionSet = "AVX2";
+		return scaleRowAVX2;
+	}
+	if (features.sse2)
+	{
+		theInstructionSet = "SSE2";
+		return scaleRowSSE2;
+	}
+#elif defined(DEPTHKERNELS_NEON)
+	if (features.neon)
+	{
+		theInstructionSet = "NEON";
+		return scaleRowNEON;
+	}
+#endif
+
+	return DepthKernels::scaleRowScalar;
+}
+
+// AVX-512 would only widen the loads here, the interleaving shuffles are
+// the bottleneck, so AVX2 machines and up share one kernel.
+DepthKernels::DeprojectRowFunc
+selectDeprojectRow()
+{
+	const CpuFeatures& features = theCpuFeatures;
+	(void)features;
+
+#ifdef DEPTHKERNELS_X86
+	if (features.avx2)
+		return deprojectRowAVX2;
+	if (features.sse2)
+		return deprojectRowSSE2;
+#elif defined(DEPTHKERNELS_NEON)
+	if (features.neon)
+		return deprojectRowNEON;
+#endif
+
+	return DepthKernels::deprojectRowScalar;
+}
+
+DepthKernels::DeprojectHalfRowFunc
+selectDeprojectHalfRow()
+{
+	const CpuFeatures& features = theCpuFeatures;
+	(void)features;
+
+#ifdef DEPTHKERNELS_X86
+	if (features.avx2 && features.f16c)
+		return deprojectHalfRowF16C;
+#elif defined(DEPTHKERNELS_NEON_HALF)
+	if (features.neon)
+		return deprojectHalfRowNEON;
+#endif
+
+	return DepthKernels::deprojectHalfRowScalar;
+}
+
+}
+
+namespace DepthKernels
+{
+
+void
+scaleRowScalar(const uint16_t* src, float* dst, int count, float scale)
+{
+	for (int x = 0; x < count; ++x)
+		dst[x] = scale * src[x];
+}
+
+void
+deprojectRowScalar(const uint16_t* src, const float* rayX, const float* rayY,
+					float* dst, int count, float scale)
+{
+	for (int x = 0; x < count; ++x)
+	{
+		float z = scale * src[x];
+		float* pixel = &dst[4 * x];
+		pixel[0] = z * rayX[x];
+		pixel[1] = z * rayY[x];
+		pixel[2] = z;
+		pixel[3] = 1.f;
+	}
+}
+
+uint16_t
+floatToHalf(float value)
+{
+	uint32_t x;
+	memcpy(&x, &value, sizeof(x));
+
+	uint32_t sign = x & 0x80000000u;
+	x ^= sign;
+
+	uint16_t half;
+	if (x >= (127 + 16) << 23)
+	{
+		// Too large for a half, or already infinity or NaN.
+		half = x > (255u << 23) ? 0x7E00 : 0x7C00;
+	}
+	else if (x < (127 - 14) << 23)
+	{
+		// Becomes a denormal or zero. Adding this magic number lets the
+		// float hardware do the shift and the rounding.
+		const uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+		float magic, f;
+		memcpy(&magic, &magicBits, sizeof(magic));
+		memcpy(&f, &x, sizeof(f));
+		f += magic;
+		memcpy(&x, &f, sizeof(x));
+		half = (uint16_t)(x - magicBits);
+	}
+	else
+	{
+		// Rebias the exponent and round the mantissa to nearest, ties to even.
+		uint32_t odd = (x >> 13) & 1;
+		x += ((uint32_t)(15 - 127) << 23) + 0xFFF;
+		x += odd;
+		half = (uint16_t)(x >> 13);
+	}
+	return half | (uint16_t)(sign >> 16);
+}
+
+void
+deprojectHalfRowScalar(const uint16_t* src, const float* rayX, const float* rayY,
+						uint16_t* dst, int count, float scale)
+{
+	for (int x = 0; x < count; ++x)
+	{
+		float z = scale * src[x];
+		uint16_t* pixel = &dst[4 * x];
+		pixel[0] = floatToHalf(z * rayX[x]);
+		pixel[1] = floatToHalf(z * rayY[x]);
+		pixel[2] = floatToHalf(z);
+		pixel[3] = floatToHalf(z > 0.f ? 1.f : 0.f);
+	}
+}
+
+ScaleRowFunc scaleRow = selectScaleRow();
+DeprojectRowFunc deprojectRow = selectDeprojectRow();
+DeprojectHalfRowFunc deprojectHalfRow = selectDeprojectHalfRow();
+
+const char*
+instructionSet()
+{
+	return theInstructionSet;
+}
+
+}
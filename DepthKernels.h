@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Per-row conversion kernels used by the capture thread.
+//
+// Every kernel has a plain C++ reference version. Faster versions for the
+// instruction sets the CPU supports are picked once when the plugin is
+// loaded, so callers always go through the function pointers below.
+namespace DepthKernels
+{
+	// Converts 'count' Z16 depth values into meters.
+	typedef void (*ScaleRowFunc)(const uint16_t* src, float* dst, int count, float scale);
+
+	// Deprojects 'count' Z16 depth values into RGBA32Float points (x, y, z, 1)
+	// in meters. 'rayX' and 'rayY' hold each pixel's ray at a depth of 1m,
+	// see DeprojectionTable.
+	typedef void (*DeprojectRowFunc)(const uint16_t* src, const float* rayX,
+									const float* rayY, float* dst, int count, float scale);
+
+	// Same as DeprojectRowFunc but writes each point as four IEEE half floats
+	// (x, y, z, valid), 8 bytes per pixel. 'valid' is 1 where the depth is
+	// non-zero and 0 elsewhere.
+	typedef void (*DeprojectHalfRowFunc)(const uint16_t* src, const float* rayX,
+									const float* rayY, uint16_t* dst, int count, float scale);
+
+	// Rounds to the nearest half float, ties to even, like the hardware
+	// conversion instructions do.
+	uint16_t	floatToHalf(float value);
+
+	void		scaleRowScalar(const uint16_t* src, float* dst, int count, float scale);
+	void		deprojectRowScalar(const uint16_t* src, const float* rayX,
+									const float* rayY, float* dst, int count, float scale);
+	void		deprojectHalfRowScalar(const uint16_t* src, const float* rayX,
+									const float* rayY, uint16_t* dst, int count, float scale);
+
+	// Selected at load time from the CPU's features.
+	extern ScaleRowFunc		scaleRow;
+	extern DeprojectRowFunc	deprojectRow;
+	extern DeprojectHalfRowFunc	deprojectHalfRow;
+
+	// Name of the instruction set the selected kernels use, e.g. "AVX2".
+	const char*	instructionSet();
+}
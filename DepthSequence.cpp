@@ -0,0 +1,288 @@
+#include "DepthSequence.h"
+#include "DepthCodec.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+static const char		Magic[8] = { 'R', 'S', 'T', 'O', 'P', 'R', 'V', 'L' };
+static const uint32_t	Version = 1;
+
+bool
+isDepthSequencePath(const std::string& path)
+{
+	static const char Extension[] = ".rvl";
+	size_t length = sizeof(Extension) - 1;
+	if (path.size() < length)
+		return false;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		if (tolower((unsigned char)path[path.size() - length + i]) != Extension[i])
+			return false;
+	}
+	return true;
+}
+
+DepthSequenceWriter::DepthSequenceWriter() :
+	myFile(nullptr),
+	myHeader(),
+	myOffset(0)
+{
+}
+
+DepthSequenceWriter::~DepthSequenceWriter()
+{
+	try
+	{
+		close();
+	}
+	catch (const std::exception&)
+	{
+	}
+}
+
+void
+DepthSequenceWriter::open(const std::string& path, const DepthSequenceHeader& header)
+{
+	close();
+
+	myFile = fopen(path.c_str(), "wb");
+	if (!myFile)
+		throw std::runtime_error("Couldn't create " + path);
+
+	myPath = path;
+	myHeader = header;
+	memcpy(myHeader.magic, Magic, sizeof(Magic));
+	myHeader.version = Version;
+	myHeader.frameCount = 0;
+	myHeader.indexOffset = 0;
+	myIndex.clear();
+	myEncoded.resize(DepthCodec::maxEncodedSize((size_t)header.width * header.height));
+	myOffset = 0;
+
+	// Rewritten by close(). Until then the index offset of 0 marks the file
+	// as unfinished.
+	writeBytes(&myHeader, sizeof(myHeader));
+}
+
+size_t
+DepthSequenceWriter::write(const uint16_t* pixels, double timestamp)
+{
+	size_t count = (size_t)myHeader.width * myHeader.height;
+	size_t size = DepthCodec::encodeRVL(pixels, count, myEncoded.data());
+
+	DepthSequenceEntry entry = {};
+	entry.offset = myOffset;
+	entry.size = (uint32_t)size;
+	entry.timestamp = timestamp;
+
+	writeBytes(myEncoded.data(), size);
+	myIndex.push_back(entry);
+	return size;
+}
+
+void
+DepthSequenceWriter::close()
+{
+	if (!myFile)
+		return;
+
+	FILE* file = myFile;
+	try
+	{
+		myHeader.frameCount = (uint32_t)myIndex.size();
+		myHeader.indexOffset = myOffset;
+		if (!myIndex.empty())
+			writeBytes(myIndex.data(), myIndex.size() * sizeof(DepthSequenceEntry));
+
+		if (fseek(file, 0, SEEK_SET) != 0)
+			throw std::runtime_error("Couldn't finish " + myPath);
+		writeBytes(&myHeader, sizeof(myHeader));
+	}
+	catch (...)
+	{
+		myFile = nullptr;
+		fclose(file);
+		throw;
+	}
+
+	myFile = nullptr;
+	if (fclose(file) != 0)
+		throw std::runtime_error("Couldn't finish " + myPath);
+}
+
+void
+DepthSequenceWriter::writeBytes(const void* data, size_t size)
+{
+	if (fwrite(data, 1, size, myFile) != size)
+		throw std::runtime_error("Couldn't write to " + myPath);
+	myOffset += size;
+}
+
+DepthSequenceReader::DepthSequenceReader() :
+	myData(nullptr),
+	mySize(0),
+	myHeader()
+#ifdef _WIN32
+	, myFile(INVALID_HANDLE_VALUE),
+	myMapping(nullptr)
+#endif
+{
+}
+
+DepthSequenceReader::~DepthSequenceReader()
+{
+	close();
+}
+
+void
+DepthSequenceReader::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+							  OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Couldn't open " + path);
+	myFile = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		close();
+		throw std::runtime_error("Couldn't read " + path);
+	}
+
+	myMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (myMapping)
+		myData = (const uint8_t*)MapViewOfFile(myMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!myData)
+	{
+		close();
+		throw std::runtime_error("Couldn't map " + path);
+	}
+	mySize = (size_t)size.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Couldn't open " + path);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Couldn't read " + path);
+	}
+
+	// The mapping keeps the file alive on its own.
+	void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		throw std::runtime_error("Couldn't map " + path);
+	myData = (const uint8_t*)data;
+	mySize = (size_t)st.st_size;
+	// Frames are read in order most of the time.
+	madvise(data, mySize, MADV_SEQUENTIAL);
+#endif
+
+	if (mySize < sizeof(DepthSequenceHeader))
+	{
+		close();
+		throw std::runtime_error(path + " is not a depth sequence");
+	}
+	memcpy(&myHeader, myData, sizeof(myHeader));
+
+	if (memcmp(myHeader.magic, Magic, sizeof(Magic)) != 0 || myHeader.version != Version)
+	{
+		close();
+		throw std::runtime_error(path + " is not a depth sequence");
+	}
+
+	uint64_t indexSize = (uint64_t)myHeader.frameCount * sizeof(DepthSequenceEntry);
+	if (myHeader.indexOffset < sizeof(DepthSequenceHeader) ||
+		myHeader.indexOffset > mySize || indexSize > mySize - myHeader.indexOffset ||
+		myHeader.width == 0 || myHeader.height == 0)
+	{
+		close();
+		throw std::runtime_error(path + " is incomplete or corrupt");
+	}
+}
+
+void
+DepthSequenceReader::close()
+{
+#ifdef _WIN32
+	if (myData)
+		UnmapViewOfFile(myData);
+	if (myMapping)
+		CloseHandle(myMapping);
+	if (myFile != INVALID_HANDLE_VALUE)
+		CloseHandle(myFile);
+	myMapping = nullptr;
+	myFile = INVALID_HANDLE_VALUE;
+#else
+	if (myData)
+		munmap((void*)myData, mySize);
+#endif
+	myData = nullptr;
+	mySize = 0;
+	myHeader = DepthSequenceHeader();
+}
+
+const DepthSequenceEntry*
+DepthSequenceReader::entry(uint32_t frame) const
+{
+	if (!myData || frame >= myHeader.frameCount)
+		return nullptr;
+	return (const DepthSequenceEntry*)(myData + myHeader.indexOffset) + frame;
+}
+
+double
+DepthSequenceReader::timestamp(uint32_t frame) const
+{
+	const DepthSequenceEntry* e = entry(frame);
+	if (!e)
+		return 0.;
+
+	double timestamp;
+	memcpy(&timestamp, &e->timestamp, sizeof(timestamp));
+	return timestamp;
+}
+
+size_t
+DepthSequenceReader::compressedSize(uint32_t frame) const
+{
+	const DepthSequenceEntry* e = entry(frame);
+	return e ? e->size : 0;
+}
+
+bool
+DepthSequenceReader::decode(uint32_t frame, uint16_t* pixels) const
+{
+	const DepthSequenceEntry* e = entry(frame);
+	if (!e)
+		return false;
+
+	DepthSequenceEntry copy;
+	memcpy(&copy, e, sizeof(copy));
+	if (copy.offset < sizeof(DepthSequenceHeader) || copy.offset > myHeader.indexOffset ||
+		copy.size > myHeader.indexOffset - copy.offset)
+		return false;
+
+	size_t count = (size_t)myHeader.width * myHeader.height;
+	return DepthCodec::decodeRVL(myData + copy.offset, copy.size, pixels, count);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// A file of RVL compressed depth frames (see DepthCodec.h).
+//
+// The file starts with a DepthSequenceHeader, followed by the compressed
+// frames and an index with one DepthSequenceEntry per frame. The index sits
+// at the end so the writer doesn't need to know the frame count up front,
+// and the header points to it once the file is closed. All fields are
+// little-endian.
+
+#pragma pack(push, 1)
+struct DepthSequenceHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	frameCount;
+	float		fps;
+	// Meters per depth unit.
+	float		depthScale;
+	// Intrinsics of the depth stream, laid out like rs2_intrinsics.
+	float		ppx, ppy;
+	float		fx, fy;
+	uint32_t	distortionModel;
+	float		coeffs[5];
+	uint64_t	indexOffset;
+};
+
+struct DepthSequenceEntry
+{
+	uint64_t	offset;
+	uint32_t	size;
+	uint32_t	reserved;
+	// Milliseconds, as reported by the camera.
+	double		timestamp;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(DepthSequenceHeader) == 80, "DepthSequenceHeader layout");
+static_assert(sizeof(DepthSequenceEntry) == 24, "DepthSequenceEntry layout");
+
+// True for paths with the .rvl extension depth sequences are saved with.
+bool	isDepthSequencePath(const std::string& path);
+
+// Appends frames to a new file. Throws std::runtime_error on I/O errors.
+class DepthSequenceWriter
+{
+public:
+	DepthSequenceWriter();
+	~DepthSequenceWriter();
+
+	// The header's magic, version, frameCount and indexOffset are filled in
+	// by the writer.
+	void		open(const std::string& path, const DepthSequenceHeader& header);
+	bool		isOpen() const { return myFile != nullptr; }
+
+	// Compresses and appends a frame of header.width * header.height pixels.
+	// Returns the compressed size in bytes.
+	size_t		write(const uint16_t* pixels, double timestamp);
+
+	// Writes the index and finishes the header. Called by the destructor if
+	// needed, which swallows errors.
+	void		close();
+
+	// Bytes written to the file so far.
+	uint64_t	size() const { return myOffset; }
+
+private:
+	void		writeBytes(const void* data, size_t size);
+
+	FILE*							myFile;
+	std::string						myPath;
+	DepthSequenceHeader				myHeader;
+	std::vector<DepthSequenceEntry>	myIndex;
+	std::vector<uint8_t>			myEncoded;
+	uint64_t						myOffset;
+};
+
+// Reads a finished file through a memory mapping, so any frame can be
+// decoded without reading the ones before it. Safe to use from several
+// threads once open() returns.
+class DepthSequenceReader
+{
+public:
+	DepthSequenceReader();
+	~DepthSequenceReader();
+
+	DepthSequenceReader(const DepthSequenceReader&) = delete;
+	DepthSequenceReader& operator=(const DepthSequenceReader&) = delete;
+
+	// Throws std::runtime_error if the file can't be mapped or isn't a
+	// complete depth sequence.
+	void		open(const std::string& path);
+	void		close();
+	bool		isOpen() const { return myData != nullptr; }
+
+	const DepthSequenceHeader&	header() const { return myHeader; }
+	uint32_t	frameCount() const { return myHeader.frameCount; }
+	double		timestamp(uint32_t frame) const;
+	size_t		compressedSize(uint32_t frame) const;
+
+	// Decodes a frame into width * height pixels. Returns false if the frame
+	// is out of range or corrupt.
+	bool		decode(uint32_t frame, uint16_t* pixels) const;
+
+private:
+	const DepthSequenceEntry*	entry(uint32_t frame) const;
+
+	const uint8_t*			myData;
+	size_t					mySize;
+	DepthSequenceHeader		myHeader;
+#ifdef _WIN32
+	void*					myFile;
+	void*					myMapping;
+#endif
+};
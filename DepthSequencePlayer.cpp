@@ -0,0 +1,335 @@
+#include "DepthSequencePlayer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+// Frames that can be out at once. When the consumer holds on to all of them
+// the player waits, which is what paces non-real-time playback.
+static const size_t PoolSize = 4;
+
+DepthSequencePlayer::DepthSequencePlayer() :
+	myLoop(true),
+	myStopping(false),
+	myWake(false),
+	mySeekFrame(-1),
+	myRealTime(true),
+	mySpeed(1.f),
+	myStatus(RS2_PLAYBACK_STATUS_UNKNOWN)
+{
+}
+
+DepthSequencePlayer::~DepthSequencePlayer()
+{
+	stop();
+
+	// Frames that are still out point into the buffers.
+	std::unique_lock<std::mutex> lock(myMutex);
+	myCondition.wait(lock, [this] { return myFree.size() == myBuffers.size(); });
+}
+
+void
+DepthSequencePlayer::start(const std::string& path, bool loop, bool realtime, float speed,
+						   FrameCallback onFrame, StatusCallback onStatus)
+{
+	stop();
+
+	myReader.open(path);
+	const DepthSequenceHeader& header = myReader.header();
+	if (header.frameCount == 0)
+	{
+		myReader.close();
+		throw std::runtime_error(path + " has no frames.");
+	}
+
+	size_t bytes = HeaderSize + (size_t)header.width * header.height * sizeof(uint16_t);
+	{
+		std::unique_lock<std::mutex> lock(myMutex);
+		myCondition.wait(lock, [this] { return myFree.size() == myBuffers.size(); });
+
+		myBuffers.resize(PoolSize);
+		myFree.clear();
+		for (int i = (int)PoolSize - 1; i >= 0; i--)
+		{
+			if (myBuffers[i].size() != bytes)
+				myBuffers[i].assign(bytes, 0);
+			myFree.push_back(i);
+		}
+
+		myStopping = false;
+		myWake = false;
+		mySeekFrame = -1;
+	}
+
+	myLoop = loop;
+	myRealTime = realtime;
+	mySpeed = speed;
+	myOnFrame = std::move(onFrame);
+	myOnStatus = std::move(onStatus);
+	myStatus = RS2_PLAYBACK_STATUS_UNKNOWN;
+
+	try
+	{
+		myDevice.reset(new rs2::software_device());
+		myDevice->register_info(RS2_CAMERA_INFO_NAME, "RealSense TOP Playback");
+		mySensor.reset(new rs2::software_sensor(myDevice->add_sensor("Depth")));
+		mySensor->add_read_only_option(RS2_OPTION_DEPTH_UNITS, header.depthScale);
+
+		rs2_video_stream vs = {};
+		vs.type = RS2_STREAM_DEPTH;
+		vs.index = 0;
+		vs.uid = 0;
+		vs.width = (int)header.width;
+		vs.height = (int)header.height;
+		vs.fps = fps();
+		vs.bpp = sizeof(uint16_t);
+		vs.fmt = RS2_FORMAT_Z16;
+		vs.intrinsics.width = (int)header.width;
+		vs.intrinsics.height = (int)header.height;
+		vs.intrinsics.ppx = header.ppx;
+		vs.intrinsics.ppy = header.ppy;
+		vs.intrinsics.fx = header.fx;
+		vs.intrinsics.fy = header.fy;
+		vs.intrinsics.model = (rs2_distortion)header.distortionModel;
+		for (int i = 0; i < 5; i++)
+			vs.intrinsics.coeffs[i] = header.coeffs[i];
+		myProfile = mySensor->add_video_stream(vs, true);
+
+		mySensor->open(myProfile);
+		mySensor->start([this](rs2::frame frame) {
+			myOnFrame(std::move(frame));
+		});
+	}
+	catch (...)
+	{
+		mySensor.reset();
+		myDevice.reset();
+		myReader.close();
+		throw;
+	}
+
+	myThread = std::thread(&DepthSequencePlayer::playLoop, this);
+}
+
+void
+DepthSequencePlayer::stop()
+{
+	if (!myThread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myStopping = true;
+	}
+	myCondition.notify_all();
+	myThread.join();
+
+	try
+	{
+		mySensor->stop();
+		mySensor->close();
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "RS2 - Error: " << e.what() << std::endl;
+	}
+	myProfile = rs2::stream_profile();
+	mySensor.reset();
+	myDevice.reset();
+	myReader.close();
+}
+
+int
+DepthSequencePlayer::fps() const
+{
+	return std::max((int)std::lround(myReader.header().fps), 1);
+}
+
+void
+DepthSequencePlayer::setRealTime(bool realtime)
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myRealTime = realtime;
+		myWake = true;
+	}
+	myCondition.notify_all();
+}
+
+void
+DepthSequencePlayer::setSpeed(float speed)
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		mySpeed = speed;
+		myWake = true;
+	}
+	myCondition.notify_all();
+}
+
+void
+DepthSequencePlayer::seek(uint32_t frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		mySeekFrame = frame;
+		myWake = true;
+	}
+	myCondition.notify_all();
+}
+
+int
+DepthSequencePlayer::acquireBuffer()
+{
+	std::unique_lock<std::mutex> lock(myMutex);
+	myCondition.wait(lock, [this] { return !myFree.empty() || myStopping; });
+	if (myStopping)
+		return -1;
+
+	int index = myFree.back();
+	myFree.pop_back();
+	return index;
+}
+
+void
+DepthSequencePlayer::release(int index)
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myFree.push_back(index);
+	}
+	myCondition.notify_all();
+}
+
+void
+DepthSequencePlayer::releasePixels(void* pixels)
+{
+	Header* header = (Header*)((uint8_t*)pixels - HeaderSize);
+	header->owner->release(header->index);
+}
+
+void
+DepthSequencePlayer::setStatus(rs2_playback_status status)
+{
+	if (status == myStatus)
+		return;
+	myStatus = status;
+	if (myOnStatus)
+		myOnStatus(status);
+}
+
+bool
+DepthSequencePlayer::sleepUntil(std::chrono::steady_clock::time_point deadline)
+{
+	std::unique_lock<std::mutex> lock(myMutex);
+	return !myCondition.wait_until(lock, deadline, [this] { return myStopping || myWake; });
+}
+
+void
+DepthSequencePlayer::playLoop()
+{
+	const DepthSequenceHeader& header = myReader.header();
+	uint32_t count = header.frameCount;
+	uint32_t next = 0;
+
+	// Real time playback schedules each frame from its timestamp relative to
+	// an anchor, which moves whenever the timeline jumps or the speed changes.
+	bool anchored = false;
+	std::chrono::steady_clock::time_point wallAnchor;
+	double stampAnchor = 0.;
+	bool lastRealTime = myRealTime;
+	float lastSpeed = mySpeed;
+
+	setStatus(RS2_PLAYBACK_STATUS_PLAYING);
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(myMutex);
+			if (next >= count && !myLoop)
+			{
+				// Hold at the end until there's somewhere else to go.
+				lock.unlock();
+				setStatus(RS2_PLAYBACK_STATUS_STOPPED);
+				lock.lock();
+				myCondition.wait(lock, [this] { return myStopping || mySeekFrame >= 0; });
+			}
+			if (myStopping)
+				break;
+
+			if (mySeekFrame >= 0)
+			{
+				next = (uint32_t)std::min<int64_t>(mySeekFrame, count - 1);
+				mySeekFrame = -1;
+				anchored = false;
+			}
+			myWake = false;
+		}
+		setStatus(RS2_PLAYBACK_STATUS_PLAYING);
+
+		if (next >= count)
+		{
+			next = 0;
+			anchored = false;
+		}
+
+		bool realtime = myRealTime;
+		float speed = std::max(mySpeed.load(), 0.001f);
+		if (realtime != lastRealTime || speed != lastSpeed)
+		{
+			anchored = false;
+			lastRealTime = realtime;
+			lastSpeed = speed;
+		}
+
+		double stamp = myReader.timestamp(next);
+		if (realtime)
+		{
+			if (!anchored)
+			{
+				wallAnchor = std::chrono::steady_clock::now();
+				stampAnchor = stamp;
+				anchored = true;
+			}
+
+			std::chrono::duration<double, std::milli> offset((stamp - stampAnchor) / speed);
+			if (!sleepUntil(wallAnchor +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset)))
+				continue;
+		}
+
+		int index = acquireBuffer();
+		if (index < 0)
+			break;
+
+		Header* bufferHeader = (Header*)myBuffers[index].data();
+		bufferHeader->owner = this;
+		bufferHeader->index = index;
+		uint16_t* pixels = (uint16_t*)(myBuffers[index].data() + HeaderSize);
+
+		if (!myReader.decode(next, pixels))
+		{
+			std::cout << "RS2 - Error: Skipping corrupt frame " << next << " of depth sequence."
+				<< std::endl;
+			release(index);
+			next++;
+			continue;
+		}
+
+		rs2_software_video_frame frame = {};
+		frame.pixels = pixels;
+		frame.deleter = &DepthSequencePlayer::releasePixels;
+		frame.stride = (int)header.width * (int)sizeof(uint16_t);
+		frame.bpp = sizeof(uint16_t);
+		frame.timestamp = stamp;
+		frame.domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+		frame.frame_number = next;
+		frame.profile = myProfile.get();
+		frame.depth_units = header.depthScale;
+
+		// The frame callback runs inside this call.
+		mySensor->on_video_frame(frame);
+		next++;
+	}
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "DepthSequence.h"
+
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Plays a depth sequence file back as rs2 depth frames, standing in for a
+// pipeline streaming from a .bag file.
+//
+// A thread decodes the frames from the memory-mapped file into a few pooled
+// buffers and hands them out through a librealsense software device, with
+// the file's intrinsics and timestamps. Seeking only moves the index the
+// thread reads next, so it costs the same for any frame.
+class DepthSequencePlayer
+{
+public:
+	typedef std::function<void(rs2::frame)>				FrameCallback;
+	typedef std::function<void(rs2_playback_status)>	StatusCallback;
+
+	DepthSequencePlayer();
+	~DepthSequencePlayer();
+
+	// Opens the file and starts playing it. Throws std::runtime_error if the
+	// file can't be read. The callbacks are called on the player's thread.
+	void		start(const std::string& path, bool loop, bool realtime, float speed,
+					  FrameCallback onFrame, StatusCallback onStatus);
+
+	// Stops the thread and closes the file. Frames already handed out stay
+	// valid, and start() waits for them to be released before reusing their
+	// buffers.
+	void		stop();
+
+	bool		playing() const { return myThread.joinable(); }
+
+	const DepthSequenceHeader&	header() const { return myReader.header(); }
+	int			fps() const;
+
+	// Without real time every frame is handed out as soon as the callback
+	// returns from the one before it.
+	void		setRealTime(bool realtime);
+	void		setSpeed(float speed);
+	// Continues from 'frame', clamped to the last one.
+	void		seek(uint32_t frame);
+
+private:
+	struct Header
+	{
+		DepthSequencePlayer*	owner;
+		int						index;
+	};
+	static const size_t		HeaderSize = 64;
+
+	void		playLoop();
+	int			acquireBuffer();
+	void		release(int index);
+	void		setStatus(rs2_playback_status status);
+	// Waits until 'deadline', or until stop(), seek() or a settings change
+	// wakes the thread. Returns false if it was woken.
+	bool		sleepUntil(std::chrono::steady_clock::time_point deadline);
+
+	static void	releasePixels(void* pixels);
+
+	DepthSequenceReader		myReader;
+	bool					myLoop;
+	FrameCallback			myOnFrame;
+	StatusCallback			myOnStatus;
+
+	std::unique_ptr<rs2::software_device>	myDevice;
+	std::unique_ptr<rs2::software_sensor>	mySensor;
+	rs2::stream_profile						myProfile;
+
+	// Pixel buffers, each with a Header in front. Handed to librealsense and
+	// given back through releasePixels().
+	std::vector<std::vector<uint8_t>>	myBuffers;
+	std::vector<int>					myFree;
+
+	std::mutex				myMutex;
+	std::condition_variable	myCondition;
+	bool					myStopping;
+	bool					myWake;
+	int64_t					mySeekFrame;
+
+	std::atomic<bool>		myRealTime;
+	std::atomic<float>		mySpeed;
+	rs2_playback_status		myStatus;
+
+	std::thread				myThread;
+};
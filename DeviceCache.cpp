@@ -0,0 +1,159 @@
+#include "DeviceCache.h"
+
+#include <iostream>
+
+DeviceCache&
+DeviceCache::instance()
+{
+	static DeviceCache theCache;
+	return theCache;
+}
+
+DeviceCache::DeviceCache() :
+	myGeneration(0)
+{
+	// Registered before the first enumeration, so a camera plugged in while
+	// that runs is either in it or reported to the callback, and refresh()
+	// enumerates again if the callback changed the list meanwhile.
+	myContext.set_devices_changed_callback([this](rs2::event_information& info) {
+		onDevicesChanged(info);
+	});
+	refresh();
+}
+
+void
+DeviceCache::refresh()
+{
+	for (;;)
+	{
+		uint64_t generation = myGeneration;
+
+		std::vector<Device> devices;
+		try
+		{
+			for (rs2::device dev : myContext.query_devices())
+			{
+				try
+				{
+					devices.push_back(describe(dev));
+				}
+				catch (const std::exception& e)
+				{
+					std::cout << "RS2 - Error: " << e.what() << std::endl;
+				}
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "RS2 - Error: " << e.what() << std::endl;
+		}
+
+		// A change that was merged into the list while enumerating may not
+		// be in this snapshot, so replacing the list would lose it.
+		std::lock_guard<std::mutex> lock(myMutex);
+		if (myGeneration != generation)
+			continue;
+		myDevices = std::move(devices);
+		myGeneration++;
+		return;
+	}
+}
+
+std::vector<DeviceCache::Device>
+DeviceCache::devices() const
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	return myDevices;
+}
+
+bool
+DeviceCache::find(const std::string& serial, Device& device) const
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	for (const Device& d : myDevices)
+	{
+		if (d.serial == serial)
+		{
+			device = d;
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+DeviceCache::onDevicesChanged(const rs2::event_information& info)
+{
+	// Only the new devices are described, which is what takes time.
+	std::vector<Device> added;
+	try
+	{
+		for (rs2::device dev : info.get_new_devices())
+		{
+			try
+			{
+				added.push_back(describe(dev));
+			}
+			catch (const std::exception& e)
+			{
+				std::cout << "RS2 - Error: " << e.what() << std::endl;
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "RS2 - Error: " << e.what() << std::endl;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+
+		std::vector<Device> kept;
+		for (Device& d : myDevices)
+		{
+			if (info.was_removed(d.device))
+				continue;
+
+			bool replaced = false;
+			for (const Device& a : added)
+				replaced |= a.serial == d.serial;
+			if (!replaced)
+				kept.push_back(std::move(d));
+		}
+		for (Device& a : added)
+			kept.push_back(std::move(a));
+		myDevices = std::move(kept);
+		myGeneration++;
+	}
+}
+
+DeviceCache::Device
+DeviceCache::describe(const rs2::device& dev)
+{
+	Device device;
+	device.device = dev;
+	device.serial = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+	if (dev.supports(RS2_CAMERA_INFO_NAME))
+		device.name = dev.get_info(RS2_CAMERA_INFO_NAME);
+
+	for (rs2::sensor& sensor : dev.query_sensors())
+	{
+		if (!sensor.is<rs2::depth_sensor>())
+			continue;
+
+		for (rs2::stream_profile& p : sensor.get_stream_profiles())
+		{
+			if (p.stream_type() != RS2_STREAM_DEPTH || p.format() != RS2_FORMAT_Z16 ||
+				!p.is<rs2::video_stream_profile>())
+				continue;
+
+			rs2::video_stream_profile vp = p.as<rs2::video_stream_profile>();
+			DepthProfile profile;
+			profile.width = vp.width();
+			profile.height = vp.height();
+			profile.fps = vp.fps();
+			device.depthProfiles.push_back(profile);
+		}
+	}
+	return device;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// The cameras attached to the process.
+//
+// USB enumeration is slow, so it happens once, when the plugin is loaded,
+// and after that the list is kept current by librealsense's devices-changed
+// callback. Every TOP builds its Sensor menu and finds its camera from here
+// instead of querying the devices itself. The cache also owns the
+// rs2::context every pipeline in the process is created on.
+class DeviceCache
+{
+public:
+	struct DepthProfile
+	{
+		int		width;
+		int		height;
+		int		fps;
+	};
+
+	struct Device
+	{
+		std::string					serial;
+		std::string					name;
+		rs2::device					device;
+		// Every Z16 depth profile of the device.
+		std::vector<DepthProfile>	depthProfiles;
+	};
+
+	static DeviceCache&	instance();
+
+	rs2::context&		context() { return myContext; }
+
+	std::vector<Device>	devices() const;
+	// Returns false if no attached camera has this serial number.
+	bool				find(const std::string& serial, Device& device) const;
+
+	// Changes every time a camera is plugged in or unplugged.
+	uint64_t			generation() const { return myGeneration; }
+
+	// Enumerates the devices again right away, for devices added to the
+	// context by the process itself.
+	void				refresh();
+
+private:
+	DeviceCache();
+
+	void				onDevicesChanged(const rs2::event_information& info);
+
+	// Reads what the menus need from the device. Throws if the device went
+	// away in the meantime.
+	static Device		describe(const rs2::device& dev);
+
+	rs2::context			myContext;
+
+	mutable std::mutex		myMutex;
+	std::vector<Device>		myDevices;
+	// Bumped under myMutex with every change to myDevices, so refresh() can
+	// tell whether the callback changed them while it was enumerating.
+	std::atomic<uint64_t>	myGeneration;
+};
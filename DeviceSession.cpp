@@ -0,0 +1,257 @@
+#include "DeviceSession.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+namespace
+{
+
+struct Registry
+{
+	std::mutex												mutex;
+	std::map<std::string, std::weak_ptr<DeviceSession>>		sessions;
+};
+
+Registry&
+registry()
+{
+	static Registry theRegistry;
+	return theRegistry;
+}
+
+}
+
+std::shared_ptr<DeviceSession>
+DeviceSession::acquire(rs2::context& context, const std::string& serial)
+{
+	// Released after the lock, since dropping the last reference to a failed
+	// session takes the lock again in its destructor.
+	std::shared_ptr<DeviceSession> existing;
+
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+
+	std::weak_ptr<DeviceSession>& entry = r.sessions[serial];
+	existing = entry.lock();
+	if (existing && !existing->failed())
+		return existing;
+
+	// A failed session may still be held by TOPs that haven't noticed yet.
+	// They keep it, and until they let go the camera stays busy for this
+	// one.
+	std::shared_ptr<DeviceSession> session(new DeviceSession(context, serial));
+	entry = session;
+	return session;
+}
+
+DeviceSession::DeviceSession(rs2::context& context, const std::string& serial) :
+	mySerial(serial),
+	myPipe(context),
+	myStarted(false),
+	myDepthScale(0.f),
+	myFailed(false),
+	mySubscribers(std::make_shared<SubscriberList>()),
+	myNextId(0)
+{
+}
+
+DeviceSession::~DeviceSession()
+{
+	{
+		std::lock_guard<std::mutex> lock(myStreamMutex);
+		stopLocked();
+	}
+
+	Registry& r = registry();
+	std::lock_guard<std::mutex> registryLock(r.mutex);
+	auto it = r.sessions.find(mySerial);
+	if (it != r.sessions.end() && it->second.expired())
+		r.sessions.erase(it);
+}
+
+int
+DeviceSession::subscribe(FrameCallback callback)
+{
+	std::shared_ptr<Subscriber> subscriber = std::make_shared<Subscriber>();
+	subscriber->callback = std::move(callback);
+	subscriber->removed = false;
+	subscriber->inFlight = 0;
+
+	std::lock_guard<std::mutex> lock(mySubscriberMutex);
+	subscriber->id = myNextId++;
+	std::shared_ptr<SubscriberList> subscribers = std::make_shared<SubscriberList>(*mySubscribers);
+	subscribers->push_back(subscriber);
+	mySubscribers = subscribers;
+	return subscriber->id;
+}
+
+void
+DeviceSession::unsubscribe(int id)
+{
+	std::unique_lock<std::mutex> lock(mySubscriberMutex);
+	std::shared_ptr<SubscriberList> subscribers = std::make_shared<SubscriberList>(*mySubscribers);
+	auto it = std::find_if(subscribers->begin(), subscribers->end(),
+		[id](const std::shared_ptr<Subscriber>& s) { return s->id == id; });
+	if (it == subscribers->end())
+		return;
+
+	std::shared_ptr<Subscriber> subscriber = *it;
+	subscribers->erase(it);
+	mySubscribers = subscribers;
+
+	// A frame already handed out may be in the callback right now.
+	subscriber->removed = true;
+	mySubscriberCondition.wait(lock, [&] { return subscriber->inFlight == 0; });
+}
+
+int
+DeviceSession::subscriberCount() const
+{
+	std::lock_guard<std::mutex> lock(mySubscriberMutex);
+	return (int)mySubscribers->size();
+}
+
+// Whether two video profiles have the same size and frame rate. An empty
+// profile only matches another empty one.
+static bool
+sameProfile(const rs2::video_stream_profile& a, const rs2::video_stream_profile& b)
+{
+	if (!a || !b)
+		return !a && !b;
+	return a.width() == b.width() && a.height() == b.height() && a.fps() == b.fps();
+}
+
+static bool
+sameStreams(const DeviceSession::Streams& a, const DeviceSession::Streams& b)
+{
+	return sameProfile(a.depth, b.depth) && sameProfile(a.color, b.color) &&
+		a.infraredLeft == b.infraredLeft && a.infraredRight == b.infraredRight;
+}
+
+DeviceSession::Streams
+DeviceSession::start(int subscriber, const Streams& wanted)
+{
+	std::lock_guard<std::mutex> lock(myStreamMutex);
+
+	if (myStarted)
+	{
+		bool alone;
+		{
+			std::lock_guard<std::mutex> subscriberLock(mySubscriberMutex);
+			alone = mySubscribers->size() == 1 && (*mySubscribers)[0]->id == subscriber;
+		}
+		if (sameStreams(myStreams, wanted) || !alone)
+			return myStreams;
+
+		stopLocked();
+	}
+
+	const rs2::video_stream_profile& depth = wanted.depth;
+	rs2::config config;
+	config.enable_device(mySerial);
+	config.enable_stream(RS2_STREAM_DEPTH, depth.width(), depth.height(), RS2_FORMAT_Z16,
+		depth.fps());
+	if (wanted.color)
+	{
+		config.enable_stream(RS2_STREAM_COLOR, wanted.color.width(), wanted.color.height(),
+			wanted.color.format(), wanted.color.fps());
+	}
+	// librealsense numbers the left imager 1 and the right one 2.
+	if (wanted.infraredLeft)
+	{
+		config.enable_stream(RS2_STREAM_INFRARED, 1, depth.width(), depth.height(),
+			RS2_FORMAT_Y8, depth.fps());
+	}
+	if (wanted.infraredRight)
+	{
+		config.enable_stream(RS2_STREAM_INFRARED, 2, depth.width(), depth.height(),
+			RS2_FORMAT_Y8, depth.fps());
+	}
+
+	rs2::pipeline_profile profile = myPipe.start(config, [this](rs2::frame frame) {
+		deliver(frame);
+	});
+	if (!profile)
+		throw std::runtime_error("Failed to start the pipeline.");
+	myStarted = true;
+
+	myStreams = wanted;
+	myStreams.depth = profile.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+	if (wanted.color)
+		myStreams.color = profile.get_stream(RS2_STREAM_COLOR).as<rs2::video_stream_profile>();
+	myDepthScale = 0.f;
+	for (rs2::sensor& sensor : profile.get_device().query_sensors())
+	{
+		if (rs2::depth_sensor dpt = sensor.as<rs2::depth_sensor>())
+		{
+			myDepthScale = dpt.get_depth_scale();
+			break;
+		}
+	}
+	return myStreams;
+}
+
+float
+DeviceSession::depthScale() const
+{
+	std::lock_guard<std::mutex> lock(myStreamMutex);
+	return myDepthScale;
+}
+
+void
+DeviceSession::markFailed()
+{
+	std::lock_guard<std::mutex> lock(myStreamMutex);
+	myFailed = true;
+}
+
+bool
+DeviceSession::failed() const
+{
+	std::lock_guard<std::mutex> lock(myStreamMutex);
+	return myFailed;
+}
+
+void
+DeviceSession::deliver(const rs2::frame& frame)
+{
+	// The lock is only held to take the list, so a slow subscriber doesn't
+	// hold up subscribe() or unsubscribe() for the others.
+	std::shared_ptr<const SubscriberList> subscribers;
+	{
+		std::lock_guard<std::mutex> lock(mySubscriberMutex);
+		subscribers = mySubscribers;
+		for (const std::shared_ptr<Subscriber>& subscriber : *subscribers)
+			subscriber->inFlight++;
+	}
+
+	// Frames are reference counted, so every subscriber gets the same one.
+	for (const std::shared_ptr<Subscriber>& subscriber : *subscribers)
+	{
+		if (!subscriber->removed)
+			subscriber->callback(frame);
+
+		std::lock_guard<std::mutex> lock(mySubscriberMutex);
+		if (--subscriber->inFlight == 0 && subscriber->removed)
+			mySubscriberCondition.notify_all();
+	}
+}
+
+void
+DeviceSession::stopLocked()
+{
+	if (!myStarted)
+		return;
+	myStarted = false;
+
+	try
+	{
+		myPipe.stop();
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "RS2 - Error: " << e.what() << std::endl;
+	}
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One camera's depth stream, and its color and infrared streams if a TOP
+// asked for them, shared by every TOP in the process that wants them.
+//
+// Sessions live in a registry keyed by serial number and are reference
+// counted through shared_ptr: the first acquire() opens the camera, and the
+// stream stops once the last holder lets go. Each frame is delivered once by
+// librealsense and handed to every subscriber, so the camera is never opened
+// twice and each TOP only pays for its own conversion.
+class DeviceSession
+{
+public:
+	typedef std::function<void(rs2::frame)> FrameCallback;
+
+	// What's streaming, or wanted to be.
+	struct Streams
+	{
+		rs2::video_stream_profile	depth;
+		// Empty when color isn't streaming.
+		rs2::video_stream_profile	color;
+		// Y8 from the left and right imagers, at the depth profile's size
+		// and frame rate.
+		bool						infraredLeft = false;
+		bool						infraredRight = false;
+	};
+
+	// Returns the session for the camera with this serial number, creating
+	// it if there is none or the existing one failed.
+	static std::shared_ptr<DeviceSession>	acquire(rs2::context& context, const std::string& serial);
+
+	~DeviceSession();
+
+	DeviceSession(const DeviceSession&) = delete;
+	DeviceSession& operator=(const DeviceSession&) = delete;
+
+	const std::string&	serial() const { return mySerial; }
+
+	// Frames arrive on librealsense's thread. Once unsubscribe() returns, the
+	// callback isn't running and won't be called again, so it mustn't be
+	// called from the callback.
+	int			subscribe(FrameCallback callback);
+	void		unsubscribe(int id);
+	int			subscriberCount() const;
+
+	// Streams what 'wanted' asks for. With more than depth, frames arrive
+	// as framesets. If other streams are already running they are only
+	// restarted when 'subscriber' is the only one, otherwise they are kept.
+	// Returns what's streaming. Throws if the streams can't be started.
+	Streams		start(int subscriber, const Streams& wanted);
+
+	// Meters per depth unit of the running stream.
+	float		depthScale() const;
+
+	// Called by a subscriber that gave up on the stream, e.g. because it
+	// stalled. The next acquire() opens a fresh session instead of joining
+	// this one.
+	void		markFailed();
+	bool		failed() const;
+
+private:
+	DeviceSession(rs2::context& context, const std::string& serial);
+
+	void		deliver(const rs2::frame& frame);
+	void		stopLocked();
+
+	struct Subscriber
+	{
+		int					id;
+		FrameCallback		callback;
+		// Set by unsubscribe(), so a frame handed out before then skips it.
+		std::atomic<bool>	removed;
+		// Frames handed out that haven't been through the callback yet.
+		// Guarded by mySubscriberMutex.
+		int					inFlight;
+	};
+	typedef std::vector<std::shared_ptr<Subscriber>> SubscriberList;
+
+	const std::string			mySerial;
+
+	// Guards the pipeline and everything about the running stream.
+	mutable std::mutex			myStreamMutex;
+	rs2::pipeline				myPipe;
+	bool						myStarted;
+	Streams						myStreams;
+	float						myDepthScale;
+	bool						myFailed;
+
+	// Guards the subscribers. The list is replaced rather than changed, so
+	// deliver() only holds the lock to take it, and calls the callbacks
+	// without it.
+	mutable std::mutex						mySubscriberMutex;
+	std::condition_variable					mySubscriberCondition;
+	std::shared_ptr<const SubscriberList>	mySubscribers;
+	int										myNextId;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer
+// thread. The librealsense callback pushes, the capture thread pops.
+//
+// The storage is allocated once with 'capacity' entries. The producer can be
+// limited to fewer queued entries at runtime with setLimit(), which lets the
+// queue depth be a parameter without reallocating while frames are in flight.
+template <typename T>
+class FrameQueue
+{
+public:
+	explicit FrameQueue(size_t capacity) :
+		mySlots(capacity + 1),
+		myLimit(capacity),
+		myHead(0),
+		myTail(0)
+	{
+	}
+
+	size_t		capacity() const { return mySlots.size() - 1; }
+
+	void		setLimit(size_t limit)
+				{
+					if (limit < 1)
+						limit = 1;
+					if (limit > capacity())
+						limit = capacity();
+					myLimit.store(limit, std::memory_order_relaxed);
+				}
+
+	// Producer side. Returns false, leaving 'value' untouched, when the
+	// queue already holds 'limit' entries.
+	bool		push(T&& value)
+				{
+					size_t tail = myTail.load(std::memory_order_relaxed);
+					size_t head = myHead.load(std::memory_order_acquire);
+					size_t count = (tail + mySlots.size() - head) % mySlots.size();
+					if (count >= myLimit.load(std::memory_order_relaxed))
+						return false;
+
+					mySlots[tail] = std::move(value);
+					myTail.store((tail + 1) % mySlots.size(), std::memory_order_release);
+					return true;
+				}
+
+	// Consumer side. Returns false when the queue is empty.
+	bool		pop(T& value)
+				{
+					size_t head = myHead.load(std::memory_order_relaxed);
+					if (head == myTail.load(std::memory_order_acquire))
+						return false;
+
+					value = std::move(mySlots[head]);
+					mySlots[head] = T();
+					myHead.store((head + 1) % mySlots.size(), std::memory_order_release);
+					return true;
+				}
+
+	// Approximate when called from a thread that is neither the producer
+	// nor the consumer.
+	size_t		size() const
+				{
+					size_t tail = myTail.load(std::memory_order_acquire);
+					size_t head = myHead.load(std::memory_order_acquire);
+					return (tail + mySlots.size() - head) % mySlots.size();
+				}
+
+private:
+	std::vector<T>			mySlots;
+	std::atomic<size_t>		myLimit;
+
+	// Kept on separate cache lines so the two threads don't false-share.
+	alignas(64) std::atomic<size_t>	myHead;
+	alignas(64) std::atomic<size_t>	myTail;
+};
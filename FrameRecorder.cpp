@@ -0,0 +1,362 @@
+#include "FrameRecorder.h"
+#include "DepthSequence.h"
+
+#include <librealsense2/hpp/rs_internal.hpp>
+
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+// Size of the file so far, 0 if it doesn't exist yet.
+static int64_t
+fileSize(const std::string& path)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path.c_str(), &st) != 0)
+		return 0;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return 0;
+#endif
+	return (int64_t)st.st_size;
+}
+
+FrameRecorder::FrameRecorder(size_t capacity) :
+	myBuffers(capacity),
+	myReady(capacity),
+	myReadyHead(0),
+	myReadyCount(0),
+	myStopping(false),
+	myGeneration(0),
+	myWidth(0),
+	myHeight(0),
+	myRecording(false)
+{
+	for (int i = (int)capacity - 1; i >= 0; i--)
+		myFree.push_back(i);
+	myStats.capacity = capacity;
+}
+
+FrameRecorder::~FrameRecorder()
+{
+	stop();
+	if (myThread.joinable())
+		myThread.join();
+}
+
+void
+FrameRecorder::start(const std::string& path)
+{
+	stop();
+	if (myThread.joinable())
+		myThread.join();
+
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myStopping = false;
+		myGeneration++;
+		myWidth = 0;
+		myHeight = 0;
+		myStats = Stats();
+		myStats.capacity = myBuffers.size();
+		myPath = path;
+		myError.clear();
+		myRecording = true;
+	}
+	myThread = std::thread(&FrameRecorder::ioLoop, this, path);
+}
+
+void
+FrameRecorder::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		if (!myRecording)
+			return;
+		myRecording = false;
+		myStopping = true;
+	}
+	myCondition.notify_all();
+}
+
+bool
+FrameRecorder::push(const rs2::video_frame& frame, float depthUnits)
+{
+	if (!myRecording)
+		return false;
+
+	int width = frame.get_width();
+	int height = frame.get_height();
+
+	int index;
+	uint64_t generation;
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		if (myStopping)
+			return false;
+		if (myWidth == 0)
+		{
+			myWidth = width;
+			myHeight = height;
+		}
+		if (width != myWidth || height != myHeight || myFree.empty())
+		{
+			myStats.framesDropped++;
+			return false;
+		}
+		index = myFree.back();
+		myFree.pop_back();
+		generation = myGeneration;
+	}
+
+	// The buffer is ours until it's queued, so it can grow here. That only
+	// happens for the first frames of the first recording.
+	Buffer& buffer = myBuffers[index];
+	size_t rowBytes = (size_t)width * sizeof(uint16_t);
+	size_t bytes = HeaderSize + rowBytes * height;
+	if (buffer.storage.size() < bytes)
+		buffer.storage.resize(bytes);
+
+	Header* header = (Header*)buffer.storage.data();
+	header->owner = this;
+	header->index = index;
+
+	const uint8_t* src = (const uint8_t*)frame.get_data();
+	size_t stride = (size_t)frame.get_stride_in_bytes();
+	uint8_t* dst = (uint8_t*)buffer.pixels();
+	if (stride == rowBytes)
+		memcpy(dst, src, rowBytes * height);
+	else
+	{
+		for (int y = 0; y < height; y++)
+			memcpy(dst + y * rowBytes, src + y * stride, rowBytes);
+	}
+
+	buffer.width = width;
+	buffer.height = height;
+	buffer.timestamp = frame.get_timestamp();
+	buffer.domain = frame.get_frame_timestamp_domain();
+	buffer.frameNumber = (int)frame.get_frame_number();
+	rs2::video_stream_profile profile = frame.get_profile().as<rs2::video_stream_profile>();
+	buffer.fps = profile.fps();
+	buffer.intrinsics = profile.get_intrinsics();
+	buffer.depthUnits = depthUnits;
+
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		// The recording was stopped, and maybe another started, while the
+		// frame was being copied.
+		if (myStopping || generation != myGeneration)
+		{
+			myFree.push_back(index);
+			return false;
+		}
+		myReady[(myReadyHead + myReadyCount) % myReady.size()] = index;
+		myReadyCount++;
+		myStats.highWater = std::max(myStats.highWater, myBuffers.size() - myFree.size());
+	}
+	myCondition.notify_one();
+	return true;
+}
+
+FrameRecorder::Stats
+FrameRecorder::stats() const
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	Stats stats = myStats;
+	stats.buffered = myBuffers.size() - myFree.size();
+	return stats;
+}
+
+std::string
+FrameRecorder::path() const
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	return myPath;
+}
+
+std::string
+FrameRecorder::error() const
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	return myError;
+}
+
+void
+FrameRecorder::release(int index)
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	myFree.push_back(index);
+}
+
+void
+FrameRecorder::releasePixels(void* pixels)
+{
+	Header* header = (Header*)((uint8_t*)pixels - HeaderSize);
+	header->owner->release(header->index);
+}
+
+void
+FrameRecorder::fail(const std::string& message)
+{
+	std::cout << "RS2 - Error: " << message << std::endl;
+
+	std::lock_guard<std::mutex> lock(myMutex);
+	if (myError.empty())
+		myError = message;
+}
+
+void
+FrameRecorder::ioLoop(std::string path)
+{
+	// Declared in this order so the recorder is gone before the device it
+	// wraps, and both before the buffers their frames point into.
+	rs2::software_device device;
+	std::unique_ptr<rs2::software_sensor> sensor;
+	std::unique_ptr<rs2::recorder> recorder;
+	rs2::sensor recorded;
+	rs2::stream_profile profile;
+	bool failed = false;
+
+	// .rvl files are compressed by the I/O thread itself instead.
+	bool compressed = isDepthSequencePath(path);
+	DepthSequenceWriter sequence;
+
+	while (true)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(myMutex);
+			myCondition.wait(lock, [this] { return myReadyCount > 0 || myStopping; });
+			if (myReadyCount == 0)
+				break;
+
+			index = myReady[myReadyHead];
+			myReadyHead = (myReadyHead + 1) % myReady.size();
+			myReadyCount--;
+		}
+
+		Buffer& buffer = myBuffers[index];
+		if (failed)
+		{
+			release(index);
+			std::lock_guard<std::mutex> lock(myMutex);
+			myStats.framesDropped++;
+			continue;
+		}
+
+		try
+		{
+			if (compressed)
+			{
+				if (!sequence.isOpen())
+				{
+					DepthSequenceHeader header = {};
+					header.width = (uint32_t)buffer.width;
+					header.height = (uint32_t)buffer.height;
+					header.fps = (float)buffer.fps;
+					header.depthScale = buffer.depthUnits;
+					header.ppx = buffer.intrinsics.ppx;
+					header.ppy = buffer.intrinsics.ppy;
+					header.fx = buffer.intrinsics.fx;
+					header.fy = buffer.intrinsics.fy;
+					header.distortionModel = (uint32_t)buffer.intrinsics.model;
+					for (int i = 0; i < 5; i++)
+						header.coeffs[i] = buffer.intrinsics.coeffs[i];
+					sequence.open(path, header);
+				}
+
+				sequence.write(buffer.pixels(), buffer.timestamp);
+				release(index);
+
+				std::lock_guard<std::mutex> lock(myMutex);
+				myStats.framesWritten++;
+				myStats.bytesWritten = (int64_t)sequence.size();
+				continue;
+			}
+
+			if (!recorder)
+			{
+				// The software device replays exactly the format of the
+				// first frame.
+				sensor.reset(new rs2::software_sensor(device.add_sensor("Depth")));
+				sensor->add_read_only_option(RS2_OPTION_DEPTH_UNITS, buffer.depthUnits);
+
+				rs2_video_stream vs = {};
+				vs.type = RS2_STREAM_DEPTH;
+				vs.index = 0;
+				vs.uid = 0;
+				vs.width = buffer.width;
+				vs.height = buffer.height;
+				vs.fps = buffer.fps;
+				vs.bpp = sizeof(uint16_t);
+				vs.fmt = RS2_FORMAT_Z16;
+				vs.intrinsics = buffer.intrinsics;
+				profile = sensor->add_video_stream(vs, true);
+
+				device.register_info(RS2_CAMERA_INFO_NAME, "RealSense TOP Recording");
+				recorder.reset(new rs2::recorder(path, device));
+
+				// Frames only go through the recorder if its sensor is the
+				// one that's streaming.
+				recorded = recorder->query_sensors().front();
+				recorded.open(profile);
+				recorded.start([](rs2::frame) {});
+			}
+
+			rs2_software_video_frame frame = {};
+			frame.pixels = buffer.pixels();
+			frame.deleter = &FrameRecorder::releasePixels;
+			frame.stride = buffer.width * (int)sizeof(uint16_t);
+			frame.bpp = sizeof(uint16_t);
+			frame.timestamp = buffer.timestamp;
+			frame.domain = buffer.domain;
+			frame.frame_number = buffer.frameNumber;
+			frame.profile = profile.get();
+			frame.depth_units = buffer.depthUnits;
+
+			// librealsense owns the buffer from here and gives it back
+			// through releasePixels() once the frame is written.
+			sensor->on_video_frame(frame);
+
+			int64_t bytes = fileSize(path);
+			std::lock_guard<std::mutex> lock(myMutex);
+			myStats.framesWritten++;
+			myStats.bytesWritten = bytes;
+		}
+		catch (const std::exception& e)
+		{
+			fail(e.what());
+			failed = true;
+			release(index);
+			std::lock_guard<std::mutex> lock(myMutex);
+			myStats.framesDropped++;
+		}
+	}
+
+	// Closing the recorder finishes the file.
+	try
+	{
+		sequence.close();
+		if (recorder)
+		{
+			recorded.stop();
+			recorded.close();
+		}
+	}
+	catch (const std::exception& e)
+	{
+		fail(e.what());
+	}
+	recorded = rs2::sensor();
+	recorder.reset();
+	sensor.reset();
+
+	int64_t bytes = fileSize(path);
+	std::lock_guard<std::mutex> lock(myMutex);
+	myStats.bytesWritten = bytes;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes depth frames to a .bag file, or an RVL compressed .rvl depth
+// sequence (see DepthSequence.h), on a thread of its own.
+//
+// push() copies the frame into one of a fixed number of buffers and returns
+// right away. The I/O thread replays the buffered frames through a
+// librealsense software device wrapped in an rs2::recorder, so a slow disk
+// only fills the buffers. When every buffer is in use new frames are
+// dropped and counted instead of waiting.
+//
+// start() and stop() can be called from any one thread, and push() from
+// another at the same time. start() waits for the previous recording to be
+// written, so it shouldn't be called from the thread that pushes frames:
+// they would back up behind the disk.
+class FrameRecorder
+{
+public:
+	struct Stats
+	{
+		int64_t		framesWritten = 0;
+		// Dropped because every buffer was in use, or the frame didn't match
+		// the format the recording started with.
+		int64_t		framesDropped = 0;
+		// Size of the file on disk.
+		int64_t		bytesWritten = 0;
+		// Buffers holding a frame that hasn't been written yet.
+		size_t		buffered = 0;
+		size_t		highWater = 0;
+		size_t		capacity = 0;
+	};
+
+	explicit FrameRecorder(size_t capacity);
+	~FrameRecorder();
+
+	// Starts a new recording. The file is created by the I/O thread when the
+	// first frame arrives, and every frame has to match that one's format.
+	// Waits for a previous recording that is still being written to finish,
+	// dropping the frames pushed meanwhile.
+	void		start(const std::string& path);
+
+	// Stops taking frames. The I/O thread writes what's buffered, closes the
+	// file and exits on its own.
+	void		stop();
+
+	bool		recording() const { return myRecording; }
+
+	// Returns false if the frame was dropped.
+	bool		push(const rs2::video_frame& frame, float depthUnits);
+
+	Stats		stats() const;
+	std::string	path() const;
+	std::string	error() const;
+
+private:
+	// Lives in front of each buffer's pixels, so the deleter librealsense
+	// calls with the pixel pointer can find its way back.
+	struct Header
+	{
+		FrameRecorder*	owner;
+		int				index;
+	};
+	static const size_t		HeaderSize = 64;
+
+	struct Buffer
+	{
+		std::vector<uint8_t>	storage;
+		int						width = 0;
+		int						height = 0;
+		int						fps = 0;
+		double					timestamp = 0.;
+		rs2_timestamp_domain	domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+		int						frameNumber = 0;
+		rs2_intrinsics			intrinsics = {};
+		float					depthUnits = 0.f;
+
+		uint16_t*				pixels() { return (uint16_t*)(storage.data() + HeaderSize); }
+	};
+
+	void		ioLoop(std::string path);
+	void		release(int index);
+	void		fail(const std::string& message);
+
+	static void	releasePixels(void* pixels);
+
+	std::vector<Buffer>		myBuffers;
+
+	mutable std::mutex		myMutex;
+	std::condition_variable	myCondition;
+	// Indices into myBuffers, guarded by myMutex. myReady is a ring in the
+	// order the frames were pushed.
+	std::vector<int>		myFree;
+	std::vector<int>		myReady;
+	size_t					myReadyHead;
+	size_t					myReadyCount;
+	bool					myStopping;
+	// Bumped by start(), so a frame that push() was copying while one
+	// recording stopped and the next started goes into neither.
+	uint64_t				myGeneration;
+	// Format of the first frame pushed since start().
+	int						myWidth;
+	int						myHeight;
+	Stats					myStats;
+	std::string				myPath;
+	std::string				myError;
+
+	std::thread				myThread;
+	// Changed under myMutex, read without it by recording().
+	std::atomic<bool>		myRecording;
+};
@@ -0,0 +1,104 @@
+#include "PointCompaction.h"
+
+#include <string.h>
+#include <algorithm>
+
+PointCompactor::PointCompactor() :
+	myWidth(0),
+	myHeight(0),
+	myValid(0),
+	myKept(0)
+{
+}
+
+void
+PointCompactor::resize(int width, int height, int bands)
+{
+	myWidth = width;
+	myHeight = height;
+	myDepth.resize((size_t)width * height);
+
+	// Bands without rows would only cost a call each.
+	bands = std::max(std::min(bands, height), 1);
+	myCounts.assign(bands, 0);
+	myOffsets.assign(bands, 0);
+}
+
+void
+PointCompactor::countBand(int band)
+{
+	const float* src = &myDepth[(size_t)bandBegin(band) * myWidth];
+	const float* end = &myDepth[(size_t)bandEnd(band) * myWidth];
+
+	// Branch-free, so the compiler can vectorize it.
+	int count = 0;
+	for (; src < end; ++src)
+		count += *src > 0.f;
+	myCounts[band] = count;
+}
+
+int
+PointCompactor::prefixSum(int maxPoints)
+{
+	int sum = 0;
+	for (int band = 0; band < bandCount(); band++)
+	{
+		myOffsets[band] = sum;
+		sum += myCounts[band];
+	}
+
+	myValid = sum;
+	myKept = maxPoints > 0 ? std::min(sum, maxPoints) : sum;
+	return myKept;
+}
+
+void
+PointCompactor::writeBand(int band, const DeprojectionTable& rays, bool flip, float* dst) const
+{
+	if (myCounts[band] == 0)
+		return;
+
+	// Point k of all valid ones is kept when floor((k + 1) * kept / valid)
+	// steps past floor(k * kept / valid), and goes to the latter index. That
+	// only needs the remainder of k * kept / valid, carried from point to
+	// point, and keeps every point when nothing is dropped.
+	const int64_t valid = myValid;
+	const int64_t kept = myKept;
+	const int64_t first = myOffsets[band];
+	int64_t index = first * kept / valid;
+	int64_t remainder = first * kept % valid;
+
+	for (int y = bandBegin(band); y < bandEnd(band); ++y)
+	{
+		const float* depth = &myDepth[(size_t)y * myWidth];
+		int row = flip ? myHeight - 1 - y : y;
+		const float* rayX = rays.rayX(row);
+		const float* rayY = rays.rayY(row);
+
+		for (int x = 0; x < myWidth; ++x)
+		{
+			float z = depth[x];
+			if (z <= 0.f)
+				continue;
+
+			remainder += kept;
+			if (remainder < valid)
+				continue;
+			remainder -= valid;
+
+			float* point = dst + index * 4;
+			point[0] = rayX[x] * z;
+			point[1] = rayY[x] * z;
+			point[2] = z;
+			point[3] = 1.f;
+			index++;
+		}
+	}
+}
+
+void
+PointCompactor::clearTail(float* dst, int begin, int end) const
+{
+	if (end > begin)
+		memset(dst + ((size_t)myKept + begin) * 4, 0, (size_t)(end - begin) * 4 * sizeof(float));
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Deprojection.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Packs only the points that have depth into the front of the output, for
+// the compact point cloud mode.
+//
+// The frame is first converted to meters, then compacted in two passes over
+// fixed bands of rows. The first counts the points with depth in every band,
+// a prefix sum over those counts gives each band the index its first point
+// goes to, and the second deprojects and writes the points. Both passes can
+// run their bands in parallel, so only the prefix sum over the few band
+// counts is serial, and the points keep the order of the image.
+//
+// With a maximum below the number of points, every point is kept or dropped
+// so that the kept ones are spread evenly over all of them, in the same
+// pass, without another sum.
+class PointCompactor
+{
+public:
+	PointCompactor();
+
+	// Sizes the depth image for 'width' x 'height' pixels, split into at
+	// most 'bands' bands of rows.
+	void		resize(int width, int height, int bands);
+
+	// R32Float meters in output row order, for the conversion to write.
+	float*		depth() { return myDepth.data(); }
+
+	int			bandCount() const { return (int)myCounts.size(); }
+	int			bandBegin(int band) const { return (int)((int64_t)band * myHeight / bandCount()); }
+	int			bandEnd(int band) const { return bandBegin(band + 1); }
+
+	// First pass, counts the pixels of the band with depth above 0.
+	void		countBand(int band);
+
+	// Between the passes, on one thread. Decides where every band's points
+	// go, keeping all of them, or with 'maxPoints' above 0 at most that
+	// many. Returns the number of points the second pass writes.
+	int			prefixSum(int maxPoints);
+
+	// Second pass, writes the kept points of the band to 'dst' as RGBA32Float
+	// with alpha 1. With 'flip' output row y of the depth image is camera row
+	// height - 1 - y, which picks the rays.
+	void		writeBand(int band, const DeprojectionTable& rays, bool flip, float* dst) const;
+
+	// Zeroes the output texels [kept + begin, kept + end), alpha included,
+	// so what's left of the texture after the points reads as unused.
+	void		clearTail(float* dst, int begin, int end) const;
+
+	// Points with depth in the last frame, and how many of them were kept.
+	int			validCount() const { return myValid; }
+	int			keptCount() const { return myKept; }
+
+private:
+	int					myWidth;
+	int					myHeight;
+	std::vector<float>	myDepth;
+
+	// Points with depth per band, and the index among all of them of each
+	// band's first point.
+	std::vector<int>	myCounts;
+	std::vector<int>	myOffsets;
+
+	int					myValid;
+	int					myKept;
+};
@@ -0,0 +1,17 @@
+#pragma once
+
+// Picks the vector instructions that are always there for the target, for
+// the kernels that only use those and so need no runtime check: SSE2 is
+// part of every x86-64 CPU and NEON of every 64-bit ARM one. Defines
+// SIMD_SSE2 or SIMD_NEON, or neither, and includes the matching intrinsics.
+//
+// Kernels that use anything newer go through DepthKernels, which checks
+// the CPU when the plugin is loaded.
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define SIMD_SSE2
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#define SIMD_NEON
+	#include <arm_neon.h>
+#endif
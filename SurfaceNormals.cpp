@@ -0,0 +1,466 @@
+#include "SurfaceNormals.h"
+#include "SimdDetect.h"
+
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// The estimate is written once against the small set of operations below,
+// and runs on either a single float, for the columns at the image's edges
+// and the ones left over, or on 4 of them at a time.
+
+struct Scalar
+{
+	struct Mask
+	{
+		bool	m;
+	};
+
+	float	v;
+
+	static Scalar	load(const float* p) { return { *p }; }
+	static Scalar	splat(float f) { return { f }; }
+};
+
+inline Scalar operator+(Scalar a, Scalar b) { return { a.v + b.v }; }
+inline Scalar operator-(Scalar a, Scalar b) { return { a.v - b.v }; }
+inline Scalar operator*(Scalar a, Scalar b) { return { a.v * b.v }; }
+inline Scalar absOf(Scalar a) { return { std::fabs(a.v) }; }
+inline Scalar minOf(Scalar a, Scalar b) { return { std::min(a.v, b.v) }; }
+inline Scalar rsqrtOf(Scalar a) { return { 1.f / std::sqrt(a.v) }; }
+inline Scalar::Mask greater(Scalar a, Scalar b) { return { a.v > b.v }; }
+inline Scalar::Mask lessEqual(Scalar a, Scalar b) { return { a.v <= b.v }; }
+inline Scalar::Mask operator&(Scalar::Mask a, Scalar::Mask b) { return { a.m && b.m }; }
+inline Scalar select(Scalar::Mask m, Scalar a, Scalar b) { return m.m ? a : b; }
+inline Scalar ones(Scalar::Mask m) { return { m.m ? 1.f : 0.f }; }
+
+inline void
+storeFloat(float* dst, Scalar x, Scalar y, Scalar z, Scalar a)
+{
+	dst[0] = x.v;
+	dst[1] = y.v;
+	dst[2] = z.v;
+	dst[3] = a.v;
+}
+
+// Channels already scaled to [0, 255], rounded to the nearest.
+inline void
+storeFixed(uint8_t* dst, Scalar b, Scalar g, Scalar r, Scalar a)
+{
+	dst[0] = (uint8_t)(b.v + 0.5f);
+	dst[1] = (uint8_t)(g.v + 0.5f);
+	dst[2] = (uint8_t)(r.v + 0.5f);
+	dst[3] = (uint8_t)(a.v + 0.5f);
+}
+
+#if defined(SIMD_SSE2)
+
+struct Vector
+{
+	struct Mask
+	{
+		__m128	m;
+	};
+
+	__m128	v;
+
+	static Vector	load(const float* p) { return { _mm_loadu_ps(p) }; }
+	static Vector	splat(float f) { return { _mm_set1_ps(f) }; }
+};
+
+inline Vector operator+(Vector a, Vector b) { return { _mm_add_ps(a.v, b.v) }; }
+inline Vector operator-(Vector a, Vector b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline Vector operator*(Vector a, Vector b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline Vector absOf(Vector a) { return { _mm_andnot_ps(_mm_set1_ps(-0.f), a.v) }; }
+inline Vector minOf(Vector a, Vector b) { return { _mm_min_ps(a.v, b.v) }; }
+// Exact rather than _mm_rsqrt_ps, so the vectors match the scalar columns.
+inline Vector rsqrtOf(Vector a) { return { _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(a.v)) }; }
+inline Vector::Mask greater(Vector a, Vector b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline Vector::Mask lessEqual(Vector a, Vector b) { return { _mm_cmple_ps(a.v, b.v) }; }
+inline Vector::Mask operator&(Vector::Mask a, Vector::Mask b) { return { _mm_and_ps(a.m, b.m) }; }
+inline Vector select(Vector::Mask m, Vector a, Vector b)
+{
+	return { _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)) };
+}
+inline Vector ones(Vector::Mask m) { return { _mm_and_ps(m.m, _mm_set1_ps(1.f)) }; }
+
+inline void
+storeFloat(float* dst, Vector x, Vector y, Vector z, Vector a)
+{
+	_MM_TRANSPOSE4_PS(x.v, y.v, z.v, a.v);
+	_mm_storeu_ps(dst, x.v);
+	_mm_storeu_ps(dst + 4, y.v);
+	_mm_storeu_ps(dst + 8, z.v);
+	_mm_storeu_ps(dst + 12, a.v);
+}
+
+inline void
+storeFixed(uint8_t* dst, Vector b, Vector g, Vector r, Vector a)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128i vb = _mm_cvttps_epi32(_mm_add_ps(b.v, half));
+	__m128i vg = _mm_cvttps_epi32(_mm_add_ps(g.v, half));
+	__m128i vr = _mm_cvttps_epi32(_mm_add_ps(r.v, half));
+	__m128i va = _mm_cvttps_epi32(_mm_add_ps(a.v, half));
+	__m128i bgra = _mm_or_si128(_mm_or_si128(vb, _mm_slli_epi32(vg, 8)),
+		_mm_or_si128(_mm_slli_epi32(vr, 16), _mm_slli_epi32(va, 24)));
+	_mm_storeu_si128((__m128i*)dst, bgra);
+}
+
+#elif defined(SIMD_NEON)
+
+struct Vector
+{
+	struct Mask
+	{
+		uint32x4_t	m;
+	};
+
+	float32x4_t	v;
+
+	static Vector	load(const float* p) { return { vld1q_f32(p) }; }
+	static Vector	splat(float f) { return { vdupq_n_f32(f) }; }
+};
+
+inline Vector operator+(Vector a, Vector b) { return { vaddq_f32(a.v, b.v) }; }
+inline Vector operator-(Vector a, Vector b) { return { vsubq_f32(a.v, b.v) }; }
+inline Vector operator*(Vector a, Vector b) { return { vmulq_f32(a.v, b.v) }; }
+inline Vector absOf(Vector a) { return { vabsq_f32(a.v) }; }
+inline Vector minOf(Vector a, Vector b) { return { vminq_f32(a.v, b.v) }; }
+inline Vector
+rsqrtOf(Vector a)
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+	return { vdivq_f32(vdupq_n_f32(1.f), vsqrtq_f32(a.v)) };
+#else
+	// 32-bit ARM has no division, two Newton steps refine the estimate to
+	// about float precision.
+	float32x4_t e = vrsqrteq_f32(a.v);
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a.v, e), e));
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a.v, e), e));
+	return { e };
+#endif
+}
+inline Vector::Mask greater(Vector a, Vector b) { return { vcgtq_f32(a.v, b.v) }; }
+inline Vector::Mask lessEqual(Vector a, Vector b) { return { vcleq_f32(a.v, b.v) }; }
+inline Vector::Mask operator&(Vector::Mask a, Vector::Mask b) { return { vandq_u32(a.m, b.m) }; }
+inline Vector select(Vector::Mask m, Vector a, Vector b) { return { vbslq_f32(m.m, a.v, b.v) }; }
+inline Vector
+ones(Vector::Mask m)
+{
+	return { vreinterpretq_f32_u32(vandq_u32(m.m, vreinterpretq_u32_f32(vdupq_n_f32(1.f)))) };
+}
+
+inline void
+storeFloat(float* dst, Vector x, Vector y, Vector z, Vector a)
+{
+	float32x4x4_t pixels;
+	pixels.val[0] = x.v;
+	pixels.val[1] = y.v;
+	pixels.val[2] = z.v;
+	pixels.val[3] = a.v;
+	vst4q_f32(dst, pixels);
+}
+
+inline void
+storeFixed(uint8_t* dst, Vector b, Vector g, Vector r, Vector a)
+{
+	const float32x4_t half = vdupq_n_f32(0.5f);
+	uint32x4_t vb = vcvtq_u32_f32(vaddq_f32(b.v, half));
+	uint32x4_t vg = vcvtq_u32_f32(vaddq_f32(g.v, half));
+	uint32x4_t vr = vcvtq_u32_f32(vaddq_f32(r.v, half));
+	uint32x4_t va = vcvtq_u32_f32(vaddq_f32(a.v, half));
+	uint32x4_t bgra = vorrq_u32(vorrq_u32(vb, vshlq_n_u32(vg, 8)),
+		vorrq_u32(vshlq_n_u32(vr, 16), vshlq_n_u32(va, 24)));
+	vst1q_u8(dst, vreinterpretq_u8_u32(bgra));
+}
+
+#endif
+
+// A pixel's depth and its ray at a depth of 1m.
+template <typename V>
+struct Sample
+{
+	V	z;
+	V	rayX;
+	V	rayY;
+};
+
+// The pixel and its neighbours in the camera image.
+enum Neighbour
+{
+	Center = 0,
+	Left,
+	Right,
+	Up,
+	Down,
+
+	NumNeighbours
+};
+
+// Rows of the depth image and of the rays: the pixel's own, then the camera
+// rows above and below it.
+struct Rows
+{
+	const float*	depth[3];
+	const float*	rayX[3];
+	const float*	rayY[3];
+};
+
+// Pixels x to x + V's width of the row, none of which is in the first or
+// last column.
+template <typename V>
+inline void
+gather(const Rows& rows, int x, Sample<V> s[NumNeighbours])
+{
+	s[Center] = { V::load(rows.depth[0] + x), V::load(rows.rayX[0] + x), V::load(rows.rayY[0] + x) };
+	s[Left] = { V::load(rows.depth[0] + x - 1), V::load(rows.rayX[0] + x - 1),
+		V::load(rows.rayY[0] + x - 1) };
+	s[Right] = { V::load(rows.depth[0] + x + 1), V::load(rows.rayX[0] + x + 1),
+		V::load(rows.rayY[0] + x + 1) };
+	s[Up] = { V::load(rows.depth[1] + x), V::load(rows.rayX[1] + x), V::load(rows.rayY[1] + x) };
+	s[Down] = { V::load(rows.depth[2] + x), V::load(rows.rayX[2] + x), V::load(rows.rayY[2] + x) };
+}
+
+// One pixel anywhere in the row. Neighbours past the first or last column
+// have no depth.
+inline void
+gatherClamped(const Rows& rows, int x, int width, Sample<Scalar> s[NumNeighbours])
+{
+	s[Center] = { { rows.depth[0][x] }, { rows.rayX[0][x] }, { rows.rayY[0][x] } };
+	s[Left] = x > 0 ?
+		Sample<Scalar>{ { rows.depth[0][x - 1] }, { rows.rayX[0][x - 1] }, { rows.rayY[0][x - 1] } } :
+		Sample<Scalar>{ { 0.f }, s[Center].rayX, s[Center].rayY };
+	s[Right] = x + 1 < width ?
+		Sample<Scalar>{ { rows.depth[0][x + 1] }, { rows.rayX[0][x + 1] }, { rows.rayY[0][x + 1] } } :
+		Sample<Scalar>{ { 0.f }, s[Center].rayX, s[Center].rayY };
+	s[Up] = { { rows.depth[1][x] }, { rows.rayX[1][x] }, { rows.rayY[1][x] } };
+	s[Down] = { { rows.depth[2][x] }, { rows.rayX[2][x] }, { rows.rayY[2][x] } };
+}
+
+template <typename V>
+struct Point
+{
+	V	x;
+	V	y;
+	V	z;
+};
+
+template <typename V>
+inline Point<V>
+deproject(const Sample<V>& s)
+{
+	return { s.z * s.rayX, s.z * s.rayY, s.z };
+}
+
+template <typename V>
+inline Point<V>
+select(typename V::Mask m, const Point<V>& a, const Point<V>& b)
+{
+	return { select(m, a.x, b.x), select(m, a.y, b.y), select(m, a.z, b.z) };
+}
+
+template <typename V>
+inline Point<V>
+operator-(const Point<V>& a, const Point<V>& b)
+{
+	return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+template <typename V>
+inline V
+dot(const Point<V>& a, const Point<V>& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// How far the surface bends across the pixel along one tangent, as the
+// angle between the normals there: the second difference of the points
+// along the normal, over the spacing of the points.
+template <typename V>
+inline V
+bend(const Point<V>& normal, const Point<V>& before, const Point<V>& center,
+	 const Point<V>& after, const Point<V>& tangent)
+{
+	Point<V> second = (after - center) - (center - before);
+	V spacing2 = dot(tangent, tangent);
+	V safe = select(greater(spacing2, V::splat(0.f)), spacing2, V::splat(1.f));
+	return V::splat(2.f) * absOf(dot(normal, second)) * rsqrtOf(safe);
+}
+
+template <NormalEstimator::Format F, bool Curvature, typename V>
+inline void
+estimatePixels(const Sample<V> s[NumNeighbours], V edgeRatio, void* dst, int x)
+{
+	const V zero = V::splat(0.f);
+	const V one = V::splat(1.f);
+
+	Point<V> points[NumNeighbours];
+	typename V::Mask same[NumNeighbours];
+	V limit = s[Center].z * edgeRatio;
+	for (int i = 0; i < NumNeighbours; i++)
+	{
+		points[i] = deproject(s[i]);
+		same[i] = greater(s[i].z, zero) & lessEqual(absOf(s[i].z - s[Center].z), limit);
+	}
+	const Point<V>& center = points[Center];
+
+	// Central differences, or one-sided where a neighbour is on another
+	// surface, or none at all.
+	Point<V> alongRow = select(same[Right], points[Right], center) -
+		select(same[Left], points[Left], center);
+	Point<V> alongColumn = select(same[Down], points[Down], center) -
+		select(same[Up], points[Up], center);
+
+	// Down the column cross along the row faces the camera.
+	Point<V> n = {
+		alongColumn.y * alongRow.z - alongColumn.z * alongRow.y,
+		alongColumn.z * alongRow.x - alongColumn.x * alongRow.z,
+		alongColumn.x * alongRow.y - alongColumn.y * alongRow.x,
+	};
+	V length2 = dot(n, n);
+	typename V::Mask valid = greater(s[Center].z, zero) & greater(length2, zero);
+	V scale = rsqrtOf(select(valid, length2, one));
+	n = { select(valid, n.x * scale, zero), select(valid, n.y * scale, zero),
+		select(valid, n.z * scale, zero) };
+
+	V alpha;
+	if (Curvature)
+	{
+		typename V::Mask row = same[Left] & same[Right];
+		typename V::Mask column = same[Up] & same[Down];
+		V bendRow = select(row, bend(n, points[Left], center, points[Right], alongRow), zero);
+		V bendColumn = select(column, bend(n, points[Up], center, points[Down], alongColumn), zero);
+		// The mean of the directions that have both neighbours.
+		V sum = bendRow + bendColumn;
+		alpha = select(valid, select(row & column, sum * V::splat(0.5f), sum), zero);
+	}
+	else
+		alpha = ones(valid);
+
+	if (F == NormalEstimator::Format::Float)
+		storeFloat((float*)dst + x * 4, n.x, n.y, n.z, alpha);
+	else
+	{
+		const V scale8 = V::splat(127.5f);
+		V b = select(valid, n.z * scale8 + scale8, zero);
+		V g = select(valid, n.y * scale8 + scale8, zero);
+		V r = select(valid, n.x * scale8 + scale8, zero);
+		V a = minOf(alpha, one) * V::splat(255.f);
+		storeFixed((uint8_t*)dst + x * 4, b, g, r, a);
+	}
+}
+
+}
+
+NormalEstimator::NormalEstimator() :
+	myWidth(0),
+	myHeight(0)
+{
+}
+
+void
+NormalEstimator::resize(int width, int height)
+{
+	myWidth = width;
+	myHeight = height;
+	myDepth.resize((size_t)width * height);
+	myZeros.assign((size_t)width, 0.f);
+}
+
+template <NormalEstimator::Format F, bool Curvature>
+void
+NormalEstimator::estimate(const DeprojectionTable& rays, bool flip, float edgeRatio,
+						  void* dst, int begin, int end) const
+{
+	int width = myWidth;
+	int height = myHeight;
+	size_t rowBytes = (size_t)width * 4 * (F == Format::Float ? sizeof(float) : 1);
+
+	for (int y = begin; y < end; ++y)
+	{
+		int row = flip ? height - 1 - y : y;
+		// Output rows holding the camera rows above and below.
+		int up = flip ? y + 1 : y - 1;
+		int down = flip ? y - 1 : y + 1;
+
+		Rows rows;
+		rows.depth[0] = &myDepth[(size_t)y * width];
+		rows.rayX[0] = rays.rayX(row);
+		rows.rayY[0] = rays.rayY(row);
+		if (row > 0)
+		{
+			rows.depth[1] = &myDepth[(size_t)up * width];
+			rows.rayX[1] = rays.rayX(row - 1);
+			rows.rayY[1] = rays.rayY(row - 1);
+		}
+		else
+		{
+			rows.depth[1] = myZeros.data();
+			rows.rayX[1] = rows.rayX[0];
+			rows.rayY[1] = rows.rayY[0];
+		}
+		if (row + 1 < height)
+		{
+			rows.depth[2] = &myDepth[(size_t)down * width];
+			rows.rayX[2] = rays.rayX(row + 1);
+			rows.rayY[2] = rays.rayY(row + 1);
+		}
+		else
+		{
+			rows.depth[2] = myZeros.data();
+			rows.rayX[2] = rows.rayX[0];
+			rows.rayY[2] = rows.rayY[0];
+		}
+
+		void* out = (uint8_t*)dst + (size_t)y * rowBytes;
+		Sample<Scalar> pixel[NumNeighbours];
+		int x = 0;
+		if (width > 0)
+		{
+			gatherClamped(rows, 0, width, pixel);
+			estimatePixels<F, Curvature>(pixel, Scalar::splat(edgeRatio), out, 0);
+			x = 1;
+		}
+
+#if defined(SIMD_SSE2) || defined(SIMD_NEON)
+		// Up to the second to last column, which still has a right
+		// neighbour to load.
+		const Vector ratio = Vector::splat(edgeRatio);
+		for (; x + 4 < width; x += 4)
+		{
+			Sample<Vector> pixels[NumNeighbours];
+			gather(rows, x, pixels);
+			estimatePixels<F, Curvature>(pixels, ratio, out, x);
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			gatherClamped(rows, x, width, pixel);
+			estimatePixels<F, Curvature>(pixel, Scalar::splat(edgeRatio), out, x);
+		}
+	}
+}
+
+void
+NormalEstimator::estimateRows(const DeprojectionTable& rays, bool flip, Format format,
+							  bool curvature, float edgeRatio, void* dst, int begin, int end) const
+{
+	if (format == Format::Float)
+	{
+		if (curvature)
+			estimate<Format::Float, true>(rays, flip, edgeRatio, dst, begin, end);
+		else
+			estimate<Format::Float, false>(rays, flip, edgeRatio, dst, begin, end);
+	}
+	else
+	{
+		if (curvature)
+			estimate<Format::Fixed8, true>(rays, flip, edgeRatio, dst, begin, end);
+		else
+			estimate<Format::Fixed8, false>(rays, flip, edgeRatio, dst, begin, end);
+	}
+}
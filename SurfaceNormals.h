@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Deprojection.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Surface normals for the normals Image modes, estimated from the depth
+// image directly.
+//
+// The frame is converted to meters first, like for the Depth mode, and each
+// normal deprojects the pixel and its four neighbours on the fly from that
+// and the rays, so no point cloud is ever written or read back. The normal
+// is the cross product of the tangents along the row and the column,
+// central differences where both neighbours lie on the same surface.
+//
+// A neighbour without depth, or whose depth differs from the pixel's by
+// more than the edge ratio times the pixel's depth, is on another surface,
+// and that side's tangent falls back to the difference with the pixel
+// itself. A pixel left without a tangent in either direction, or without
+// depth, has no normal.
+class NormalEstimator
+{
+public:
+	enum class Format : int32_t
+	{
+		// BGRA8Fixed, each component mapped from [-1, 1] to [0, 255].
+		Fixed8 = 0,
+		// RGBA32Float.
+		Float,
+	};
+
+	NormalEstimator();
+
+	// Sizes the depth image for 'width' x 'height' pixels.
+	void		resize(int width, int height);
+
+	// R32Float meters in output row order, for the conversion to write.
+	float*		depth() { return myDepth.data(); }
+
+	// Writes the normals of output rows [begin, end) to 'dst', facing the
+	// camera. With 'flip' output row y of the depth image is camera row
+	// height - 1 - y, which picks the rays and which rows are above and
+	// below. Alpha is 1 where there's a normal or, with 'curvature', how
+	// much the surface bends per pixel: the angle in radians between
+	// neighbouring normals, 0 on a plane. Pixels without a normal are all 0.
+	// Rows can be estimated in parallel once the whole depth image is there.
+	void		estimateRows(const DeprojectionTable& rays, bool flip, Format format,
+							 bool curvature, float edgeRatio, void* dst, int begin, int end) const;
+
+private:
+	template <Format F, bool Curvature>
+	void		estimate(const DeprojectionTable& rays, bool flip, float edgeRatio,
+						 void* dst, int begin, int end) const;
+
+	int					myWidth;
+	int					myHeight;
+	std::vector<float>	myDepth;
+	// Stands in for the rows above the first and below the last one.
+	std::vector<float>	myZeros;
+};
@@ -0,0 +1,68 @@
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+
+RollingStats::RollingStats(size_t window) :
+	mySamples(std::max<size_t>(window, 1)),
+	myNext(0),
+	myCount(0),
+	myScratch(mySamples.size())
+{
+}
+
+void
+RollingStats::add(double value)
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	mySamples[myNext] = value;
+	myNext = (myNext + 1) % mySamples.size();
+	myCount = std::min(myCount + 1, mySamples.size());
+}
+
+void
+RollingStats::clear()
+{
+	std::lock_guard<std::mutex> lock(myMutex);
+	myNext = 0;
+	myCount = 0;
+}
+
+RollingStats::Summary
+RollingStats::summary() const
+{
+	// The window is small, so working on it under the lock holds up add()
+	// for no longer than a copy would.
+	std::lock_guard<std::mutex> lock(myMutex);
+
+	Summary result;
+	result.count = myCount;
+	if (!myCount)
+		return result;
+
+	std::vector<double>::iterator begin = myScratch.begin();
+	std::vector<double>::iterator end =
+		std::copy(mySamples.begin(), mySamples.begin() + myCount, begin);
+
+	double sum = 0.;
+	result.min = *begin;
+	for (std::vector<double>::iterator it = begin; it != end; ++it)
+	{
+		sum += *it;
+		result.min = std::min(result.min, *it);
+	}
+	result.mean = sum / myCount;
+
+	size_t rank = (myCount * 99 + 99) / 100 - 1;
+	std::nth_element(begin, begin + rank, end);
+	result.p99 = begin[rank];
+
+	return result;
+}
+
+int64_t
+monotonicNanoseconds()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
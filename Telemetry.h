@@ -0,0 +1,45 @@
+#pragma once
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Keeps the last 'window' samples of a measurement so the Info CHOP can show
+// min, mean and 99th percentile over a rolling window instead of a single
+// noisy value. add() and summary() may be called from different threads.
+class RollingStats
+{
+public:
+	struct Summary
+	{
+		double		min = 0.;
+		double		mean = 0.;
+		double		p99 = 0.;
+		size_t		count = 0;
+	};
+
+	explicit RollingStats(size_t window = 120);
+
+	void			add(double value);
+	Summary			summary() const;
+	void			clear();
+
+private:
+	mutable std::mutex		myMutex;
+	std::vector<double>		mySamples;
+	size_t					myNext;
+	size_t					myCount;
+	// Reordered by summary() to find the percentile, sized once so the cook
+	// never allocates for it.
+	mutable std::vector<double>	myScratch;
+};
+
+// Monotonic high-resolution time for measuring intervals, in nanoseconds.
+int64_t				monotonicNanoseconds();
+
+// Milliseconds between two monotonicNanoseconds() values.
+inline double		elapsedMilliseconds(int64_t start, int64_t end)
+					{
+						return (end - start) * 1e-6;
+					}
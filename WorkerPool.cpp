@@ -0,0 +1,180 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <sys/sysctl.h>
+#else
+	#include <fstream>
+	#include <set>
+	#include <string>
+#endif
+
+// More bands than threads so a thread that gets descheduled doesn't hold
+// up the whole frame, but few enough that each band is many rows long.
+static const int BandsPerThread = 4;
+
+WorkerPool::WorkerPool(int threads) :
+	myQuit(false),
+	myJob(0),
+	myFunc(nullptr),
+	myContext(nullptr),
+	myCount(0),
+	myBandSize(1),
+	myBusyThreads(0),
+	myNextBand(0),
+	myNumBands(0)
+{
+	setThreadCount(threads);
+}
+
+WorkerPool::~WorkerPool()
+{
+	stopThreads();
+}
+
+void
+WorkerPool::setThreadCount(int threads)
+{
+	threads = std::max(threads, 1);
+	if (threads == threadCount())
+		return;
+
+	stopThreads();
+
+	myQuit = false;
+	for (int i = 1; i < threads; i++)
+		myThreads.emplace_back(&WorkerPool::threadLoop, this, myJob);
+}
+
+void
+WorkerPool::stopThreads()
+{
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myQuit = true;
+	}
+	myStartCondition.notify_all();
+
+	for (std::thread& thread : myThreads)
+		thread.join();
+	myThreads.clear();
+}
+
+void
+WorkerPool::run(int count, BandFunc func, void* context)
+{
+	if (count <= 0)
+		return;
+
+	if (myThreads.empty())
+	{
+		func(context, 0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(myMutex);
+		myFunc = func;
+		myContext = context;
+		myCount = count;
+		myNumBands = std::min(count, threadCount() * BandsPerThread);
+		myBandSize = (count + myNumBands - 1) / myNumBands;
+		myNextBand = 0;
+		myBusyThreads = (int)myThreads.size();
+		myJob++;
+	}
+	myStartCondition.notify_all();
+
+	workOnBands();
+
+	std::unique_lock<std::mutex> lock(myMutex);
+	myDoneCondition.wait(lock, [this] { return myBusyThreads == 0; });
+}
+
+void
+WorkerPool::workOnBands()
+{
+	for (;;)
+	{
+		int band = myNextBand++;
+		if (band >= myNumBands)
+			break;
+
+		int begin = band * myBandSize;
+		int end = std::min(begin + myBandSize, myCount);
+		if (begin < end)
+			myFunc(myContext, begin, end);
+	}
+}
+
+void
+WorkerPool::threadLoop(int lastJob)
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(myMutex);
+			myStartCondition.wait(lock, [&] { return myQuit || myJob != lastJob; });
+			if (myQuit)
+				return;
+			lastJob = myJob;
+		}
+
+		workOnBands();
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(myMutex);
+			last = --myBusyThreads == 0;
+		}
+		if (last)
+			myDoneCondition.notify_one();
+	}
+}
+
+int
+WorkerPool::physicalCoreCount()
+{
+	int cores = 0;
+
+#ifdef _WIN32
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!info.empty() && GetLogicalProcessorInformation(info.data(), &length))
+	{
+		for (const auto& entry : info)
+		{
+			if (entry.Relationship == RelationProcessorCore)
+				cores++;
+		}
+	}
+#elif defined(__APPLE__)
+	int value = 0;
+	size_t size = sizeof(value);
+	if (sysctlbyname("hw.physicalcpu", &value, &size, nullptr, 0) == 0)
+		cores = value;
+#else
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::set<std::string> seen;
+	std::string line, physical;
+	while (std::getline(cpuinfo, line))
+	{
+		if (line.compare(0, 11, "physical id") == 0)
+			physical = line;
+		else if (line.compare(0, 7, "core id") == 0)
+			seen.insert(physical + line);
+	}
+	cores = (int)seen.size();
+#endif
+
+	if (cores <= 0)
+		cores = (int)std::thread::hardware_concurrency();
+	return std::max(cores, 1);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that split per-row work into bands.
+//
+// The thread calling parallelFor() works on bands too, so a pool with a
+// thread count of N starts N - 1 threads of its own. Threads are only
+// created or destroyed by setThreadCount(), never per frame.
+//
+// parallelFor() must only be called from one thread at a time.
+class WorkerPool
+{
+public:
+	explicit WorkerPool(int threads = 1);
+	~WorkerPool();
+
+	void		setThreadCount(int threads);
+	int			threadCount() const { return (int)myThreads.size() + 1; }
+
+	// Calls func(begin, end) on disjoint bands covering [0, count) and
+	// returns once all of them are done.
+	template <typename Func>
+	void		parallelFor(int count, Func&& func)
+				{
+					run(count, &invokeBand<Func>, &func);
+				}
+
+	// Number of physical cores, not counting SMT siblings.
+	static int	physicalCoreCount();
+
+private:
+	typedef void (*BandFunc)(void* context, int begin, int end);
+
+	template <typename Func>
+	static void	invokeBand(void* context, int begin, int end)
+				{
+					(*(Func*)context)(begin, end);
+				}
+
+	void		run(int count, BandFunc func, void* context);
+	void		workOnBands();
+	// 'lastJob' is the job that was current when the thread was created,
+	// so a job started before the thread gets to run isn't missed.
+	void		threadLoop(int lastJob);
+	void		stopThreads();
+
+	std::vector<std::thread>	myThreads;
+
+	std::mutex					myMutex;
+	std::condition_variable		myStartCondition;
+	std::condition_variable		myDoneCondition;
+	bool						myQuit;
+
+	// The job currently being run. Bumping myJob wakes the threads.
+	int							myJob;
+	BandFunc					myFunc;
+	void*						myContext;
+	int							myCount;
+	int							myBandSize;
+	int							myBusyThreads;
+
+	std::atomic<int>			myNextBand;
+	int							myNumBands;
+};